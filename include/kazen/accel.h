@@ -1,33 +1,329 @@
 #pragma once
 
 #include <kazen/object.h>
+#include <kazen/mesh.h>
+#include <kazen/instance.h>
+#include <kazen/particles.h>
+#include <kazen/mmap.h>
+#if defined(KAZEN_USE_EMBREE)
+#  include <kazen/embree.h>
+#endif
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 NAMESPACE_BEGIN(kazen)
 
+#define KAZEN_BVH_WIDTH 8 /* Branching factor of the traversal hierarchy (4 or 8) */
+
+/* Count a traversal step in the statistics of the calling thread (see \ref AccelStatistics) */
+#if defined(KAZEN_ENABLE_ACCEL_STATS)
+#  define KAZEN_ACCEL_STAT(counter, value) Accel::getThreadStatistics().counter += (uint64_t) (value)
+#else
+#  define KAZEN_ACCEL_STAT(counter, value) do { } while (0)
+#endif
+
+/**
+ * \brief Traversal counters of \ref Accel
+ *
+ * The counters and their accessors in \ref Accel only exist when kazen is
+ * compiled with \c KAZEN_ENABLE_ACCEL_STATS. Every thread counts into its own copy, so
+ * that counting does not need any synchronization. Rays of a packet are
+ * counted individually: a node that is tested for four active lanes
+ * counts as four visits.
+ */
+struct AccelStatistics {
+    uint64_t rays = 0;          ///< Intersection and occlusion queries
+    uint64_t nodes = 0;         ///< Visited inner nodes
+    uint64_t boxes = 0;         ///< Tested child bounding boxes
+    uint64_t triangles = 0;     ///< Ray-triangle tests
+    uint64_t particles = 0;     ///< Ray-particle tests
+
+    /// Relative cost of the counted work, used for heatmaps
+    uint64_t cost() const { return nodes + triangles + particles; }
+
+    AccelStatistics &operator+=(const AccelStatistics &other) {
+        rays += other.rays; nodes += other.nodes; boxes += other.boxes; triangles += other.triangles;
+        particles += other.particles;
+        return *this;
+    }
+
+    AccelStatistics operator-(const AccelStatistics &other) const {
+        AccelStatistics result;
+        result.rays = rays - other.rays;
+        result.nodes = nodes - other.nodes;
+        result.boxes = boxes - other.boxes;
+        result.triangles = triangles - other.triangles;
+        result.particles = particles - other.particles;
+        return result;
+    }
+
+    /// Return a human-readable summary with per-ray averages
+    std::string toString() const;
+};
+
 /**
  * \brief Acceleration data structure for ray intersection queries
  *
- * The current implementation falls back to a brute force loop
- * through the geometry.
+ * The triangles of all registered meshes are organized in a bounding volume
+ * hierarchy (BVH). The hierarchy is constructed in parallel using the binned
+ * surface area heuristic (SAH): at every node, primitive centroids are
+ * dropped into a fixed number of bins along each axis, and the split plane
+ * between two bins with the lowest expected traversal cost is chosen.
+ *
+ * The binary hierarchy is then collapsed into \ref KAZEN_BVH_WIDTH -wide
+ * nodes, whose child bounds are intersected with a single SIMD slab test.
+ * Optionally, these are further compressed into \ref QuantizedBVHNode
+ * records to reduce the memory footprint of very large scenes.
+ *
+ * Scenes with many long and thin triangles can optionally be built as a
+ * spatial-split BVH (SBVH), which clips primitive references against split
+ * planes when this reduces the overlap of sibling nodes. Where build time
+ * matters more than traversal performance, a linear BVH (LBVH) can be
+ * built from the primitives sorted by the Morton codes of their centroids.
+ *
+ * Triangles are not fetched through the index and vertex buffers of their
+ * meshes during traversal. After every build, the vertex positions of the
+ * triangles referenced by the leaves are copied into structure-of-arrays
+ * records in leaf order, so that a ray is tested against up to
+ * \ref KAZEN_BVH_WIDTH triangles of a leaf at once with a watertight
+ * SIMD kernel.
+ *
+ * Meshes with several key frames (see \ref Mesh::addTimeStep()) are motion
+ * blurred. The hierarchy is built once over the bounds of the triangles
+ * across the entire shutter interval, but every wide node additionally
+ * stores the bounds of its children at each key frame. Traversal
+ * interpolates these at the time of the ray, so that a fast-moving
+ * triangle only occupies the space it covers at that time.
+ *
+ * Analytic spheres and disks (see \ref Particles) are leaf primitives as
+ * well. Their centers and radii are copied into structure-of-arrays records
+ * next to the triangle records, and up to \ref KAZEN_BVH_WIDTH particles of
+ * a leaf are intersected at once by solving their quadratics in SIMD.
+ *
+ * Meshes that are placed through an \ref Instance are not copied into the
+ * hierarchy. Instead, every referenced mesh gets its own bottom-level
+ * \ref Accel, and the instances are leaf primitives of this (top-level)
+ * hierarchy. Rays that reach an instance are transformed into its object
+ * space and traverse the shared bottom-level hierarchy.
+ *
+ * Meshes and instances can also be added and removed after \ref build() (see
+ * \ref update()), while other threads keep tracing rays.
  */
 class Accel {
+    friend struct BVHBuildTask;
+    friend struct SBVHBuildTask;
+    friend struct LBVHBuildTask;
 public:
     using Float = enoki::Packet<float>;
     KAZEN_BASE_TYPES()
+    using Intersection3f       = Intersection<Float>;
+    using ScalarIntersection3f = Intersection<ScalarFloat>;
+    using ScalarIndex          = uint32_t;
+    using ScalarSize           = uint32_t;
+
+    /// Node encodings available for traversal
+    enum ENodeFormat {
+        EWideNodes = 0,     ///< Full-precision wide nodes (default)
+        EQuantizedNodes     ///< Wide nodes with 8-bit quantized child bounds
+    };
+
+    /// Strategies for constructing the hierarchy
+    enum EBuilder {
+        ESAHBuilder = 0,    ///< Top-down binned SAH (default, optionally with spatial splits)
+        ELinearBuilder      ///< Morton code sorting (LBVH), optionally SAH in the top levels
+    };
+
+    /**
+     * \brief Create a new and empty acceleration data structure
+     *
+     * The node encoding is selected with the string property
+     * \c nodeFormat, which is either \c "wide" or \c "quantized".
+     * The float property \c refitThreshold controls when \ref refit()
+     * falls back to a full rebuild. Setting the boolean property
+     * \c spatialSplits enables the SBVH build, in which case the float
+     * property \c spatialSplitBudget limits the number of additional
+     * primitive references (relative to the number of primitives).
+     *
+     * The string property \c builder selects the construction strategy:
+     * \c "sah" (default) or \c "lbvh". The LBVH builder trades traversal
+     * performance for much faster builds, which pays off when geometry is
+     * rebuilt often, e.g. during look-dev. The integer property
+     * \c lbvhSahLevels sets the number of top levels it splits with the
+     * SAH instead (default: 0).
+     *
+     * The boolean property \c reorderNodes (default: \c true) enables the
+     * cache-friendly node order of \ref reorderNodes() for wide nodes.
+     *
+     * If the string property \c cacheDir is set, built hierarchies are
+     * stored in that directory and reused by later runs (see \ref build()).
+     *
+     * The string property \c backend selects the implementation of the
+     * intersection queries: \c "kazen" (default) uses the hierarchy
+     * described above, and \c "embree" uses \ref EmbreeAccel, which
+     * requires kazen to be configured with \c KAZEN_USE_EMBREE. The other
+     * properties only apply to the \c "kazen" backend.
+     */
+    Accel(const PropertyList &props = PropertyList());
+
+    /// Release all memory
+    ~Accel();
 
     /**
      * \brief Register a triangle mesh for inclusion in the acceleration
      * data structure
      *
-     * This function can only be used before \ref build() is called
+     * After \ref build(), the mesh is only visible to intersection queries
+     * once \ref update() has been called.
      */
     void addMesh(Mesh *mesh);
 
-    /// Build the acceleration data structure (currently a no-op)
+    /**
+     * \brief Register a placement of a (possibly shared) mesh
+     *
+     * After \ref build(), the instance is only visible to intersection
+     * queries once \ref update() has been called.
+     */
+    void addInstance(const Instance *instance);
+
+    /**
+     * \brief Register a set of analytic spheres or disks
+     *
+     * Particles are stored directly in the top-level hierarchy and have to
+     * be registered before \ref build().
+     */
+    void addParticles(const Particles *particles);
+
+    /**
+     * \brief Remove a previously registered mesh
+     *
+     * After \ref build(), the mesh remains visible to intersection queries
+     * (and must stay alive) until \ref update() returns.
+     */
+    void removeMesh(const Mesh *mesh);
+
+    /**
+     * \brief Remove a previously registered instance
+     *
+     * To move an object, remove its instance and add a new one with the new
+     * transformation. After \ref build(), the instance remains visible to
+     * intersection queries (and must stay alive) until \ref update() returns.
+     */
+    void removeInstance(const Instance *instance);
+
+    /**
+     * \brief Apply the meshes and instances added or removed since
+     * \ref build() or the last update
+     *
+     * The first update moves every mesh into its own bottom-level hierarchy,
+     * placed with an identity transformation, so that the top-level
+     * hierarchy only holds one primitive per object. From then on, an update
+     * only builds the bottom-level hierarchies of new meshes and rebuilds
+     * the top-level hierarchy over the bounds of the objects, which is cheap
+     * compared to a full \ref build().
+     *
+     * This costs traversal performance: rays that reach a mesh pass through
+     * an additional top-level leaf, and the top-level hierarchy cannot
+     * separate overlapping meshes as well as a hierarchy over their
+     * triangles. Identity instances skip the ray transformation, but scenes
+     * with many large, overlapping meshes are still traced faster after a
+     * full \ref build() (compare both with <tt>kazen --bench-rays</tt>).
+     *
+     * \ref refit() after an update refits a copy of the published hierarchy
+     * and publishes it in the same way. The copy shares the bottom-level
+     * hierarchies of meshes that did not move, so only the top level and
+     * the moved meshes temporarily need twice the memory.
+     *
+     * Intersection queries only announce themselves to updates once a
+     * hierarchy has been published, so that scenes that are never edited
+     * do not pay for it. Queries that started before the first update may
+     * therefore still use the hierarchy of the initial build. It is kept
+     * until the acceleration data structure is destroyed, and meshes
+     * removed by the first update must stay alive until such queries have
+     * finished.
+     *
+     * The new hierarchy is built next to the current one and published
+     * atomically: intersection queries running concurrently with the update
+     * use either the old or the new contents, and the old hierarchy is only
+     * released once no query uses it anymore. Updates themselves are
+     * serialized.
+     */
+    void update();
+
+    /**
+     * \brief Build the acceleration data structure
+     *
+     * If a cache directory was specified, the node and index arrays are
+     * looked up in a cache file named after a hash of the mesh data,
+     * instance transformations and build settings. On a hit, the file is
+     * memory-mapped and used for traversal as is. Otherwise the hierarchy
+     * is built and written to the cache.
+     */
     void build();
 
+    /**
+     * \brief Update the hierarchy after vertex positions have changed
+     *
+     * The bounds of all nodes are recomputed bottom-up in parallel while
+     * the topology of the hierarchy is kept, which is much cheaper than
+     * \ref build(). Bottom-level hierarchies of instanced meshes are
+     * refit as well, unless the mesh did not change since the last refit
+     * (see \ref Mesh::getRevision()).
+     *
+     * Refitting degrades the quality of the hierarchy as geometry moves
+     * away from the configuration it was built for. Once the SAH cost of
+     * the refit hierarchy exceeds that of the last full build by more
+     * than the factor \c refitThreshold, the hierarchy is rebuilt.
+     *
+     * \return \c true if the hierarchy was refit, \c false if it was rebuilt
+     */
+    bool refit();
+
     /// Return an axis-aligned box that bounds the scene
-    const BoundingBox3f &getBoundingBox() const { return m_bbox; }
+    const ScalarBoundingBox3f &getBoundingBox() const { return m_bbox; }
+
+    /// Return the total number of primitives (triangles, particles and instances) in the top-level hierarchy
+    ScalarSize getPrimitiveCount() const { return getInstanceBase() + (ScalarSize) m_instances.size(); }
+
+    /// Return the number of triangles stored directly in this hierarchy
+    ScalarSize getTriangleCount() const { return m_meshOffset.back(); }
+
+    /// Return the number of particles stored in this hierarchy
+    ScalarSize getParticleCount() const { return m_particleOffset.back(); }
+
+    /// Return the number of registered instances
+    ScalarSize getInstanceCount() const { return (ScalarSize) m_instances.size(); }
+
+    /// Return the node encoding used for traversal
+    ENodeFormat getNodeFormat() const { return m_nodeFormat; }
+
+    /// Return the number of key frames of the moving meshes (1 if all meshes are static)
+    ScalarSize getTimeStepCount() const { return m_timeSteps; }
+
+    /// Are intersection queries forwarded to Embree?
+    bool usesEmbree() const {
+#if defined(KAZEN_USE_EMBREE)
+        return (bool) m_embree;
+#else
+        return false;
+#endif
+    }
+
+    /// Return the total number of BVH nodes used for traversal
+    ScalarSize getNodeCount() const { return m_nodeCount; }
+
+    /// Return the memory used by the traversal nodes, primitive indices and triangle records in bytes
+    size_t getMemoryUsage() const {
+        return (size_t) m_nodeCount * (m_nodeFormat == EQuantizedNodes ? sizeof(QuantizedBVHNode) : sizeof(WideBVHNode)) +
+               m_motionBounds.size() * sizeof(MotionBounds) +
+               (size_t) m_indexCount * sizeof(ScalarIndex) +
+               m_triangleData.size() * sizeof(ScalarFloat) +
+               m_triangleIndices.size() * sizeof(ScalarIndex) +
+               m_particleData.size() * sizeof(ScalarFloat) +
+               m_particleIndices.size() * sizeof(ScalarIndex);
+    }
 
     /**
      * \brief Intersect a ray against all triangles stored in the scene and
@@ -44,16 +340,704 @@ public:
      * \param shadowRay
      *    \c true if this is a shadow ray query, i.e. a query that only aims to
      *    find out whether the ray is blocked or not without returning detailed
-     *    intersection information.
+     *    intersection information. Such queries are forwarded to
+     *    \ref rayTest(), and \c its is left untouched.
      *
      * \return \c true if an intersection was found
      */
-    bool rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay) const;
+    bool rayIntersect(const ScalarRay3f &ray, ScalarIntersection3f &its, bool shadowRay = false) const;
+
+    /**
+     * \brief Intersect a packet of rays against all triangles stored in the
+     * scene and return detailed intersection information
+     *
+     * The packet is traversed as a whole: every node is tested once for all
+     * active lanes, lanes that miss a node are masked off, and all lanes
+     * share a single traversal stack. Once fewer than a quarter of the
+     * lanes remain active in a subtree, the remaining rays finish that
+     * subtree individually.
+     *
+     * \return A mask of the lanes for which an intersection was found
+     */
+    Mask rayIntersect(const Ray3f &ray, Intersection3f &its, bool shadowRay = false, Mask active = true) const;
+
+    /**
+     * \brief Test whether a ray segment is occluded by any primitive
+     *
+     * This is the dedicated entry point for shadow rays. The traversal
+     * stops at the first intersection that is found, no matter how far
+     * along the ray it lies, and children are visited in storage order
+     * instead of being sorted by their distance.
+     *
+     * \return \c true if the ray segment is occluded
+     */
+    bool rayTest(const ScalarRay3f &ray) const;
+
+    /// Test a packet of ray segments for occlusion (see above)
+    Mask rayTest(const Ray3f &ray, Mask active = true) const;
+
+    /// Return a human-readable summary of the acceleration data structure
+    std::string toString() const;
+
+#if defined(KAZEN_ENABLE_ACCEL_STATS)
+    /// Return the traversal counters of the calling thread
+    static AccelStatistics &getThreadStatistics();
+
+    /**
+     * \brief Return the sum of the traversal counters of all threads
+     *
+     * Must not be called while rays are being traced.
+     */
+    static AccelStatistics getStatistics();
+
+    /// Reset the traversal counters of all threads (must not be called while rays are being traced)
+    static void resetStatistics();
+#endif
+
+protected:
+    /**
+     * \brief Compact BVH node representation
+     *
+     * Inner nodes store the split axis and the index of their right child;
+     * the left child always directly follows its parent in memory. Leaf
+     * nodes reference a contiguous range of \ref m_indices.
+     */
+    struct BVHNode {
+        union {
+            struct {
+                unsigned flag : 1;
+                uint32_t size : 31;
+                uint32_t start;
+            } leaf;
+
+            struct {
+                unsigned flag : 1;
+                uint32_t axis : 31;
+                uint32_t rightChild;
+            } inner;
+
+            uint64_t data = 0;
+        };
+        ScalarBoundingBox3f bbox;
+
+        bool isLeaf() const { return leaf.flag == 1; }
+        bool isInner() const { return leaf.flag == 0; }
+        uint32_t start() const { return leaf.start; }
+        uint32_t end() const { return leaf.start + leaf.size; }
+    };
+
+    /**
+     * \brief Intersect a ray with \ref KAZEN_BVH_WIDTH boxes at once
+     *
+     * \param oRcp
+     *    Ray origin multiplied by the reciprocal ray direction
+     * \param dRcp
+     *    Reciprocal ray direction, which must be finite: an infinite
+     *    component turns the bounds of that axis into NaNs
+     * \param valid
+     *    Boxes that should be considered at all
+     *
+     * \return The entry distance of every box that is hit within
+     *    <tt>[mint, maxt]</tt>, and \c Infinity for all others
+     */
+    template <typename FloatP>
+    static KAZEN_INLINE FloatP slabTest(const Vector<FloatP, 3> &bmin, const Vector<FloatP, 3> &bmax,
+                                        const Vector<FloatP, 3> &oRcp, const Vector<FloatP, 3> &dRcp,
+                                        const FloatP &mint, const FloatP &maxt, const mask_t<FloatP> &valid) {
+        Vector<FloatP, 3> t1 = fmsub(bmin, dRcp, oRcp),
+                          t2 = fmsub(bmax, dRcp, oRcp);
+        Vector<FloatP, 3> t1p = min(t1, t2),
+                          t2p = max(t1, t2);
+
+        FloatP tNear = max(max(t1p.x(), t1p.y()), max(t1p.z(), mint)),
+               tFar  = min(min(t2p.x(), t2p.y()), min(t2p.z(), maxt));
+
+        return select(valid && tNear <= tFar, tNear, math::Infinity<FloatP>);
+    }
+
+    /**
+     * \brief Wide BVH node with \ref KAZEN_BVH_WIDTH children
+     *
+     * The child bounds are stored in structure-of-arrays layout so that a
+     * ray can be tested against all of them using one packet slab test.
+     * A child is either another wide node (\c count == 0), a leaf covering
+     * \c count entries of \ref m_indices starting at \c child, or an empty
+     * slot (\c count == \ref EmptySlot).
+     *
+     * Nodes are aligned to cache lines, so that a node never touches more
+     * cache lines than its size requires.
+     */
+    struct alignas(64) WideBVHNode {
+        using FloatP  = Packet<ScalarFloat, KAZEN_BVH_WIDTH>;
+        using UInt32P = Packet<uint32_t, KAZEN_BVH_WIDTH>;
+        using MaskP   = mask_t<FloatP>;
+
+        static constexpr uint32_t EmptySlot = (uint32_t) -1;
+
+        FloatP minX, minY, minZ;
+        FloatP maxX, maxY, maxZ;
+        UInt32P child;
+        UInt32P count = EmptySlot;
+
+        /// Intersect a ray with the bounds of all children (see \ref slabTest())
+        KAZEN_INLINE FloatP rayIntersect(const Vector<FloatP, 3> &oRcp, const Vector<FloatP, 3> &dRcp,
+                                         const FloatP &mint, const FloatP &maxt) const {
+            return slabTest(Vector<FloatP, 3>(minX, minY, minZ),
+                            Vector<FloatP, 3>(maxX, maxY, maxZ),
+                            oRcp, dRcp, mint, maxt, neq(count, EmptySlot));
+        }
+
+        /// Return the node index (or primitive range) referenced by the given child
+        KAZEN_INLINE void getChild(uint32_t i, uint32_t &target, uint32_t &size) const {
+            target = child[i];
+            size = count[i];
+        }
+
+        /// Return the bounds of the given child, or \c false for an empty slot
+        KAZEN_INLINE bool getChildBounds(uint32_t i, ScalarBoundingBox3f &bbox) const {
+            if (count[i] == EmptySlot)
+                return false;
+            bbox = ScalarBoundingBox3f(ScalarPoint3f(minX[i], minY[i], minZ[i]),
+                                       ScalarPoint3f(maxX[i], maxY[i], maxZ[i]));
+            return true;
+        }
+
+        /// Is the given child slot unused?
+        KAZEN_INLINE bool isEmpty(uint32_t i) const { return count[i] == EmptySlot; }
+
+        /// Return the number of non-empty child slots
+        uint32_t getChildCount() const { return (uint32_t) enoki::count(neq(count, EmptySlot)); }
+
+        /// Replace the bounds of all non-empty children
+        void setChildBounds(const ScalarBoundingBox3f *bounds) {
+            for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+                if (isEmpty(i))
+                    continue;
+                minX[i] = bounds[i].min.x(); maxX[i] = bounds[i].max.x();
+                minY[i] = bounds[i].min.y(); maxY[i] = bounds[i].max.y();
+                minZ[i] = bounds[i].min.z(); maxZ[i] = bounds[i].max.z();
+            }
+        }
+    };
+
+    /**
+     * \brief Child bounds of a \ref WideBVHNode at a single key frame
+     *
+     * Hierarchies over moving meshes store one record per key frame and
+     * node. The bounds at any time are linearly interpolated between the
+     * records of the enclosing key frames, which bounds the linearly
+     * interpolated vertex positions.
+     */
+    struct alignas(64) MotionBounds {
+        using FloatP = WideBVHNode::FloatP;
+
+        FloatP minX, minY, minZ;
+        FloatP maxX, maxY, maxZ;
+    };
+
+    /**
+     * \brief Key frame interval containing the time of a ray
+     *
+     * \c index is the key frame preceding the time, and \c weight is the
+     * relative position between that key frame and the next one.
+     */
+    template <typename Value> struct TimeSegment {
+        using Index = uint32_array_t<Value>;
+
+        Index index;
+        Value weight;
+
+        TimeSegment(const Value &time, ScalarSize timeSteps) {
+            ScalarSize segments = std::max(timeSteps, (ScalarSize) 2) - 1;
+            Value t = clamp(time, 0.f, 1.f) * (ScalarFloat) segments;
+            index = min(Index(t), segments - 1);
+            weight = t - Value(index);
+        }
+    };
+
+    /**
+     * \brief Compressed variant of \ref WideBVHNode
+     *
+     * Child bounds are stored as 8-bit offsets on a per-node grid spanned by
+     * \c origin and power-of-two cell sizes, rounded outward so that the
+     * decoded boxes always contain the original ones. The inner children of
+     * a node are stored consecutively starting at \c childBase, and the
+     * primitives of its leaf children are stored consecutively in
+     * \ref m_indices starting at \c primBase. This needs about a third of
+     * the memory of a \ref WideBVHNode.
+     */
+    struct QuantizedBVHNode {
+        using FloatP  = WideBVHNode::FloatP;
+        using UInt32P = WideBVHNode::UInt32P;
+
+        /// Values of \c count: inner child, largest leaf, empty slot
+        static constexpr uint8_t InnerChild = 0;
+        static constexpr uint8_t MaxLeafSize = 254;
+        static constexpr uint8_t EmptySlot = 255;
+
+        float origin[3];                        ///< Minimum corner of the quantization grid
+        int8_t exponent[3];                     ///< Cell size along each axis is 2^exponent
+        uint32_t childBase;                     ///< Index of the first inner child
+        uint32_t primBase;                      ///< Index of the first primitive of the leaf children
+        uint8_t count[KAZEN_BVH_WIDTH];         ///< Child type / leaf primitive count
+        uint8_t qmin[3][KAZEN_BVH_WIDTH];       ///< Quantized lower child bounds
+        uint8_t qmax[3][KAZEN_BVH_WIDTH];       ///< Quantized upper child bounds
+
+        /// Return the size of a grid cell along the given axis
+        KAZEN_INLINE float scale(int axis) const {
+            return memcpy_cast<float>(uint32_t(exponent[axis] + 127) << 23);
+        }
+
+        /// Decode the child bounds and intersect them with a ray (see \ref slabTest())
+        KAZEN_INLINE FloatP rayIntersect(const Vector<FloatP, 3> &oRcp, const Vector<FloatP, 3> &dRcp,
+                                         const FloatP &mint, const FloatP &maxt) const {
+            alignas(alignof(FloatP)) float lo[3][KAZEN_BVH_WIDTH], hi[3][KAZEN_BVH_WIDTH];
+            alignas(alignof(UInt32P)) uint32_t valid[KAZEN_BVH_WIDTH];
+
+            for (int axis = 0; axis < 3; ++axis) {
+                float s = scale(axis);
+                for (int i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+                    lo[axis][i] = fmadd((float) qmin[axis][i], s, origin[axis]);
+                    hi[axis][i] = fmadd((float) qmax[axis][i], s, origin[axis]);
+                }
+            }
+            for (int i = 0; i < KAZEN_BVH_WIDTH; ++i)
+                valid[i] = count[i];
+
+            return slabTest(Vector<FloatP, 3>(load<FloatP>(lo[0]), load<FloatP>(lo[1]), load<FloatP>(lo[2])),
+                            Vector<FloatP, 3>(load<FloatP>(hi[0]), load<FloatP>(hi[1]), load<FloatP>(hi[2])),
+                            oRcp, dRcp, mint, maxt, neq(load<UInt32P>(valid), (uint32_t) EmptySlot));
+        }
+
+        /// Return the node index (or primitive range) referenced by the given child
+        KAZEN_INLINE void getChild(uint32_t i, uint32_t &target, uint32_t &size) const {
+            uint32_t innerBefore = 0, primsBefore = 0;
+            for (uint32_t j = 0; j < i; ++j) {
+                if (count[j] == InnerChild)
+                    innerBefore++;
+                else if (count[j] != EmptySlot)
+                    primsBefore += count[j];
+            }
+
+            if (count[i] == InnerChild) {
+                target = childBase + innerBefore;
+                size = 0;
+            } else {
+                target = primBase + primsBefore;
+                size = count[i];
+            }
+        }
+
+        /// Return the decoded bounds of the given child, or \c false for an empty slot
+        KAZEN_INLINE bool getChildBounds(uint32_t i, ScalarBoundingBox3f &bbox) const {
+            if (count[i] == EmptySlot)
+                return false;
+            for (int axis = 0; axis < 3; ++axis) {
+                float s = scale(axis);
+                bbox.min[axis] = fmadd((float) qmin[axis][i], s, origin[axis]);
+                bbox.max[axis] = fmadd((float) qmax[axis][i], s, origin[axis]);
+            }
+            return true;
+        }
+
+        /// Is the given child slot unused?
+        KAZEN_INLINE bool isEmpty(uint32_t i) const { return count[i] == EmptySlot; }
+
+        /// Return the number of non-empty child slots
+        uint32_t getChildCount() const {
+            uint32_t result = 0;
+            for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i)
+                result += count[i] != EmptySlot;
+            return result;
+        }
+
+        /**
+         * \brief Set up the quantization grid for the given bounds of all
+         * non-empty children and encode them, rounding outward
+         */
+        void setChildBounds(const ScalarBoundingBox3f *bounds);
+    };
+
+    /**
+     * \brief Per-ray constants of the watertight ray-triangle test
+     *
+     * The axes are permuted such that the largest component of the ray
+     * direction becomes \c z, and triangles are sheared such that the ray
+     * direction becomes the \c z axis. The edge functions are then evaluated
+     * in 2D in the same way for both triangles sharing an edge, so that rays
+     * cannot slip through between them (Woop et al., "Watertight
+     * Ray/Triangle Intersection", JCGT 2013).
+     */
+    template <typename Value> struct WatertightRay {
+        using Index  = uint32_array_t<Value>;
+        using Point3 = Point<Value, 3>;
+
+        Point3 o;               ///< Ray origin
+        Index kx, ky, kz;       ///< Permuted axes
+        Value sx, sy, sz;       ///< Shear constants
+
+        WatertightRay(const Ray<Point3> &ray);
+    };
+
+    using TriangleFloatP = WideBVHNode::FloatP;
+    using TriangleMaskP  = WideBVHNode::MaskP;
+
+    /**
+     * \brief Compute the mesh and triangle indices corresponding to
+     * a primitive index used by the underlying generic BVH implementation.
+     */
+    ScalarIndex findMesh(ScalarIndex &idx) const {
+        auto it = std::lower_bound(m_meshOffset.begin(), m_meshOffset.end(), idx + 1) - 1;
+        idx -= *it;
+        return (ScalarIndex) (it - m_meshOffset.begin());
+    }
+
+    /**
+     * \brief Compute the particle set and particle indices corresponding to
+     * a primitive index in <tt>[getTriangleCount(), getInstanceBase())</tt>
+     */
+    ScalarIndex findParticles(ScalarIndex &idx) const {
+        idx -= getTriangleCount();
+        auto it = std::lower_bound(m_particleOffset.begin(), m_particleOffset.end(), idx + 1) - 1;
+        idx -= *it;
+        return (ScalarIndex) (it - m_particleOffset.begin());
+    }
+
+    /// Return the primitive index of the first instance (instances follow the triangles and particles)
+    ScalarIndex getInstanceBase() const { return getTriangleCount() + getParticleCount(); }
+
+    /// Return the bounding box of the given primitive over the entire shutter interval
+    ScalarBoundingBox3f getBoundingBox(ScalarIndex index) const {
+        if (index >= getInstanceBase())
+            return m_instanceBBoxes[index - getInstanceBase()];
+        if (index >= getTriangleCount()) {
+            ScalarIndex setIdx = findParticles(index);
+            return m_particles[setIdx]->getBoundingBox(index);
+        }
+        ScalarIndex meshIdx = findMesh(index);
+        return m_meshes[meshIdx]->getBoundingBox(index);
+    }
+
+    /// Return the bounding box of the given primitive at the given key frame (particles do not move)
+    ScalarBoundingBox3f getBoundingBox(ScalarIndex index, ScalarSize timeStep) const {
+        if (index >= getTriangleCount())
+            return getBoundingBox(index);
+        const Mesh *mesh = m_meshes[findMesh(index)];
+        return mesh->getBoundingBox(index, mesh->getTimeStepCount() > 1 ? timeStep : 0u);
+    }
+
+    /**
+     * \brief Fill in the remaining fields of an intersection record
+     *
+     * \param index
+     *    Primitive index of a triangle or particle, relative to the
+     *    bottom-level hierarchy if the triangle was hit through an instance
+     * \param instance
+     *    Index of the instance that was hit, or \ref NoInstance
+     * \param ray
+     *    The ray that was traced. Its time determines the positions of
+     *    moving vertices.
+     */
+    void setHitInformation(ScalarIndex index, ScalarIndex instance, const ScalarRay3f &ray,
+                           ScalarIntersection3f &its) const;
+
+    /// Fill in the remaining fields of an intersection record for a triangle of the given mesh
+    static void setHitInformation(const Mesh *mesh, ScalarIndex index, ScalarFloat time,
+                                  ScalarIntersection3f &its);
+
+    /// Fill in the remaining fields of an intersection record for a particle of the given set
+    static void setHitInformation(const Particles *particles, ScalarIndex index, const ScalarRay3f &ray,
+                                  ScalarIntersection3f &its);
+
+    /// Intersect a ray with the given instance, updating \c ray.maxt on success
+    bool intersectInstance(ScalarIndex instance, ScalarRay3f &ray, ScalarIndex &f, ScalarPoint2f &uv) const;
+
+    /// Intersect a packet of rays with the given instance (see above)
+    Mask intersectInstance(ScalarIndex instance, Ray3f &ray, UInt32 &f, Float &u, Float &v, Mask active) const;
+
+    /// Test whether a ray is occluded by the given instance
+    bool occludedInstance(ScalarIndex instance, const ScalarRay3f &ray) const;
+
+    /// Test whether a packet of rays is occluded by the given instance
+    Mask occludedInstance(ScalarIndex instance, const Ray3f &ray, Mask active) const;
+
+    /// Compute the SAH cost of the subtree rooted at the given node
+    ScalarFloat statistics(ScalarIndex nodeIdx, ScalarSize &leafCount) const;
+
+    /// Collapse the binary subtree rooted at \c nodeIdx into wide nodes and return the new root
+    ScalarIndex collapse(ScalarIndex nodeIdx);
+
+    /**
+     * \brief Reorder the wide nodes and primitive indices for traversal
+     *
+     * Nodes are stored depth-first, visiting the inner child with the
+     * largest surface area (i.e. the one most likely to be traversed) first,
+     * so that it directly follows its parent in memory. The primitives of
+     * all leaf children of a node are stored consecutively, in the order in
+     * which their parents are stored, so that the triangle records touched
+     * by neighboring nodes are adjacent as well.
+     */
+    void reorderNodes();
+
+    /**
+     * \brief Compute the \ref MotionBounds of the subtree rooted at the given
+     * wide node, storing the bounds of the entire subtree at every key frame
+     * in \c bounds
+     */
+    void updateMotionBounds(ScalarIndex nodeIdx, uint32_t depth, ScalarBoundingBox3f *bounds);
+
+    /// Recompute \ref m_motionBounds after the hierarchy or the vertex positions have changed
+    void updateMotionBounds();
+
+    /**
+     * \brief Intersect a ray with the children of a node at the time of the ray
+     *
+     * Uses the bounds stored in the node if all meshes are static
+     * (see \ref slabTest()).
+     */
+    template <typename Node, typename FloatP = typename Node::FloatP>
+    KAZEN_INLINE FloatP intersectChildren(const Node &node, ScalarIndex nodeIdx, const TimeSegment<ScalarFloat> &segment,
+                                          const Vector<FloatP, 3> &oRcp, const Vector<FloatP, 3> &dRcp,
+                                          const FloatP &mint, const FloatP &maxt) const;
+
+    /// Return the bounds of a child of a node at the (per-lane) time of a packet of rays
+    template <typename Node>
+    KAZEN_INLINE bool getChildBounds(const Node &node, ScalarIndex nodeIdx, uint32_t i,
+                                     const TimeSegment<Float> &segment, BoundingBox3f &bbox) const;
+
+    /// Start tracking edits made after \ref build() (the caller holds \ref m_updateMutex)
+    void startEditing();
+
+    /// Create an empty hierarchy with the same build settings
+    std::unique_ptr<Accel> createChild() const;
+
+    /**
+     * \brief Create a copy of a built hierarchy that can be refit
+     * independently
+     *
+     * Used by \ref refit() to modify a published hierarchy without touching
+     * the nodes that running queries may be reading. Bottom-level
+     * hierarchies of meshes that moved since their last refit are copied,
+     * the others are shared with this hierarchy (\ref refit() leaves them
+     * untouched).
+     */
+    std::unique_ptr<Accel> copy() const;
+
+    /**
+     * \brief Build one bottom-level hierarchy for every mesh referenced by
+     * an instance
+     *
+     * The hierarchies are built concurrently, largest meshes first, and
+     * the builds of large meshes are parallel themselves.
+     */
+    void buildBottomLevel();
+
+    /// Return the hierarchy published by the last \ref update(), or \c nullptr
+    const Accel *getSnapshot() const { return m_snapshot.load(); }
+
+    /// Build the hierarchy from scratch (bottom-level hierarchies must already exist)
+    void buildHierarchy();
+
+    /// Point the traversal data to the node and index arrays of the last build
+    void updateTraversalData();
+
+    /// Copy the vertex positions of all triangles referenced by the leaves into \ref m_triangleData
+    void updateTriangleData();
+
+    /// Copy the centers and radii of all particles referenced by the leaves into \ref m_particleData
+    void updateParticleData();
+
+    /**
+     * \brief Return the particle record plane of the given center axis (0..2),
+     * or of the radius (3)
+     *
+     * The radius of disks is stored negated.
+     */
+    const ScalarFloat *getParticleData(uint32_t plane) const {
+        return m_particleData.data() + (size_t) plane * m_triangleStride;
+    }
+
+    /// Return the triangle record coordinates of the given vertex (0..2) and axis at the given key frame
+    const ScalarFloat *getTriangleData(uint32_t vertex, uint32_t axis, uint32_t timeStep = 0) const {
+        return m_triangleData.data() + (size_t) (timeStep * 9 + vertex * 3 + axis) * m_triangleStride;
+    }
+
+    /**
+     * \brief Intersect a ray with the triangle records of up to
+     * \ref KAZEN_BVH_WIDTH consecutive index slots starting at \c slot
+     *
+     * Slots that reference instances are ignored. Moving triangles are
+     * interpolated to the time given by \c segment.
+     *
+     * \return A mask of the slots whose triangle is hit within the ray segment
+     */
+    TriangleMaskP intersectTriangles(ScalarIndex slot, ScalarSize count, const WatertightRay<ScalarFloat> &wray,
+                                     const TimeSegment<ScalarFloat> &segment, const ScalarRay3f &ray,
+                                     TriangleFloatP &t, TriangleFloatP &u, TriangleFloatP &v) const;
+
+    /// Intersect a packet of rays with the triangle record of the given index slot
+    Mask intersectTriangle(ScalarIndex slot, const WatertightRay<Float> &wray, const TimeSegment<Float> &segment,
+                           const Ray3f &ray, Float &t, Float &u, Float &v, Mask active) const;
+
+    /**
+     * \brief Intersect a ray with the particle records of up to
+     * \ref KAZEN_BVH_WIDTH consecutive index slots starting at \c slot
+     *
+     * Slots that do not reference particles are ignored.
+     *
+     * \return A mask of the slots whose particle is hit within the ray segment
+     */
+    TriangleMaskP intersectParticles(ScalarIndex slot, ScalarSize count, const ScalarRay3f &ray,
+                                     TriangleFloatP &t) const;
+
+    /// Intersect a packet of rays with the particle record of the given index slot
+    Mask intersectParticle(ScalarIndex slot, const Ray3f &ray, Float &t, Mask active) const;
+
+    /// Return the traversal nodes in the given encoding
+    template <typename Node>
+    Node *getNodes() const { return (Node *) m_nodeData; }
+
+    /// Compute the cache key of the current geometry and build settings
+    uint64_t cacheKey() const;
+
+    /// Try to memory-map the hierarchy from the given cache file, which is validated against the current geometry
+    bool loadCache(const std::string &filename, uint64_t key);
+
+    /// Write the hierarchy to the given cache file
+    void writeCache(const std::string &filename, uint64_t key) const;
+
+    /// Recompute the bounds of the subtree rooted at the given node and return its bounds
+    template <typename Node>
+    ScalarBoundingBox3f refit(Node *nodes, ScalarIndex nodeIdx, uint32_t depth);
+
+    /// Compute the SAH cost of the subtree rooted at the given wide node
+    template <typename Node>
+    ScalarFloat sahCost(const Node *nodes, ScalarIndex nodeIdx) const;
+
+    /// Compute the SAH cost of the traversal hierarchy
+    ScalarFloat sahCost() const {
+        if (getNodeCount() == 0)
+            return 0.f;
+        return m_nodeFormat == EQuantizedNodes
+            ? sahCost(getNodes<QuantizedBVHNode>(), 0u)
+            : sahCost(getNodes<WideBVHNode>(), 0u);
+    }
+
+    /// Sum up the revisions of the meshes (see \ref Mesh::getRevision())
+    uint64_t getGeometryRevision() const;
+
+    /// Convert the wide nodes into quantized nodes (reorders \ref m_indices)
+    void quantize();
+
+    /**
+     * \brief Traverse the subtree of the given wide node hierarchy with a
+     * single ray, updating \c ray.maxt to the closest intersection
+     *
+     * \param root
+     *    Index of the node (or first primitive) the traversal starts with
+     * \param rootCount
+     *    0 if \c root is a node, or else the number of primitives
+     * \param instance
+     *    Set to the index of the instance containing triangle \c f, or
+     *    to \ref NoInstance for triangles of this hierarchy
+     */
+    template <typename Node>
+    bool traverse(const Node *nodes, ScalarRay3f &ray, ScalarIndex root, ScalarSize rootCount,
+                  ScalarIndex &f, ScalarIndex &instance, ScalarPoint2f &uv) const;
+
+    /// Traverse the given wide node hierarchy with a packet of rays
+    template <typename Node>
+    Mask traversePacket(const Node *nodes, const Ray3f &ray, UInt32 &f, UInt32 &instance,
+                        Float &t, Float &u, Float &v, Mask active) const;
+
+    /**
+     * \brief Traverse the subtree of the given wide node hierarchy with a
+     * single ray until any intersection is found (see \ref rayTest())
+     */
+    template <typename Node>
+    bool occluded(const Node *nodes, const ScalarRay3f &ray, ScalarIndex root, ScalarSize rootCount) const;
+
+    /// Traverse the given wide node hierarchy with a packet of occlusion rays
+    template <typename Node>
+    Mask occludedPacket(const Node *nodes, const Ray3f &ray, Mask active) const;
+
+    /// Traverse the hierarchy in the selected node format with a single ray
+    bool traverse(ScalarRay3f &ray, ScalarIndex &f, ScalarIndex &instance, ScalarPoint2f &uv) const {
+        return m_nodeFormat == EQuantizedNodes
+            ? traverse(getNodes<QuantizedBVHNode>(), ray, 0u, 0u, f, instance, uv)
+            : traverse(getNodes<WideBVHNode>(), ray, 0u, 0u, f, instance, uv);
+    }
+
+    /// Traverse the hierarchy in the selected node format with a packet of rays
+    Mask traversePacket(const Ray3f &ray, UInt32 &f, UInt32 &instance, Float &t, Float &u, Float &v,
+                        Mask active) const {
+        return m_nodeFormat == EQuantizedNodes
+            ? traversePacket(getNodes<QuantizedBVHNode>(), ray, f, instance, t, u, v, active)
+            : traversePacket(getNodes<WideBVHNode>(), ray, f, instance, t, u, v, active);
+    }
+
+    /// Instance index reported for triangles that are stored directly in this hierarchy
+    static constexpr ScalarIndex NoInstance = (ScalarIndex) -1;
+
+    /// Entry of \ref m_triangleIndices for index slots that do not reference a triangle
+    static constexpr ScalarIndex NoTriangle = (ScalarIndex) -1;
+
+    /// Entry of \ref m_particleIndices for index slots that do not reference a particle
+    static constexpr ScalarIndex NoParticle = (ScalarIndex) -1;
 
 private:
-    std::vector<Mesh *> m_meshes;   ///< Meshes
-    BoundingBox3f m_bbox;           ///< Bounding box of the entire scene
+    std::vector<Mesh *> m_meshes;           ///< Meshes
+    std::vector<ScalarIndex> m_meshOffset;  ///< Index of the first triangle for each mesh
+    std::vector<const Particles *> m_particles;         ///< Particle sets (primitives following the triangles)
+    std::vector<ScalarIndex> m_particleOffset;          ///< Index of the first particle for each particle set
+    std::vector<const Instance *> m_instances;          ///< Instances (primitives following the particles)
+    std::vector<ScalarBoundingBox3f> m_instanceBBoxes;  ///< World-space bounds of every instance
+    std::vector<const Accel *> m_instanceAccels;        ///< Bottom-level hierarchy of every instance
+    std::unordered_map<const Mesh *, std::shared_ptr<Accel>> m_bottomLevel; ///< Shared bottom-level hierarchies
+    bool m_verbose = true;                  ///< Print build statistics?
+    ScalarFloat m_refitThreshold;           ///< Relative SAH cost increase that triggers a rebuild
+    EBuilder m_builder = ESAHBuilder;       ///< Construction strategy
+    uint32_t m_lbvhSahLevels = 0;           ///< Number of top levels of an LBVH that are split with the SAH
+    bool m_spatialSplits;                   ///< Build a spatial-split BVH?
+    bool m_reorderNodes;                    ///< Reorder the wide nodes after the build?
+    ScalarFloat m_spatialSplitBudget;       ///< Maximum relative number of duplicated references
+    ScalarFloat m_buildCost = 0.f;          ///< SAH cost of the traversal hierarchy after the last build
+    uint64_t m_geometryRevision = 0;        ///< Value of \ref getGeometryRevision() at the last build or refit
+    std::string m_cacheDir;                 ///< Directory of the on-disk BVH cache (empty: disabled)
+    uint64_t m_cacheKey = 0;                ///< Cache key of the last build
+    ENodeFormat m_nodeFormat = EWideNodes;  ///< Node encoding used for traversal
+    std::vector<BVHNode> m_nodes;           ///< Binary BVH nodes (only during construction)
+    std::vector<WideBVHNode> m_wideNodes;   ///< Wide BVH nodes
+    std::vector<QuantizedBVHNode> m_quantizedNodes; ///< Quantized wide BVH nodes
+    std::vector<MotionBounds> m_motionBounds; ///< Child bounds of every wide node at every key frame (moving meshes only)
+    ScalarSize m_timeSteps = 1;             ///< Number of key frames of the moving meshes
+    std::vector<ScalarIndex> m_indices;     ///< Index references by BVH nodes
+    void *m_nodeData = nullptr;             ///< Traversal nodes (in one of the arrays above, or memory-mapped)
+    ScalarIndex *m_indexData = nullptr;     ///< Primitive indices referenced by the traversal nodes
+    ScalarSize m_nodeCount = 0;             ///< Number of traversal nodes
+    ScalarSize m_indexCount = 0;            ///< Number of primitive indices
+    std::vector<ScalarFloat> m_triangleData;    ///< Triangle vertex coordinates per index slot (9 padded SoA arrays per key frame)
+    std::vector<ScalarIndex> m_triangleIndices; ///< Triangle referenced by every index slot, or \ref NoTriangle
+    ScalarSize m_triangleStride = 0;        ///< Length of each array in \ref m_triangleData and \ref m_particleData
+    std::vector<ScalarFloat> m_particleData;    ///< Particle centers and radii per index slot (4 padded SoA arrays)
+    std::vector<ScalarIndex> m_particleIndices; ///< Primitive index of the particle referenced by every index slot, or \ref NoParticle
+    std::unique_ptr<MemoryMappedFile> m_cacheFile; ///< Memory-mapped cache file, if the hierarchy was loaded from it
+#if defined(KAZEN_USE_EMBREE)
+    std::unique_ptr<EmbreeAccel> m_embree;  ///< Embree backend, if selected
+#endif
+    ScalarBoundingBox3f m_bbox;             ///< Bounding box of the entire scene
+
+    /* Incremental updates (see \ref update()) */
+    bool m_built = false;                   ///< Has \ref build() been called?
+    bool m_editing = false;                 ///< Have objects been added or removed after the build?
+    bool m_pendingEdits = false;            ///< Are there edits that have not been applied by \ref update()?
+    std::vector<Mesh *> m_sceneMeshes;      ///< Current meshes including edits (only while editing)
+    std::vector<const Instance *> m_sceneInstances; ///< Current instances including edits (only while editing)
+    std::unordered_map<const Mesh *, std::shared_ptr<const Instance>> m_meshInstances; ///< Identity instances of the current meshes
+    std::vector<std::shared_ptr<const Instance>> m_ownedInstances; ///< Identity instances referenced by this hierarchy
+    std::atomic<Accel *> m_snapshot { nullptr }; ///< Hierarchy that queries are forwarded to after an update
+    std::mutex m_updateMutex;               ///< Serializes edits and updates
 };
 
 
-NAMESPACE_END(kazen)
\ No newline at end of file
+NAMESPACE_END(kazen)
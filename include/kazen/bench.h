@@ -0,0 +1,156 @@
+#pragma once
+
+#include <kazen/accel.h>
+
+NAMESPACE_BEGIN(kazen)
+
+/**
+ * \brief Ray throughput benchmark of \ref Accel
+ *
+ * Generates a fixed set of rays for a scene and measures how many closest-hit
+ * and occlusion queries per second the acceleration data structure answers,
+ * for a number of thread counts and for single rays, for packets and for
+ * ray streams. Ray streams hand each block of rays to a \ref RayStream,
+ * which sorts the block by origin and direction before tracing it in
+ * packets, like a renderer would do with the secondary rays of an image
+ * block.
+ * This isolates the cost of traversal from shading and sampling, so that
+ * numbers can be compared across changes of the hierarchy, machines and
+ * build flags.
+ *
+ * Three ray distributions are available:
+ *  - \c "camera": primary rays through uniformly distributed film positions
+ *  - \c "sphere": rays starting at uniformly distributed points in the scene
+ *    bounds, with uniformly distributed directions
+ *  - \c "bounce": cosine-distributed rays leaving the first surface hit by
+ *    the camera rays, i.e. incoherent secondary rays of a path tracer
+ *  - \c "axis": rays starting at uniformly distributed points in the scene
+ *    bounds and running parallel to one of the coordinate axes, which
+ *    exercise the special cases of the slab tests
+ *
+ * If kazen was configured with \c KAZEN_ENABLE_ACCEL_STATS, the traversal
+ * cost of the camera rays can be written as a per-pixel heatmap (see
+ * \ref saveHeatmap()).
+ *
+ * With \c verify, every ray is additionally traced by all kernels (single
+ * rays and packets, closest hit and occlusion) and the results are checked
+ * for consistency, which catches kernels that lose or invent hits.
+ *
+ * Ray sets can be recorded to a file and replayed later, e.g. to benchmark
+ * the rays of an actual rendering.
+ */
+class RayBenchmark {
+public:
+    using Float = enoki::Packet<float>;
+    KAZEN_BASE_TYPES()
+    using ScalarIntersection3f = Accel::ScalarIntersection3f;
+    using Intersection3f       = Accel::Intersection3f;
+
+    /// Ways of handing the rays to the acceleration data structure
+    enum ETraceMode {
+        ESingleRays = 0,    ///< One ray at a time
+        EPackets,           ///< Consecutive rays form a packet
+        EStreams            ///< Each block of rays is sorted by a \ref RayStream first
+    };
+
+    /// Ray distributions
+    enum EDistribution {
+        ECameraRays = 0,    ///< Primary rays of the scene camera
+        ESphereRays,        ///< Uniformly distributed rays within the scene bounds
+        EBounceRays,        ///< Diffuse rays leaving the surfaces seen by the camera
+        EAxisRays           ///< Axis-parallel rays within the scene bounds
+    };
+
+    /// Benchmark settings
+    struct Settings {
+        EDistribution distribution = ECameraRays;   ///< Generated ray distribution
+        size_t rayCount = 1 << 20;                  ///< Number of generated rays
+        uint32_t repetitions = 3;                   ///< Timed passes per measurement (the fastest one counts)
+        uint64_t seed = 0;                          ///< Seed of the ray generator
+        std::vector<int> threadCounts;              ///< Thread counts to measure (empty: 1, 2, 4, .. up to all cores)
+        std::string rayFile;                        ///< Replay the rays stored in this file instead of generating them
+        std::string recordFile;                     ///< Store the benchmarked rays in this file
+        bool verify = false;                        ///< Check that all kernels agree before measuring
+        std::string heatmapFile;                    ///< Write the traversal cost of the camera rays to this file
+    };
+
+    /// Create a benchmark of the acceleration data structure of an activated scene
+    RayBenchmark(const Scene *scene, const Settings &settings);
+
+    /**
+     * \brief Run all measurements
+     *
+     * \return A JSON document with the scene and ray statistics and the
+     *    throughput in millions of rays per second for every thread count
+     */
+    std::string run() const;
+
+    /// Return the number of rays in the benchmark
+    size_t getRayCount() const { return m_rays.size(); }
+
+    /**
+     * \brief Trace every ray with all kernels and compare the results
+     *
+     * \return The number of rays for which the kernels disagree on the
+     *    occlusion status or the hit distance
+     */
+    size_t verify() const;
+
+#if defined(KAZEN_ENABLE_ACCEL_STATS)
+    /**
+     * \brief Write the average traversal cost of the camera rays through
+     * every pixel as a false-color image
+     *
+     * Only available for generated camera rays. See
+     * \ref Renderer::saveTraversalCost() for the output.
+     */
+    void saveHeatmap(const std::string &filename) const;
+#endif
+
+    /// Return a human-readable summary
+    std::string toString() const;
+
+protected:
+    /// Generate the configured ray distribution
+    void generateRays();
+
+    /**
+     * \brief Sample primary rays through uniformly distributed film positions
+     *
+     * If \c pixels is given, it receives the index of the pixel of every ray.
+     */
+    void generateCameraRays(std::vector<ScalarRay3f> &rays, size_t count, uint64_t seed,
+                            std::vector<uint32_t> *pixels = nullptr) const;
+
+    /// Load a ray set stored by \ref saveRays()
+    void loadRays(const std::string &filename);
+
+    /// Store the ray set as a raw array of (origin, direction, mint, maxt, time) records
+    void saveRays(const std::string &filename) const;
+
+    /**
+     * \brief Trace all rays with the given number of threads
+     *
+     * \return The time of the fastest of the configured passes in seconds
+     */
+    double measure(int threads, bool occlusion, ETraceMode mode) const;
+
+private:
+    const Scene *m_scene;
+    Settings m_settings;
+    std::vector<ScalarRay3f> m_rays;
+    std::vector<uint32_t> m_pixels;     ///< Pixel of every camera ray (only for generated camera rays)
+};
+
+/**
+ * \brief Entry point of <tt>kazen --bench-rays</tt>
+ *
+ * Parses the remaining command line arguments, runs a \ref RayBenchmark
+ * and prints the JSON result to standard output (or to the file given by
+ * \c --output).
+ *
+ * \return The exit code of the program
+ */
+extern int benchRays(int argc, char **argv);
+
+NAMESPACE_END(kazen)
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <kazen/mesh.h>
+#include <kazen/mmap.h>
+
+NAMESPACE_BEGIN(kazen)
+
+/**
+ * \brief Triangle mesh stored in kazen's native binary format
+ *
+ * The file mirrors the storage of \ref Mesh: a header with the counts and
+ * the bounding box is followed by the vertex positions, normals, texture
+ * coordinates and face indices, each one aligned and padded to
+ * \ref KAZEN_BINARY_MESH_ALIGNMENT bytes. Loading a mesh maps the file into
+ * memory and points the buffers of the mesh directly at the mapped pages,
+ * so that even huge meshes are ready in milliseconds and only the parts
+ * that are actually touched are read from disk.
+ *
+ * The string property \c filename names the file. An optional \c toWorld
+ * transformation is applied in place, which turns the affected pages into
+ * private copies and therefore costs a full read of the positions and
+ * normals. The boolean property \c compressAttributes selects the compact
+ * attribute encoding (see \ref Mesh::compressAttributes()), which replaces
+ * the mapped normals and texture coordinates by smaller copies. Likewise,
+ * \c weldVertices and \c weldTolerance (see \ref Mesh::weldVertices())
+ * replace all mapped buffers by welded copies, and so does
+ * \c reorderForLocality (see \ref Mesh::reorderForLocality()). Converting
+ * a mesh that was already reordered avoids that cost at load time.
+ *
+ * The header and the array bounds are always checked, but the face
+ * indices are used as stored. Setting the boolean property \c validate
+ * checks them against the vertex count at load time, which reads every
+ * page of the face array and should be reserved for files from untrusted
+ * sources.
+ *
+ * The format stores a single key frame. For motion blur, the string
+ * property \c keyFrames lists further binary mesh files with the vertex
+ * positions of the following key frames (see \ref Mesh::loadKeyFrames()).
+ *
+ * Files are written by \ref write() or by <tt>kazen --convert-mesh</tt>.
+ */
+class BinaryMesh : public Mesh {
+public:
+    /// Map a binary mesh file
+    BinaryMesh(const PropertyList &props);
+
+    /**
+     * \brief Store a mesh in the binary format
+     *
+     * Meshes with motion blur or compressed attributes cannot be stored;
+     * convert every key frame separately instead and list them in the
+     * \c keyFrames property. Throws an \ref Exception if the file cannot be
+     * written.
+     */
+    static void write(const Mesh *mesh, const std::string &filename);
+
+private:
+    std::unique_ptr<MemoryMappedFile> m_file;   ///< Mapping that backs the mesh buffers
+};
+
+/**
+ * \brief Entry point of <tt>kazen --convert-mesh [--reorder] input.obj output.kmesh</tt>
+ *
+ * With \c --reorder, the mesh is stored in the order of
+ * \ref Mesh::reorderForLocality().
+ *
+ * \return The exit code of the program
+ */
+extern int convertMesh(int argc, char **argv);
+
+NAMESPACE_END(kazen)
@@ -2,6 +2,7 @@
 
 #include <kazen/common.h>
 #include <kazen/vector.h>
+#include <kazen/color.h>
 
 NAMESPACE_BEGIN(kazen)
 
@@ -20,6 +21,12 @@ public:
     /// Clear the bitmap to zero
     void clear();
 
+    /// Return the size of the bitmap in pixels
+    const ScalarVector2i &getSize() const { return m_size; }
+
+    /// Set the (linear) RGB value of the given pixel
+    void setPixel(const ScalarPoint2i &p, const ScalarColor3f &value);
+
     /// Save the bitmap as an EXR file with the specified filename
     void saveEXR(const std::string &filename);
 
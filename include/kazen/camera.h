@@ -32,6 +32,11 @@ public:
      *    A uniformly distributed 2D vector that is used to sample
      *    a position on the aperture of the sensor if necessary.
      *
+     * \param timeSample
+     *    A uniformly distributed value that is used to sample the
+     *    time of the ray (see \ref Ray::time) within the shutter
+     *    interval of the camera.
+     *
      * \return
      *    An importance weight associated with the sampled ray.
      *    This accounts for the difference in the camera response
@@ -39,7 +44,8 @@ public:
      */
     virtual Color3f sampleRay(Ray3f &ray,
         const Point2f &samplePosition,
-        const Point2f &apertureSample) const = 0;
+        const Point2f &apertureSample,
+        const Float &timeSample) const = 0;
 
     /// Return the size of the output image in pixels
     const ScalarVector2i &getOutputSize() const { return m_outputSize; }
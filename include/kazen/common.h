@@ -154,6 +154,7 @@ struct LightQueryRecord;
 class Mesh;
 class Object;
 class ObjectFactory;
+class Particles;
 class PhaseFunction;
 class ReconstructionFilter;
 class Sampler;
@@ -194,6 +195,8 @@ NAMESPACE_BEGIN(util)
     extern std::string memString(size_t size, bool precise = false);   
     /// Return human-readable information about the version
     extern std::string copyright();    
+    /// Compute a 64-bit FNV-1a hash of a block of memory, optionally continuing a previous hash
+    extern uint64_t hash(const void *data, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
 NAMESPACE_END(util)
 
 
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <kazen/mesh.h>
+#include <kazen/instance.h>
+
+#include <unordered_map>
+
+/* Opaque Embree handles (see <embree3/rtcore.h>) */
+struct RTCDeviceTy;
+struct RTCSceneTy;
+struct RTCGeometryTy;
+
+NAMESPACE_BEGIN(kazen)
+
+/**
+ * \brief Ray intersection backend based on Intel Embree
+ *
+ * This is an alternative to the BVH of \ref Accel, which forwards to it
+ * when its \c backend property is set to \c "embree". It is only
+ * available if kazen was configured with \c KAZEN_USE_EMBREE.
+ *
+ * Every mesh becomes an Embree triangle geometry that references the index
+ * and vertex buffers of the mesh without copying them. Geometry IDs match
+ * the mesh indices of \ref Accel, so that hits can be reported using the
+ * same triangle numbering. Meshes referenced by an \ref Instance get their
+ * own Embree scene, which is instanced into the top-level scene.
+ */
+class EmbreeAccel {
+public:
+    using Float = enoki::Packet<float>;
+    KAZEN_BASE_TYPES()
+    using ScalarIndex = uint32_t;
+
+    /// Index reported for hits that are not part of an instance
+    static constexpr ScalarIndex NoInstance = (ScalarIndex) -1;
+
+    /// Create a new Embree device
+    EmbreeAccel();
+
+    /// Release all Embree objects
+    ~EmbreeAccel();
+
+    /**
+     * \brief Create and commit the Embree scenes for the given meshes and instances
+     *
+     * \param meshOffset
+     *    Index of the first triangle of every mesh, as used by \ref Accel
+     */
+    void build(const std::vector<Mesh *> &meshes, const std::vector<ScalarIndex> &meshOffset,
+               const std::vector<const Instance *> &instances);
+
+    /// Recommit all scenes after vertex positions have changed
+    void update();
+
+    /**
+     * \brief Find the closest intersection along a ray
+     *
+     * \param f
+     *    Triangle index in the numbering of \ref Accel, relative to the
+     *    instanced mesh if the triangle was hit through an instance
+     * \param instance
+     *    Index of the instance that was hit, or \ref NoInstance
+     */
+    bool rayIntersect(const ScalarRay3f &ray, ScalarIndex &f, ScalarIndex &instance,
+                      ScalarFloat &t, ScalarPoint2f &uv) const;
+
+    /// Find the closest intersections along a packet of rays (see above)
+    Mask rayIntersect(const Ray3f &ray, UInt32 &f, UInt32 &instance, Float &t, Float &u, Float &v,
+                      Mask active) const;
+
+    /// Test whether a ray segment is occluded
+    bool rayTest(const ScalarRay3f &ray) const;
+
+    /// Test whether a packet of ray segments is occluded
+    Mask rayTest(const Ray3f &ray, Mask active) const;
+
+    /// Return a human-readable summary
+    std::string toString() const;
+
+protected:
+    /// Triangle geometry referencing the buffers of a mesh
+    struct Geometry {
+        RTCGeometryTy *geometry;
+        const Mesh *mesh;
+        std::vector<const void *> positions;    ///< Currently shared vertex buffer of every key frame
+        std::vector<std::vector<float>> padded; ///< Padded copies of the vertices, if a mesh buffer cannot be shared
+    };
+
+    /// Create the triangle geometry of a mesh and attach it to the given scene
+    void attachMesh(RTCSceneTy *scene, const Mesh *mesh, ScalarIndex geometryId);
+
+    /// Point a geometry to the current vertex buffers (one per key frame) of its mesh
+    void setVertexBuffer(Geometry &geometry);
+
+    /// Throw an exception if the device reported an error
+    void checkError(const char *operation) const;
+
+private:
+    RTCDeviceTy *m_device = nullptr;
+    RTCSceneTy *m_scene = nullptr;                              ///< Top-level scene
+    std::unordered_map<const Mesh *, RTCSceneTy *> m_bottomLevel; ///< Scenes of instanced meshes
+    std::vector<RTCGeometryTy *> m_instanceGeometries;          ///< Instance geometries of the top-level scene
+    std::vector<Geometry> m_geometries;                         ///< All triangle geometries
+    std::vector<ScalarIndex> m_meshOffset;                      ///< Index of the first triangle of every mesh
+    ScalarIndex m_meshCount = 0;                                ///< Number of meshes in the top-level scene
+};
+
+NAMESPACE_END(kazen)
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <kazen/object.h>
+#include <kazen/mesh.h>
+#include <kazen/transform.h>
+
+NAMESPACE_BEGIN(kazen)
+
+/**
+ * \brief Placement of a shared triangle mesh in the scene
+ *
+ * An instance references a mesh together with an object-to-world
+ * transformation. Any number of instances may reference the same mesh:
+ * \ref Accel builds a single bottom-level BVH per referenced mesh, and the
+ * top-level BVH only stores the transformed bounds of every instance. The
+ * memory footprint and build time therefore scale with the amount of
+ * unique geometry rather than with the amount of placed geometry.
+ */
+class Instance : public Object {
+public:
+    using Float = enoki::Packet<float>;
+    KAZEN_BASE_TYPES()
+
+    /**
+     * \brief Create a new instance
+     *
+     * The object-to-world transformation is given by the \c toWorld
+     * property (default: identity).
+     */
+    Instance(const PropertyList &props);
+
+    /// Create an instance of an existing mesh
+    Instance(const Mesh *mesh, const ScalarTransform4f &toWorld);
+
+    /// Register the referenced mesh (exactly one mesh per instance)
+    void addChild(Object *child);
+
+    /// Check that a mesh has been assigned
+    void activate();
+
+    /// Return the referenced mesh
+    const Mesh *getMesh() const { return m_mesh; }
+
+    /// Return the object-to-world transformation
+    const ScalarTransform4f &getToWorld() const { return m_toWorld; }
+
+    /// Return the world-to-object transformation
+    const ScalarTransform4f &getToObject() const { return m_toObject; }
+
+    /// Is the transformation the identity, i.e. can rays be used without transforming them?
+    bool isIdentity() const { return m_identity; }
+
+    /// Return the world-space bounds of the instanced mesh
+    ScalarBoundingBox3f getBoundingBox() const { return getBoundingBox(m_mesh->bbox()); }
+
+    /// Return world-space bounds of the given object-space box
+    ScalarBoundingBox3f getBoundingBox(const ScalarBoundingBox3f &bbox) const;
+
+    /// Return a human-readable summary of this instance
+    std::string toString() const;
+
+    /// Return the type of object (i.e. Mesh/BSDF/etc.) provided by this instance
+    EClassType getClassType() const { return EInstance; }
+
+private:
+    const Mesh *m_mesh = nullptr;
+    ScalarTransform4f m_toWorld;
+    ScalarTransform4f m_toObject;
+    bool m_identity;
+};
+
+NAMESPACE_END(kazen)
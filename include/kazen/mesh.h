@@ -1,6 +1,9 @@
 #pragma once
 
 #include <kazen/common.h>
+#include <kazen/object.h>
+#include <kazen/frame.h>
+#include <kazen/bbox.h>
 
 NAMESPACE_BEGIN(kazen)
 
@@ -16,9 +19,12 @@ template <typename Float_>
 struct Intersection {
     using Float     = Float_;
     using Mask      = mask_t<Float>;
+    using Point2f   = Point<Float, 2>;
     using Point3f   = Point<Float, 3>;
     using Vector3f  = Vector<Float, 3>;
+    using Frame3f   = Frame<Float>;
     using MeshPtr   = replace_scalar_t<Float, const Mesh *>;
+    using ParticlesPtr = replace_scalar_t<Float, const Particles *>;
 
     /// Position of the surface intersection
     Point3f p;
@@ -31,10 +37,12 @@ struct Intersection {
     /// Geometric frame (based on the true geometry)
     Frame3f geoFrame;
     /// Pointer to the associated mesh
-    const MeshPtr *mesh;
+    MeshPtr mesh;
+    /// Pointer to the associated particles, if a particle was hit instead of a mesh
+    ParticlesPtr particles;
 
     /// Create an uninitialized intersection record
-    Intersection() : mesh(nullptr) { }
+    Intersection() : mesh(nullptr), particles(nullptr) { }
 
     /// Transform a direction vector into the local shading frame
     Vector3f toLocal(const Vector3f &d) const {
@@ -55,7 +63,7 @@ struct Intersection {
 
 
 
-class Mesh : Object {
+class Mesh : public Object {
 public:
     using Float = enoki::Packet<float>;
     KAZEN_BASE_TYPES()
@@ -74,8 +82,6 @@ public:
 
     /// Initialize internal data structures (called once by the XML parser)
     virtual void activate();
-    
-    bool rayIntersect(const Ray3f &ray, float &u, float &v, float &t) const;
 
     /// Return the total number of face(current is triangles) in this shape
     ScalarSize getFaceCount() const { return m_faceCount; }
@@ -90,20 +96,188 @@ public:
     const FloatStorage &getVertexNormals() const { return m_N; }
 
     /// Return vertex texture coordinates buffer
-    const MatrixXf &getVertexTexCoords() const { return m_UV; }
+    const FloatStorage &getVertexTexCoords() const { return m_UV; }
+
+    /**
+     * \brief Replace the vertex positions, e.g. with those of the next
+     * frame of an animation sequence
+     *
+     * The number of vertices and the connectivity must not change. The
+     * bounding box is updated, and acceleration data structures that
+     * contain the mesh must be refit (see \ref Accel::refit()).
+     */
+    void setVertexPositions(const FloatStorage &positions);
+
+    /**
+     * \brief Append the vertex positions of another key frame for motion blur
+     *
+     * The key frames of a mesh are spread uniformly over the shutter
+     * interval <tt>[0, 1]</tt> of \ref Ray::time: with \c n key frames,
+     * frame \c k is reached at time <tt>k / (n - 1)</tt>, and vertices move
+     * linearly in between. The positions passed to the constructor (or to
+     * \ref setVertexPositions()) are frame 0. The bounding box of the mesh
+     * covers all key frames. Scene files supply key frames through the
+     * \c keyFrames property of the mesh loaders (see \ref loadKeyFrames()),
+     * and the camera samples \ref Ray::time within its shutter interval.
+     */
+    void addTimeStep(const FloatStorage &positions);
+
+    /**
+     * \brief Return a counter that is increased whenever the vertex
+     * positions or the connectivity of the mesh change
+     *
+     * Used by \ref Accel::refit() to skip the hierarchies of meshes that
+     * did not move.
+     */
+    uint64_t getRevision() const { return m_revision; }
+
+    /// Return the number of key frames (1 for a static mesh)
+    ScalarSize getTimeStepCount() const { return 1 + (ScalarSize) m_motionV.size(); }
+
+    /// Return the vertex positions of the given key frame
+    const FloatStorage &getVertexPositions(ScalarSize timeStep) const {
+        return timeStep == 0 ? m_V : m_motionV[timeStep - 1];
+    }
 
     /// Return a pointer to the triangle vertex index list
     const DynamicBuffer<UInt32> &getIndices() const { return m_F; }
 
+    /// Does this mesh have per-vertex normals?
+    bool hasVertexNormals() const { return slices(m_N) != 0 || slices(m_packedN) != 0; }
+
+    /// Does this mesh have per-vertex texture coordinates?
+    bool hasVertexTexCoords() const { return slices(m_UV) != 0 || slices(m_packedUV) != 0; }
+
+    /**
+     * \brief Merge vertices with identical or nearly identical attributes
+     *
+     * Two vertices are merged if their positions at all key frames, their
+     * normals and their texture coordinates agree. With a \c tolerance of
+     * zero the values must be equal, otherwise they may differ by at most
+     * \c tolerance per component. Every vertex is merged into the first
+     * vertex that matches it, which may itself have been merged into an
+     * earlier one, so chains of close vertices collapse into one. Candidates
+     * are looked up in a grid with a spacing of \c tolerance, including the
+     * neighbouring cells. The faces are remapped, and faces that collapse
+     * are removed. The result does not depend on the number of threads.
+     *
+     * Called by \ref activate() if the boolean property \c weldVertices of
+     * the mesh is set, with the float property \c weldTolerance (default 0).
+     * Must be called before \ref compressAttributes().
+     */
+    void weldVertices(ScalarFloat tolerance = 0.f);
+
+    /**
+     * \brief Reorder the triangles and vertices for memory locality
+     *
+     * Triangles are sorted along a Morton curve through their centroids,
+     * and vertices are then numbered in the order of their first use by
+     * the sorted triangles, so that primitives that are close in space are
+     * also close in memory. This speeds up building hierarchies over the
+     * mesh as well as leaf intersection and attribute fetches. The order is
+     * deterministic.
+     *
+     * Called by \ref activate() if the boolean property
+     * \c reorderForLocality of the mesh is set.
+     */
+    void reorderForLocality();
+
+    /**
+     * \brief Replace the normals and texture coordinates by a compact encoding
+     *
+     * Normals are stored as 32-bit octahedral vectors and texture coordinates
+     * as two 16-bit values normalized to the texture coordinate bounds of the
+     * mesh, which saves 60% of the attribute memory. The attributes are
+     * decoded by \ref getVertexNormal() and \ref getVertexTexCoord(), i.e.
+     * only when the hit information of an intersection is computed, and
+     * \ref getVertexNormals() and \ref getVertexTexCoords() return empty
+     * buffers afterwards.
+     *
+     * Called by \ref activate() if the boolean property
+     * \c compressAttributes of the mesh is set.
+     */
+    void compressAttributes();
+
+    /// Are the normals and texture coordinates stored in the compact encoding?
+    bool hasCompressedAttributes() const { return slices(m_packedN) != 0 || slices(m_packedUV) != 0; }
+
+    /// Return the vertex indices of the given face
+    template <typename Index>
+    auto getFaceIndices(Index index, mask_t<Index> active = true) const {
+        using Result = Array<replace_scalar_t<Index, uint32_t>, 3>;
+        return gather<Result>(m_F, index, active);
+    }
+
+    /// Return the world-space position of the given vertex
+    template <typename Index>
+    auto getVertexPosition(Index index, mask_t<Index> active = true) const {
+        using Result = Point<replace_scalar_t<Index, InputFloat>, 3>;
+        return gather<Result>(m_V, index, active);
+    }
+
+    /// Return the position of the given vertex at the given key frame
+    ScalarPoint3f getVertexPosition(ScalarIndex index, ScalarSize timeStep) const {
+        return gather<InputPoint3f>(getVertexPositions(timeStep), index);
+    }
+
+    /// Return the position of the given vertex at the given time, interpolated between key frames
+    ScalarPoint3f getVertexPositionAt(ScalarIndex index, ScalarFloat time) const;
+
+    /// Return the normal of the given vertex
+    template <typename Index>
+    auto getVertexNormal(Index index, mask_t<Index> active = true) const {
+        using Result = Normal<replace_scalar_t<Index, InputFloat>, 3>;
+        if (slices(m_packedN) != 0)
+            return Result(decodeNormal(gather<replace_scalar_t<Index, uint32_t>>(m_packedN, index, active)));
+        return gather<Result>(m_N, index, active);
+    }
+
+    /// Return the texture coordinates of the given vertex
+    template <typename Index>
+    auto getVertexTexCoord(Index index, mask_t<Index> active = true) const {
+        using Result = Point<replace_scalar_t<Index, InputFloat>, 2>;
+        if (slices(m_packedUV) != 0) {
+            auto packed = gather<replace_scalar_t<Index, uint32_t>>(m_packedUV, index, active);
+            using Value = replace_scalar_t<Index, InputFloat>;
+            Result uv(Value(packed & 0xFFFFu), Value(packed >> 16));
+            return Result(fmadd(uv, Result(m_uvScale * (1.f / 65535.f)), Result(m_uvOffset)));
+        }
+        return gather<Result>(m_UV, index, active);
+    }
+
+    /// Decode a normal that was stored by \ref encodeNormal()
+    template <typename UInt>
+    static auto decodeNormal(const UInt &packed) {
+        using Value = replace_scalar_t<UInt, InputFloat>;
+        Value x = fmadd(Value(packed & 0xFFFFu), 2.f / 65535.f, -1.f),
+              y = fmadd(Value(packed >> 16), 2.f / 65535.f, -1.f),
+              z = 1.f - abs(x) - abs(y);
+
+        /* Unfold the lower hemisphere */
+        Value t = max(-z, 0.f);
+        x += select(x >= 0.f, -t, t);
+        y += select(y >= 0.f, -t, t);
+        return Normal<Value, 3>(normalize(Normal<Value, 3>(x, y, z)));
+    }
+
+    /// Encode a unit vector as two 16-bit coordinates on the octahedron
+    static uint32_t encodeNormal(const ScalarNormal3f &n);
+
     /// Return the surface area of the mesh
     ScalarFloat surfaceArea() const;
 
     /// Return an axis-aligned bounding box of the entire mesh
     const ScalarBoundingBox3f &bbox() const { return m_bbox; }
 
-    /// Return an axis-aligned bounding box containing the given triangle
+    /// Return an axis-aligned bounding box containing the given triangle at all key frames
     ScalarBoundingBox3f getBoundingBox(ScalarIndex index) const;
 
+    /// Return an axis-aligned bounding box containing the given triangle at the given key frame
+    ScalarBoundingBox3f getBoundingBox(ScalarIndex index, ScalarSize timeStep) const;
+
+    /// Return the centroid of the given triangle
+    ScalarPoint3f getCentroid(ScalarIndex index) const;
+
     /// Is this mesh an area light?
     bool isLight() const { return m_light != nullptr; }
 
@@ -142,6 +316,21 @@ protected:
     /// Create an empty mesh
     Mesh();
 
+    /// Recompute the bounding box over all key frames
+    void updateBoundingBox();
+
+    /**
+     * \brief Append the key frames listed in the string property \c keyFrames
+     *
+     * The property holds a comma-separated list of files that are loaded
+     * with the mesh plugin \c pluginName and the \c toWorld transformation
+     * of the mesh. Their vertex positions become the key frames after the
+     * first one (see \ref addTimeStep()). Every file must describe the same
+     * mesh, with the same vertex count and connectivity. Only the counts
+     * are checked, so that mapped files are not read in full.
+     */
+    void loadKeyFrames(const PropertyList &props, const std::string &pluginName);
+
 protected:
     std::string             m_name;                 ///< Identifying name
     ScalarBoundingBox3f     m_bbox;                 ///< Bounding box of the mesh
@@ -149,9 +338,19 @@ protected:
     ScalarSize              m_faceCount = 0;        ///< Total number of faces
 
     FloatStorage            m_V;                    ///< Vertex positions
+    std::vector<FloatStorage> m_motionV;            ///< Vertex positions of the key frames after the first one
     FloatStorage            m_N;                    ///< Vertex normals
     FloatStorage            m_UV;                   ///< Vertex texture coordinates
+    DynamicBuffer<UInt32>   m_packedN;              ///< Octahedral vertex normals (see \ref compressAttributes())
+    DynamicBuffer<UInt32>   m_packedUV;             ///< Quantized vertex texture coordinates
+    ScalarPoint2f           m_uvOffset = 0.f;       ///< Smallest texture coordinate
+    ScalarVector2f          m_uvScale = 0.f;        ///< Extent of the texture coordinates
+    bool                    m_compressAttributes = false; ///< Compress the attributes in \ref activate()?
+    bool                    m_weldVertices = false; ///< Weld the vertices in \ref activate()?
+    ScalarFloat             m_weldTolerance = 0.f;  ///< Largest difference of welded attribute values
+    bool                    m_reorderForLocality = false; ///< Reorder the mesh in \ref activate()?
     DynamicBuffer<UInt32>   m_F;                    ///< Faces
+    uint64_t                m_revision = 0;         ///< Number of changes to the geometry (see \ref getRevision())
     BSDF                    *m_bsdf = nullptr;      ///< BSDF of the surface
     Light                   *m_light = nullptr;     ///< Associated light, if any
 };
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <kazen/common.h>
+
+NAMESPACE_BEGIN(kazen)
+
+/**
+ * \brief Read-only view of a file that is mapped into memory
+ *
+ * Pages are loaded lazily by the operating system and shared between all
+ * processes that map the same file, which makes this the cheapest way to
+ * access large binary files (caches, meshes) in their on-disk layout.
+ */
+class MemoryMappedFile {
+public:
+    /**
+     * \brief Map the given file into memory
+     *
+     * \param copyOnWrite
+     *    If \c true, the mapping may be modified. Modified pages become
+     *    private to this process and are never written back to the file.
+     *
+     * Throws an \ref Exception if the file cannot be opened or mapped.
+     */
+    MemoryMappedFile(const std::string &filename, bool copyOnWrite = false);
+
+    /// Unmap the file
+    ~MemoryMappedFile();
+
+    MemoryMappedFile(const MemoryMappedFile &) = delete;
+    MemoryMappedFile &operator=(const MemoryMappedFile &) = delete;
+
+    /// Return a pointer to the file contents
+    void *data() { return m_data; }
+
+    /// Return a pointer to the file contents (const version)
+    const void *data() const { return m_data; }
+
+    /// Return the size of the mapped file in bytes
+    size_t size() const { return m_size; }
+
+    /// Return the name of the mapped file
+    const std::string &filename() const { return m_filename; }
+
+    /// Return a human-readable summary
+    std::string toString() const;
+
+private:
+    std::string m_filename;
+    void *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+NAMESPACE_END(kazen)
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <kazen/bbox.h>
+
+NAMESPACE_BEGIN(kazen)
+
+/// Number of bits per axis of a 63-bit Morton code
+constexpr uint32_t MortonBits = 21;
+
+/// Spread the lower 21 bits of \c x so that there are two zero bits between each of them
+inline uint64_t expandBits(uint64_t x) {
+    x &= 0x1fffffull;
+    x = (x | (x << 32)) & 0x001f00000000ffffull;
+    x = (x | (x << 16)) & 0x001f0000ff0000ffull;
+    x = (x | (x <<  8)) & 0x100f00f00f00f00full;
+    x = (x | (x <<  4)) & 0x10c30c30c30c30c3ull;
+    x = (x | (x <<  2)) & 0x1249249249249249ull;
+    return x;
+}
+
+/**
+ * \brief Computes 63-bit Morton codes of points within a bounding box
+ *
+ * Every axis of the box is divided into \f$2^{21}\f$ cells, and the cell
+ * indices are interleaved with the x axis in the most significant bit.
+ * Points outside of the box are clamped to its boundary cells, and flat
+ * axes of the box map to cell 0.
+ */
+template <typename BBox> class MortonEncoder {
+public:
+    using Point  = typename BBox::Point;
+    using Vector = typename BBox::Vector;
+    using Scalar = typename BBox::Scalar;
+
+    /// Create an encoder for the given bounding box
+    MortonEncoder(const BBox &bbox) : m_min(bbox.min) {
+        Vector extents = bbox.extents();
+        for (int axis = 0; axis < 3; ++axis)
+            m_scale[axis] = extents[axis] > 0 ? Scalar(1u << MortonBits) / extents[axis] : Scalar(0);
+    }
+
+    /// Return the Morton code of a point
+    uint64_t operator()(const Point &p) const {
+        uint64_t code = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            Scalar cell = std::clamp((p[axis] - m_min[axis]) * m_scale[axis], Scalar(0),
+                                     Scalar((1u << MortonBits) - 1));
+            code |= expandBits((uint64_t) cell) << (2 - axis);
+        }
+        return code;
+    }
+
+private:
+    Point m_min;    ///< Lower corner of the box
+    Vector m_scale; ///< Number of cells per unit length along every axis
+};
+
+NAMESPACE_END(kazen)
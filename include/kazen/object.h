@@ -17,6 +17,8 @@ public:
     enum EClassType {
         EScene = 0,
         EMesh,
+        EInstance,
+        EParticles,
         EBSDF,
         EPhaseFunction,
         ELight,
@@ -75,6 +77,8 @@ public:
         switch (type) {
             case EScene:        return "scene";
             case EMesh:         return "mesh";
+            case EInstance:     return "instance";
+            case EParticles:    return "particles";
             case EBSDF:         return "bsdf";
             case ELight:        return "light";
             case ECamera:       return "camera";
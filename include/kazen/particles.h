@@ -0,0 +1,117 @@
+#pragma once
+
+#include <kazen/object.h>
+#include <kazen/bbox.h>
+
+NAMESPACE_BEGIN(kazen)
+
+/**
+ * \brief Set of analytic spheres or disks, e.g. the particles of a simulation
+ *
+ * Only the center and radius of every particle are stored, which is a tiny
+ * fraction of the memory of a tessellated mesh. \ref Accel places the
+ * particles directly into its leaves and intersects them analytically.
+ *
+ * The string property \c shape is either \c "sphere" (default) or
+ * \c "disk". Disks always face the incoming ray, which is the usual way of
+ * rendering dense point clouds. The float property \c radius sets the
+ * radius of particles for which no individual radius is given.
+ */
+class Particles : public Object {
+public:
+    using Float = enoki::Packet<float>;
+    KAZEN_BASE_TYPES()
+    using ScalarIndex  = uint32_t;
+    using ScalarSize   = uint32_t;
+    using InputFloat   = float;
+    using InputPoint3f = Point<InputFloat, 3>;
+    using FloatStorage = DynamicBuffer<replace_scalar_t<Float, InputFloat>>;
+
+    /// Particle shapes
+    enum EShape {
+        ESphere = 0,    ///< Sphere around the center
+        EDisk           ///< Disk around the center, facing the ray
+    };
+
+    /// Create an empty particle set
+    Particles(const PropertyList &props);
+
+    /// Release all memory
+    virtual ~Particles();
+
+    /// Assign a diffuse BSDF if none was specified
+    virtual void activate();
+
+    /**
+     * \brief Replace the particles
+     *
+     * \param centers
+     *    Particle centers, three values per particle
+     * \param radii
+     *    One radius per particle, or an empty buffer to use the
+     *    \c radius property for all particles
+     */
+    void setParticles(const FloatStorage &centers, const FloatStorage &radii = FloatStorage());
+
+    /// Return the shape of the particles
+    EShape getShape() const { return m_shape; }
+
+    /// Return the number of particles
+    ScalarSize getParticleCount() const { return m_particleCount; }
+
+    /// Return the center of the given particle
+    ScalarPoint3f getCenter(ScalarIndex index) const {
+        return gather<InputPoint3f>(m_centers, index);
+    }
+
+    /// Return the radius of the given particle
+    ScalarFloat getRadius(ScalarIndex index) const {
+        return slices(m_radii) == 0 ? m_radius : gather<InputFloat>(m_radii, index);
+    }
+
+    /// Return the particle centers
+    const FloatStorage &getCenters() const { return m_centers; }
+
+    /// Return the per-particle radii (empty if all particles have the default radius)
+    const FloatStorage &getRadii() const { return m_radii; }
+
+    /// Return an axis-aligned bounding box of all particles
+    const ScalarBoundingBox3f &bbox() const { return m_bbox; }
+
+    /// Return an axis-aligned bounding box containing the given particle
+    ScalarBoundingBox3f getBoundingBox(ScalarIndex index) const {
+        ScalarPoint3f center = getCenter(index);
+        ScalarFloat radius = getRadius(index);
+        return ScalarBoundingBox3f(center - radius, center + radius);
+    }
+
+    /// Return a pointer to the BSDF associated with the particles
+    BSDF *getBSDF() { return m_bsdf; }
+
+    /// Return a pointer to the BSDF associated with the particles (const version)
+    const BSDF *getBSDF() const { return m_bsdf; }
+
+    /// Register a child object (i.e. a BSDF)
+    virtual void addChild(Object *child);
+
+    /// Return the name of this particle set
+    const std::string &getName() const { return m_name; }
+
+    /// Return a human-readable summary
+    std::string toString() const;
+
+    /// Return the type of object (i.e. Mesh/BSDF/etc.) provided by this instance
+    EClassType getClassType() const { return EParticles; }
+
+private:
+    std::string             m_name;                 ///< Identifying name
+    EShape                  m_shape;                ///< Shape of all particles
+    ScalarFloat             m_radius;               ///< Radius of particles without an individual radius
+    ScalarSize              m_particleCount = 0;    ///< Number of particles
+    ScalarBoundingBox3f     m_bbox;                 ///< Bounding box of all particles
+    FloatStorage            m_centers;              ///< Particle centers
+    FloatStorage            m_radii;                ///< Particle radii (optional)
+    BSDF                    *m_bsdf = nullptr;      ///< BSDF of the surface
+};
+
+NAMESPACE_END(kazen)
@@ -14,6 +14,22 @@ public:
     void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block);
     void render(Scene *scene, const std::string &filename);
 
+    /**
+     * \brief Write per-pixel BVH traversal costs as a false-color image
+     *
+     * The costs are normalized by their maximum and stored as a PNG file
+     * with the suffix \c "_traversal". Nothing is written if all costs are
+     * zero. \ref render() writes the costs of the rendered pixels if kazen
+     * was configured with \c KAZEN_ENABLE_ACCEL_STATS (once
+     * \ref renderSample() traces rays); <tt>kazen --bench-rays
+     * --heatmap</tt> writes those of the camera rays.
+     */
+    static void saveTraversalCost(const std::vector<ScalarFloat> &cost, const ScalarVector2i &size,
+                                  const std::string &filename);
+
+private:
+    ScalarVector2i m_outputSize;
+    std::vector<ScalarFloat> m_traversalCost;   ///< BVH traversal cost of every pixel (nodes + triangles)
 };
 
 NAMESPACE_END(kazen)
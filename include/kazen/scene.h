@@ -14,13 +14,17 @@ NAMESPACE_BEGIN(kazen)
  */
 class Scene : public Object {
 public:
+    using Float = enoki::Packet<float>;
+    KAZEN_BASE_TYPES()
+    using ScalarIntersection3f = Accel::ScalarIntersection3f;
+
     /// Construct a new scene object
     Scene(const PropertyList &);
 
     /// Release all memory
     virtual ~Scene();
 
-    /// Return a pointer to the scene's kd-tree
+    /// Return a pointer to the scene's acceleration data structure
     const Accel *getAccel() const { return m_accel; }
 
     /// Return a pointer to the scene's integrator
@@ -55,7 +59,7 @@ public:
      *
      * \return \c true if an intersection was found
      */
-    bool rayIntersect(const Ray3f &ray, Intersection &its) const {
+    bool rayIntersect(const ScalarRay3f &ray, ScalarIntersection3f &its) const {
         return m_accel->rayIntersect(ray, its, false);
     }
 
@@ -74,20 +78,19 @@ public:
      *
      * \return \c true if an intersection was found
      */
-    bool rayIntersect(const Ray3f &ray) const {
-        Intersection its; /* Unused */
-        return m_accel->rayIntersect(ray, its, true);
+    bool rayIntersect(const ScalarRay3f &ray) const {
+        return m_accel->rayTest(ray);
     }
 
     /// \brief Return an axis-aligned box that bounds the scene
-    const BoundingBox3f &getBoundingBox() const {
+    const ScalarBoundingBox3f &getBoundingBox() const {
         return m_accel->getBoundingBox();
     }
 
     /**
      * \brief Inherited from \ref Object::activate()
      *
-     * Initializes the internal data structures (kd-tree,
+     * Initializes the internal data structures (BVH,
      * emitter sampling data structures, etc.)
      */
     void activate();
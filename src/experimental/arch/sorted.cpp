@@ -0,0 +1,116 @@
+#include "sorted.h"
+#include <kazen/morton.h>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
+#include <tbb/blocked_range.h>
+
+/* Number of packets that are traced by a single task */
+#define KAZEN_STREAM_GRAIN_SIZE 64
+
+NAMESPACE_BEGIN(kazen)
+
+void RayStream::clear() {
+    m_rays.clear();
+    m_its.clear();
+    m_hit.clear();
+}
+
+uint64_t RayStream::sortKey(const ScalarRay3f &ray) const {
+    MortonEncoder<ScalarBoundingBox3f> morton(m_accel->getBoundingBox());
+    uint64_t octant = 0;
+    for (int axis = 0; axis < 3; ++axis)
+        octant |= (ray.d[axis] < 0.f ? 1u : 0u) << axis;
+
+    /* The lowest level of the Morton code is dropped to make room for the octant */
+    return (octant << 60) | (morton(ray.o) >> 3);
+}
+
+void RayStream::trace(bool shadowRays) {
+    size_t size = m_rays.size();
+    m_its.resize(size);
+    m_hit.assign(size, 0);
+    if (size == 0)
+        return;
+
+    /* Sort ray indices by direction octant and origin */
+    std::vector<std::pair<uint64_t, ScalarIndex>> order(size);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, size),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i != range.end(); ++i)
+                order[i] = { sortKey(m_rays[i]), (ScalarIndex) i };
+        }
+    );
+    tbb::parallel_sort(order.begin(), order.end());
+
+    /* Trace consecutive runs of the sorted stream as packets */
+    size_t packetCount = (size + Float::Size - 1) / Float::Size;
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, packetCount, KAZEN_STREAM_GRAIN_SIZE),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t packet = range.begin(); packet != range.end(); ++packet) {
+                size_t offset = packet * Float::Size,
+                       count = std::min((size_t) Float::Size, size - offset);
+
+                /* Gather the rays of this packet, replicating the
+                   last ray into the unused lanes of a partial packet */
+                Ray3f ray;
+                for (size_t i = 0; i < Float::Size; ++i) {
+                    const ScalarRay3f &ray1 = m_rays[order[offset + std::min(i, count - 1)].second];
+                    for (size_t k = 0; k < 3; ++k) {
+                        ray.o[k][i] = ray1.o[k];
+                        ray.d[k][i] = ray1.d[k];
+                        ray.dRcp[k][i] = ray1.dRcp[k];
+                    }
+                    ray.mint[i] = ray1.mint;
+                    ray.maxt[i] = ray1.maxt;
+                    ray.time[i] = ray1.time;
+                }
+                Mask active = arange<UInt32>() < (uint32_t) count;
+
+                Intersection3f its;
+                Mask hit = shadowRays ? m_accel->rayTest(ray, active)
+                                      : m_accel->rayIntersect(ray, its, false, active);
+
+                /* Scatter the results back to submission order */
+                for (size_t i = 0; i < count; ++i) {
+                    ScalarIndex index = order[offset + i].second;
+                    if (!hit[i])
+                        continue;
+
+                    m_hit[index] = 1;
+                    if (shadowRays)
+                        continue;
+
+                    ScalarIntersection3f &its1 = m_its[index];
+                    for (size_t k = 0; k < 3; ++k) {
+                        its1.p[k] = its.p[k][i];
+                        its1.shFrame.s[k] = its.shFrame.s[k][i];
+                        its1.shFrame.t[k] = its.shFrame.t[k][i];
+                        its1.shFrame.n[k] = its.shFrame.n[k][i];
+                        its1.geoFrame.s[k] = its.geoFrame.s[k][i];
+                        its1.geoFrame.t[k] = its.geoFrame.t[k][i];
+                        its1.geoFrame.n[k] = its.geoFrame.n[k][i];
+                    }
+                    its1.uv = ScalarPoint2f(its.uv.x()[i], its.uv.y()[i]);
+                    its1.t = its.t[i];
+                    its1.mesh = its.mesh[i];
+                    its1.particles = its.particles[i];
+                }
+            }
+        }
+    );
+}
+
+std::string RayStream::toString() const {
+    return fmt::format(
+        "RayStream[\n"
+        "  rays = {},\n"
+        "  packetSize = {}\n"
+        "]",
+        m_rays.size(),
+        Float::Size
+    );
+}
+
+NAMESPACE_END(kazen)
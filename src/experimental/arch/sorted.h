@@ -1 +1,79 @@
-#pragma once
\ No newline at end of file
+#pragma once
+
+#include <kazen/accel.h>
+
+NAMESPACE_BEGIN(kazen)
+
+/**
+ * \brief Ray-stream stage that reorders large batches of rays before tracing
+ *
+ * Secondary rays generated by an integrator are mostly incoherent. Instead
+ * of tracing them one by one, they are first collected (e.g. from all
+ * pixels of an image block) into a stream. \ref trace() then sorts the
+ * stream by a key made of the direction octant and the Morton code of the
+ * ray origin within the scene bounds, so that consecutive rays start close
+ * to each other and travel in similar directions. The sorted stream is cut
+ * into packets that are traversed with the packet kernel of \ref Accel,
+ * which recovers cache locality for both nodes and triangles.
+ *
+ * Results are reported in submission order.
+ */
+class RayStream {
+public:
+    using Float = enoki::Packet<float>;
+    KAZEN_BASE_TYPES()
+    using Intersection3f       = Accel::Intersection3f;
+    using ScalarIntersection3f = Accel::ScalarIntersection3f;
+    using ScalarIndex          = uint32_t;
+
+    /// Create an empty ray stream that traces against the given acceleration data structure
+    RayStream(const Accel *accel) : m_accel(accel) { }
+
+    /// Append a ray to the stream and return its index
+    ScalarIndex push(const ScalarRay3f &ray) {
+        m_rays.push_back(ray);
+        return (ScalarIndex) (m_rays.size() - 1);
+    }
+
+    /// Reserve memory for the given number of rays
+    void reserve(size_t size) { m_rays.reserve(size); }
+
+    /// Remove all rays and results
+    void clear();
+
+    /// Return the number of queued rays
+    size_t size() const { return m_rays.size(); }
+
+    /**
+     * \brief Sort the queued rays and trace them in coherent packets
+     *
+     * \param shadowRays
+     *    \c true if only the occlusion status of every ray is needed
+     */
+    void trace(bool shadowRays);
+
+    /// Was an intersection found for the ray with the given index?
+    bool hit(ScalarIndex index) const { return m_hit[index] != 0; }
+
+    /// Return the intersection record for the ray with the given index
+    const ScalarIntersection3f &getIntersection(ScalarIndex index) const { return m_its[index]; }
+
+    /// Return a human-readable summary
+    std::string toString() const;
+
+protected:
+    /**
+     * \brief Compute the sort key of a ray: the direction octant in the
+     * upper 3 bits, followed by the upper 60 bits of the Morton code of
+     * the origin within the scene bounds
+     */
+    uint64_t sortKey(const ScalarRay3f &ray) const;
+
+private:
+    const Accel *m_accel;
+    std::vector<ScalarRay3f> m_rays;
+    std::vector<ScalarIntersection3f> m_its;
+    std::vector<uint8_t> m_hit;
+};
+
+NAMESPACE_END(kazen)
@@ -1,23 +1,3214 @@
 #include <kazen/accel.h>
+#include <kazen/morton.h>
+#include <kazen/timer.h>
 
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/task_group.h>
+#include <tbb/blocked_range.h>
+
+/* Number of bins used to evaluate the surface area heuristic */
+#define KAZEN_BVH_BINS 32
+/* Maximum number of primitives stored in a single leaf node */
+#define KAZEN_BVH_MAX_LEAF_SIZE 8
+/* Relative cost of traversing an inner node and of a triangle test */
+#define KAZEN_BVH_TRAVERSAL_COST 1.f
+#define KAZEN_BVH_INTERSECTION_COST 1.f
+/* Subtrees with fewer primitives are built by a single thread */
+#define KAZEN_BVH_SERIAL_THRESHOLD 4096
+/* Maximum depth of the hierarchy */
+#define KAZEN_BVH_MAX_DEPTH 64
+/* Size of the wide BVH traversal stack */
+#define KAZEN_BVH_STACK_SIZE (KAZEN_BVH_MAX_DEPTH * (KAZEN_BVH_WIDTH - 1) + 1)
+/* Packets with a smaller fraction of active lanes fall back to single-ray traversal */
+#define KAZEN_BVH_PACKET_COHERENCE 0.25f
+/* Default relative SAH cost increase after which a refit hierarchy is rebuilt */
+#define KAZEN_BVH_REFIT_THRESHOLD 1.5f
+/* Children of nodes up to this depth are refit by separate tasks */
+#define KAZEN_BVH_REFIT_PARALLEL_DEPTH 3
+/* Spatial splits are only considered where sibling overlap exceeds this fraction of the scene surface area */
+#define KAZEN_SBVH_ALPHA 1e-5f
+/* Default maximum number of duplicated references relative to the number of primitives */
+#define KAZEN_SBVH_BUDGET 0.3f
+/* Largest leaf created by the LBVH builder */
+#define KAZEN_LBVH_LEAF_SIZE 4
+/* Version of the on-disk BVH cache format, must be increased whenever the node layout or build changes */
+#define KAZEN_BVH_CACHE_VERSION 1
+/* Alignment of the arrays stored in a BVH cache file */
+#define KAZEN_BVH_CACHE_ALIGNMENT 64
+/* Size of the blocks of mesh data that are hashed in parallel */
+#define KAZEN_BVH_CACHE_CHUNK_SIZE (1 << 20)
 
 NAMESPACE_BEGIN(kazen)
 
+NAMESPACE_BEGIN()
+    /// Header of an on-disk BVH cache file, followed by the node and index arrays
+    struct BVHCacheHeader {
+        char magic[4];          ///< "KBVH"
+        uint32_t version;       ///< \ref KAZEN_BVH_CACHE_VERSION
+        uint64_t key;           ///< Hash of the geometry and build settings
+        uint32_t width;         ///< \ref KAZEN_BVH_WIDTH
+        uint32_t nodeFormat;    ///< \ref Accel::ENodeFormat
+        uint32_t nodeSize;      ///< Size of a single node in bytes
+        uint32_t nodeCount;     ///< Number of nodes
+        uint32_t indexCount;    ///< Number of primitive indices
+        float bboxMin[3];       ///< Bounds of the hierarchy
+        float bboxMax[3];
+        float buildCost;        ///< SAH cost of the hierarchy
+        uint64_t nodeOffset;    ///< Offset of the node array in bytes
+        uint64_t indexOffset;   ///< Offset of the index array in bytes
+    };
+
+    /**
+     * \brief Reciprocal ray direction for the slab tests
+     *
+     * Components that are (nearly) zero are replaced by a tiny value of the
+     * same sign, so that the reciprocal stays finite. With an infinite
+     * reciprocal, the slab test of an axis-parallel ray computes
+     * <tt>inf - inf = NaN</tt> for that axis, and the subsequent min()/max()
+     * may then cull boxes that contain the ray.
+     */
+    template <typename Vector> Vector slabRcp(const Vector &d) {
+        return rcp(select(abs(d) < 1e-18f, copysign(Vector(1e-18f), d), d));
+    }
+
+    inline uint64_t alignCacheOffset(uint64_t offset) {
+        return (offset + KAZEN_BVH_CACHE_ALIGNMENT - 1) / KAZEN_BVH_CACHE_ALIGNMENT * KAZEN_BVH_CACHE_ALIGNMENT;
+    }
+
+    /**
+     * \brief Check that the children of all nodes of a cached hierarchy
+     * reference valid nodes and primitive ranges
+     *
+     * Inner children are always stored after their parent, which also rules
+     * out cycles. Every primitive index must be below \c primCount.
+     */
+    template <typename Node>
+    bool validCacheData(const Node *nodes, uint32_t nodeCount, const uint32_t *indices,
+                        uint32_t indexCount, uint32_t primCount) {
+        std::atomic<bool> valid { true };
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, nodeCount, 1024),
+            [&](const tbb::blocked_range<uint32_t> &range) {
+                for (uint32_t n = range.begin(); n != range.end(); ++n) {
+                    for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+                        if (nodes[n].isEmpty(i))
+                            continue;
+                        uint32_t target, size;
+                        nodes[n].getChild(i, target, size);
+                        if (size == 0 ? (target <= n || target >= nodeCount)
+                                      : (uint64_t) target + size > indexCount)
+                            valid = false;
+                    }
+                }
+            }
+        );
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, indexCount, 1 << 14),
+            [&](const tbb::blocked_range<uint32_t> &range) {
+                for (uint32_t i = range.begin(); i != range.end(); ++i) {
+                    if (indices[i] >= primCount)
+                        valid = false;
+                }
+            }
+        );
+        return valid;
+    }
+
+#if defined(KAZEN_ENABLE_ACCEL_STATS)
+    /// Registry of the traversal counters of all threads
+    std::mutex statisticsMutex;
+    std::vector<AccelStatistics *> statisticsRegistry;
+    AccelStatistics retiredStatistics;  ///< Counters of threads that have exited
+
+    /// Traversal counters of a thread, registered for the lifetime of the thread
+    struct ThreadStatistics {
+        AccelStatistics statistics;
+
+        ThreadStatistics() {
+            std::lock_guard<std::mutex> lock(statisticsMutex);
+            statisticsRegistry.push_back(&statistics);
+        }
+
+        ~ThreadStatistics() {
+            std::lock_guard<std::mutex> lock(statisticsMutex);
+            retiredStatistics += statistics;
+            statisticsRegistry.erase(std::find(statisticsRegistry.begin(), statisticsRegistry.end(), &statistics));
+        }
+    };
+
+    thread_local ThreadStatistics threadStatistics;
+#endif
+
+    /* Readers of hierarchies published by Accel::update(): every thread
+       records the epoch at which its current query started (0: idle) */
+    std::atomic<uint64_t> queryEpoch { 1 };
+    std::mutex readerMutex;
+    std::vector<std::atomic<uint64_t> *> readerRegistry;
+
+    /// Query epoch of a thread, registered for the lifetime of the thread
+    struct ReaderEpoch {
+        std::atomic<uint64_t> epoch { 0 };
+        uint32_t depth = 0;     ///< Number of nested queries
+
+        ReaderEpoch() {
+            std::lock_guard<std::mutex> lock(readerMutex);
+            readerRegistry.push_back(&epoch);
+        }
+
+        ~ReaderEpoch() {
+            std::lock_guard<std::mutex> lock(readerMutex);
+            readerRegistry.erase(std::find(readerRegistry.begin(), readerRegistry.end(), &epoch));
+        }
+    };
+
+    thread_local ReaderEpoch readerEpoch;
+
+    /// Marks the calling thread as reading a published hierarchy for the lifetime of the guard
+    struct ReadGuard {
+        ReadGuard() {
+            if (readerEpoch.depth++ == 0)
+                readerEpoch.epoch.store(queryEpoch.load());
+        }
+
+        ~ReadGuard() {
+            if (--readerEpoch.depth == 0)
+                readerEpoch.epoch.store(0, std::memory_order_release);
+        }
+    };
+
+    /**
+     * \brief Wait until all queries that may have seen a hierarchy that was
+     * just replaced have finished
+     *
+     * Queries load the published hierarchy after announcing their epoch, so
+     * a query that loaded the old hierarchy announced an epoch older than
+     * the one started here. The epoch stores, the epoch loads and the
+     * accesses to \ref Accel::m_snapshot are all sequentially consistent,
+     * which rules out that a query loads the old hierarchy while this
+     * function still observes the query as idle. Queries that found no
+     * published hierarchy at all are not waited for, they traverse the
+     * hierarchy of the initial build, which is never released early.
+     */
+    void waitForReaders() {
+        uint64_t epoch = ++queryEpoch;
+
+        std::lock_guard<std::mutex> lock(readerMutex);
+        for (std::atomic<uint64_t> *reader : readerRegistry) {
+            uint64_t started;
+            while ((started = reader->load()) != 0 && started < epoch)
+                std::this_thread::yield();
+        }
+    }
+
+    /// Return the component of \c v along the axis \c k (which may differ per lane)
+    template <typename Value, typename Index>
+    KAZEN_INLINE Value permute(const Vector<Value, 3> &v, const Index &k) {
+        if constexpr (std::is_arithmetic_v<Value>)
+            return v[k];
+        else
+            return select(eq(k, 0u), v.x(), select(eq(k, 1u), v.y(), v.z()));
+    }
+
+    /**
+     * \brief Interpolate between two key frames
+     *
+     * Unlike <tt>fmadd(b - a, w, a)</tt>, the result is monotonic in both
+     * \c a and \c b, hence bounds interpolated this way always contain
+     * vertex positions interpolated with the same weight.
+     */
+    template <typename Value, typename Weight>
+    KAZEN_INLINE Value lerpKeyFrames(const Value &a, const Value &b, const Weight &w) {
+        return fmadd(b, w, a * (1.f - w));
+    }
+
+    /**
+     * \brief Watertight ray-triangle test (see \ref Accel::WatertightRay)
+     *
+     * The vertices are given relative to the ray origin, with their
+     * components already permuted to (kx, ky, kz). Either the ray or the
+     * triangle may be vectorized.
+     */
+    template <typename Value, typename Shear>
+    KAZEN_INLINE mask_t<Value> watertightTest(const Vector<Value, 3> &a, const Vector<Value, 3> &b,
+                                              const Vector<Value, 3> &c, const Shear &sx, const Shear &sy,
+                                              const Shear &sz, const Shear &mint, const Shear &maxt,
+                                              Value &t, Value &u, Value &v) {
+        /* Shear the vertices onto the plane orthogonal to the ray */
+        Value ax = a.x() - sx * a.z(), ay = a.y() - sy * a.z(),
+              bx = b.x() - sx * b.z(), by = b.y() - sy * b.z(),
+              cx = c.x() - sx * c.z(), cy = c.y() - sy * c.z();
+
+        /* Scaled barycentric coordinates. No fused operations here: the
+           triangle sharing an edge has to compute exactly the negated value. */
+        Value e0 = cx * by - cy * bx,
+              e1 = ax * cy - ay * cx,
+              e2 = bx * ay - by * ax;
+
+        mask_t<Value> active = (e0 >= 0.f && e1 >= 0.f && e2 >= 0.f) ||
+                               (e0 <= 0.f && e1 <= 0.f && e2 <= 0.f);
+
+        Value det = e0 + e1 + e2;
+        active &= neq(det, 0.f);
+
+        Value tScaled = e0 * (sz * a.z()) + e1 * (sz * b.z()) + e2 * (sz * c.z());
+        Value invDet = rcp(det);
+
+        t = tScaled * invDet;
+        u = e1 * invDet;
+        v = e2 * invDet;
+        return active && t >= mint && t <= maxt;
+    }
+
+    /**
+     * \brief Ray-sphere and ray-disk test (see \ref Accel::intersectParticles())
+     *
+     * \c f is the ray origin relative to the particle center, and disks are
+     * marked by a negative radius. The sphere quadratic is solved in the
+     * robust form of Haines et al. ("Precision Improvements for Ray/Sphere
+     * Intersection", Ray Tracing Gems 2019): its discriminant is computed
+     * from the distance between the center and the ray, which does not
+     * cancel out for small spheres far away from the origin, and the roots
+     * are found without subtracting quantities of similar magnitude. A disk
+     * faces the ray and is hit at the point where the ray passes closest to
+     * its center. Either the ray or the particles may be vectorized.
+     */
+    template <typename Value>
+    KAZEN_INLINE mask_t<Value> particleTest(const Vector<Value, 3> &f, const Vector<Value, 3> &d,
+                                            const Value &radius, const Value &mint, const Value &maxt,
+                                            Value &t) {
+        Value a = squared_norm(d),
+              b = dot(f, d),
+              invA = rcp(a),
+              r2 = sqr(radius);
+
+        /* Squared distance between the center and the ray, relative to the radius */
+        Vector<Value, 3> l = fnmadd(d, b * invA, f);
+        Value disc = r2 - squared_norm(l);
+        mask_t<Value> active = disc >= 0.f;
+
+        /* Both roots of the sphere, and the closest approach for disks */
+        Value s = sqrt(max(a * disc, 0.f)),
+              q = -(b + select(b >= 0.f, s, -s)),
+              t0 = (squared_norm(f) - r2) / q,
+              t1 = q * invA;
+        Value tNear = min(t0, t1),
+              tFar  = max(t0, t1);
+
+        t = select(radius < 0.f, -b * invA, select(tNear >= mint, tNear, tFar));
+        return active && t >= mint && t <= maxt;
+    }
+NAMESPACE_END()
+
+/**
+ * \brief Build task for the binned SAH BVH
+ *
+ * Each invocation constructs the subtree over the primitive range
+ * <tt>[start, end)</tt> of \ref Accel::m_indices. A subtree over \c n
+ * primitives never requires more than <tt>2n-1</tt> nodes, hence the right
+ * child of a node whose left subtree covers \c k primitives is placed
+ * \c 2k entries after its parent. This lets concurrent tasks write into
+ * the shared node array without synchronization and makes the resulting
+ * tree independent of the number of threads.
+ */
+struct BVHBuildTask {
+    using ScalarFloat         = Accel::ScalarFloat;
+    using ScalarIndex         = Accel::ScalarIndex;
+    using ScalarSize          = Accel::ScalarSize;
+    using ScalarPoint3f       = Accel::ScalarPoint3f;
+    using ScalarVector3f      = Accel::ScalarVector3f;
+    using ScalarBoundingBox3f = Accel::ScalarBoundingBox3f;
+
+    /// Per-axis bin statistics gathered for a single node
+    struct Bins {
+        ScalarBoundingBox3f bbox[3][KAZEN_BVH_BINS];
+        ScalarSize count[3][KAZEN_BVH_BINS] = { };
+
+        void merge(const Bins &other) {
+            for (int axis = 0; axis < 3; ++axis) {
+                for (int i = 0; i < KAZEN_BVH_BINS; ++i) {
+                    bbox[axis][i].expand(other.bbox[axis][i]);
+                    count[axis][i] += other.count[axis][i];
+                }
+            }
+        }
+    };
+
+    /// Bounds of a primitive range and of the associated centroids
+    struct Bounds {
+        ScalarBoundingBox3f bbox;
+        ScalarBoundingBox3f centroidBBox;
+
+        void merge(const Bounds &other) {
+            bbox.expand(other.bbox);
+            centroidBBox.expand(other.centroidBBox);
+        }
+    };
+
+    Accel &accel;
+    const std::vector<ScalarBoundingBox3f> &bboxes;
+    const std::vector<ScalarPoint3f> &centroids;
+
+    BVHBuildTask(Accel &accel,
+                 const std::vector<ScalarBoundingBox3f> &bboxes,
+                 const std::vector<ScalarPoint3f> &centroids)
+        : accel(accel), bboxes(bboxes), centroids(centroids) { }
+
+    /// Apply \c func to the range <tt>[start, end)</tt>, in parallel if it is large enough
+    template <typename T, typename Func>
+    static T reduce(ScalarIndex start, ScalarIndex end, const Func &func) {
+        if (end - start < KAZEN_BVH_SERIAL_THRESHOLD) {
+            T result;
+            func(start, end, result);
+            return result;
+        }
+
+        return tbb::parallel_reduce(
+            tbb::blocked_range<ScalarIndex>(start, end, KAZEN_BVH_SERIAL_THRESHOLD), T(),
+            [&](const tbb::blocked_range<ScalarIndex> &range, T result) {
+                func(range.begin(), range.end(), result);
+                return result;
+            },
+            [](T a, const T &b) {
+                a.merge(b);
+                return a;
+            }
+        );
+    }
+
+    /// Result of the binned SAH split search over a primitive range
+    struct Split {
+        int axis = -1;              ///< Split axis, or -1 if no split plane separates the centroids
+        int bin = -1;               ///< Last bin of the left side
+        ScalarFloat cost = math::Infinity<ScalarFloat>; ///< SAH cost of the split
+        ScalarPoint3f origin;       ///< Lower corner of the centroid bounds
+        ScalarVector3f scale;       ///< Number of bins per unit length along each axis
+
+        /// Return the bin of the given centroid along an axis
+        int binIndex(const ScalarPoint3f &p, int axis) const {
+            int index = (int) ((p[axis] - origin[axis]) * scale[axis]);
+            return std::min(index, KAZEN_BVH_BINS - 1);
+        }
+
+        /// Does the given centroid lie on the left side of the split plane?
+        bool isLeft(const ScalarPoint3f &p) const { return binIndex(p, axis) <= bin; }
+    };
+
+    /// Compute the bounds of the primitives in <tt>[start, end)</tt> and of their centroids
+    Bounds computeBounds(ScalarIndex start, ScalarIndex end) const {
+        const ScalarIndex *indices = accel.m_indices.data();
+        return reduce<Bounds>(start, end,
+            [&](ScalarIndex from, ScalarIndex to, Bounds &result) {
+                for (ScalarIndex i = from; i < to; ++i) {
+                    result.bbox.expand(bboxes[indices[i]]);
+                    result.centroidBBox.expand(centroids[indices[i]]);
+                }
+            }
+        );
+    }
+
+    /// Find the split plane between two bins with the lowest SAH cost for the primitives in <tt>[start, end)</tt>
+    Split findSplit(ScalarIndex start, ScalarIndex end, const Bounds &bounds) const {
+        const ScalarIndex *indices = accel.m_indices.data();
+        Split split;
+
+        /* Map centroids to bins along each axis */
+        ScalarVector3f extents = bounds.centroidBBox.extents();
+        split.origin = bounds.centroidBBox.min;
+        for (int axis = 0; axis < 3; ++axis)
+            split.scale[axis] = extents[axis] > 0.f ? KAZEN_BVH_BINS / extents[axis] : 0.f;
+
+        Bins bins = reduce<Bins>(start, end,
+            [&](ScalarIndex from, ScalarIndex to, Bins &result) {
+                for (ScalarIndex i = from; i < to; ++i) {
+                    ScalarIndex idx = indices[i];
+                    for (int axis = 0; axis < 3; ++axis) {
+                        int bin = split.binIndex(centroids[idx], axis);
+                        result.bbox[axis][bin].expand(bboxes[idx]);
+                        result.count[axis][bin]++;
+                    }
+                }
+            }
+        );
+
+        /* Evaluate the SAH for all split planes between adjacent bins */
+        ScalarFloat area = bounds.bbox.surfaceArea();
+        ScalarFloat invArea = area > 0.f ? 1.f / area : 0.f;
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (split.scale[axis] == 0.f)
+                continue;
+
+            ScalarFloat rightArea[KAZEN_BVH_BINS];
+            ScalarSize rightCount[KAZEN_BVH_BINS];
+            ScalarBoundingBox3f accum;
+            ScalarSize count = 0;
+
+            for (int i = KAZEN_BVH_BINS - 1; i > 0; --i) {
+                accum.expand(bins.bbox[axis][i]);
+                count += bins.count[axis][i];
+                rightArea[i] = count > 0 ? accum.surfaceArea() : 0.f;
+                rightCount[i] = count;
+            }
+
+            accum.reset();
+            count = 0;
+
+            for (int i = 0; i < KAZEN_BVH_BINS - 1; ++i) {
+                accum.expand(bins.bbox[axis][i]);
+                count += bins.count[axis][i];
+                if (count == 0 || rightCount[i + 1] == 0)
+                    continue;
+
+                ScalarFloat cost = KAZEN_BVH_TRAVERSAL_COST + KAZEN_BVH_INTERSECTION_COST * invArea *
+                    (count * accum.surfaceArea() + rightCount[i + 1] * rightArea[i + 1]);
+
+                if (cost < split.cost) {
+                    split.cost = cost;
+                    split.axis = axis;
+                    split.bin = i;
+                }
+            }
+        }
+
+        return split;
+    }
+
+    void operator()(ScalarIndex nodeIdx, ScalarIndex start, ScalarIndex end, uint32_t depth) const {
+        ScalarSize size = end - start;
+        ScalarIndex *indices = accel.m_indices.data();
+        Accel::BVHNode &node = accel.m_nodes[nodeIdx];
+
+        /* Compute the bounds of the primitives and of their centroids */
+        Bounds bounds = computeBounds(start, end);
+        node.bbox = bounds.bbox;
+
+        if (size == 1 || depth + 1 >= KAZEN_BVH_MAX_DEPTH) {
+            makeLeaf(node, start, size);
+            return;
+        }
+
+        Split split = findSplit(start, end, bounds);
+        ScalarFloat leafCost = KAZEN_BVH_INTERSECTION_COST * size;
+
+        /* Stop if splitting does not pay off and the leaf is small enough */
+        if (size <= KAZEN_BVH_MAX_LEAF_SIZE && (split.axis == -1 || split.cost >= leafCost)) {
+            makeLeaf(node, start, size);
+            return;
+        }
+
+        ScalarIndex mid;
+        int bestAxis = split.axis;
+        if (bestAxis != -1) {
+            mid = (ScalarIndex) (std::partition(indices + start, indices + end,
+                [&](ScalarIndex idx) { return split.isLeft(centroids[idx]); }
+            ) - indices);
+        } else {
+            /* All centroids coincide: no split plane can separate them */
+            bestAxis = 0;
+            mid = start + size / 2;
+        }
+
+        ScalarIndex leftIdx  = nodeIdx + 1,
+                    rightIdx = nodeIdx + 2 * (mid - start);
+
+        node.inner.flag = 0;
+        node.inner.axis = (uint32_t) bestAxis;
+        node.inner.rightChild = rightIdx;
+
+        if (size >= KAZEN_BVH_SERIAL_THRESHOLD) {
+            tbb::parallel_invoke(
+                [&] { (*this)(leftIdx, start, mid, depth + 1); },
+                [&] { (*this)(rightIdx, mid, end, depth + 1); }
+            );
+        } else {
+            (*this)(leftIdx, start, mid, depth + 1);
+            (*this)(rightIdx, mid, end, depth + 1);
+        }
+    }
+
+    static void makeLeaf(Accel::BVHNode &node, ScalarIndex start, ScalarSize size) {
+        node.leaf.flag = 1;
+        node.leaf.size = size;
+        node.leaf.start = start;
+    }
+};
+
+/**
+ * \brief Build task for the spatial-split BVH (SBVH)
+ *
+ * In addition to the object partitions of \ref BVHBuildTask, every node
+ * considers splitting space at bin boundaries: references that straddle
+ * the plane are clipped and continue in both children with tighter
+ * bounds. Spatial splits are only evaluated where the best object split
+ * leaves overlapping children.
+ *
+ * Every task owns a budget of reference slots in \c refs and
+ * \ref Accel::m_indices (at least its number of references), and the
+ * subtree stays within it. A subtree with budget \c b needs at most
+ * <tt>2b-1</tt> nodes, so nodes are placed as in \ref BVHBuildTask.
+ * Left over slots are split between the children in proportion to their
+ * reference counts, which keeps the build deterministic and caps the total
+ * amount of duplication.
+ */
+struct SBVHBuildTask {
+    using ScalarFloat         = Accel::ScalarFloat;
+    using ScalarIndex         = Accel::ScalarIndex;
+    using ScalarSize          = Accel::ScalarSize;
+    using ScalarPoint3f       = Accel::ScalarPoint3f;
+    using ScalarVector3f      = Accel::ScalarVector3f;
+    using ScalarBoundingBox3f = Accel::ScalarBoundingBox3f;
+    using Bins                = BVHBuildTask::Bins;
+    using Bounds              = BVHBuildTask::Bounds;
+
+    /// A (possibly clipped) reference to a primitive
+    struct Reference {
+        ScalarIndex index;
+        ScalarBoundingBox3f bbox;
+    };
+
+    /// Per-axis statistics of the clipped references in each spatial bin
+    struct SpatialBins {
+        ScalarBoundingBox3f bbox[3][KAZEN_BVH_BINS];
+        ScalarSize entry[3][KAZEN_BVH_BINS] = { };
+        ScalarSize exit[3][KAZEN_BVH_BINS] = { };
+
+        void merge(const SpatialBins &other) {
+            for (int axis = 0; axis < 3; ++axis) {
+                for (int i = 0; i < KAZEN_BVH_BINS; ++i) {
+                    bbox[axis][i].expand(other.bbox[axis][i]);
+                    entry[axis][i] += other.entry[axis][i];
+                    exit[axis][i] += other.exit[axis][i];
+                }
+            }
+        }
+    };
+
+    Accel &accel;
+    std::vector<Reference> &refs;
+    ScalarFloat minOverlap;
+
+    SBVHBuildTask(Accel &accel, std::vector<Reference> &refs, ScalarFloat minOverlap)
+        : accel(accel), refs(refs), minOverlap(minOverlap) { }
+
+    /// Return the part of a reference that lies within the slab <tt>[lo, hi]</tt> along the given axis
+    ScalarBoundingBox3f clip(const Reference &ref, int axis, ScalarFloat lo, ScalarFloat hi) const {
+        ScalarBoundingBox3f result;
+
+        if (ref.index < accel.getTriangleCount()) {
+            /* Clip the triangle itself: collect its vertices inside the
+               slab and the points where its edges cross the slab planes */
+            ScalarIndex idx = ref.index;
+            const Mesh *mesh = accel.m_meshes[accel.findMesh(idx)];
+            auto fi = mesh->getFaceIndices(idx);
+            ScalarPoint3f p[3] = { mesh->getVertexPosition(fi[0]),
+                                   mesh->getVertexPosition(fi[1]),
+                                   mesh->getVertexPosition(fi[2]) };
+
+            for (int i = 0; i < 3; ++i) {
+                const ScalarPoint3f &a = p[i], &b = p[(i + 1) % 3];
+                if (a[axis] >= lo && a[axis] <= hi)
+                    result.expand(a);
+
+                for (ScalarFloat plane : { lo, hi }) {
+                    if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane)) {
+                        ScalarFloat t = (plane - a[axis]) / (b[axis] - a[axis]);
+                        ScalarPoint3f q = fmadd(b - a, t, a);
+                        q[axis] = plane;
+                        result.expand(q);
+                    }
+                }
+            }
+        } else {
+            /* Particles and instances are only clipped conservatively by their bounds */
+            result = ref.bbox;
+            result.min[axis] = std::max(result.min[axis], lo);
+            result.max[axis] = std::min(result.max[axis], hi);
+        }
+
+        /* The reference may already have been clipped by an earlier split */
+        result.clip(ref.bbox);
+        if (!result.valid())
+            result.reset();
+        return result;
+    }
+
+    void operator()(ScalarIndex nodeIdx, ScalarIndex start, ScalarSize size, ScalarSize budget, uint32_t depth) const {
+        Accel::BVHNode &node = accel.m_nodes[nodeIdx];
+
+        /* Compute the bounds of the references and of their centroids */
+        Bounds bounds = BVHBuildTask::reduce<Bounds>(start, start + size,
+            [&](ScalarIndex from, ScalarIndex to, Bounds &result) {
+                for (ScalarIndex i = from; i < to; ++i) {
+                    result.bbox.expand(refs[i].bbox);
+                    result.centroidBBox.expand(refs[i].bbox.center());
+                }
+            }
+        );
+        node.bbox = bounds.bbox;
+
+        if (size == 1 || depth + 1 >= KAZEN_BVH_MAX_DEPTH) {
+            makeLeaf(node, start, size);
+            return;
+        }
+
+        /* 1. Find the best object split (see \ref BVHBuildTask) */
+        ScalarVector3f extents = bounds.centroidBBox.extents();
+        ScalarVector3f scale;
+        for (int axis = 0; axis < 3; ++axis)
+            scale[axis] = extents[axis] > 0.f ? KAZEN_BVH_BINS / extents[axis] : 0.f;
+
+        auto binIndex = [&](const Reference &ref, int axis) {
+            int bin = (int) ((ref.bbox.center()[axis] - bounds.centroidBBox.min[axis]) * scale[axis]);
+            return std::min(bin, KAZEN_BVH_BINS - 1);
+        };
+
+        Bins bins = BVHBuildTask::reduce<Bins>(start, start + size,
+            [&](ScalarIndex from, ScalarIndex to, Bins &result) {
+                for (ScalarIndex i = from; i < to; ++i) {
+                    for (int axis = 0; axis < 3; ++axis) {
+                        int bin = binIndex(refs[i], axis);
+                        result.bbox[axis][bin].expand(refs[i].bbox);
+                        result.count[axis][bin]++;
+                    }
+                }
+            }
+        );
+
+        ScalarFloat area = node.bbox.surfaceArea();
+        ScalarFloat invArea = area > 0.f ? 1.f / area : 0.f;
+        ScalarFloat leafCost = KAZEN_BVH_INTERSECTION_COST * size;
+        ScalarFloat bestCost = math::Infinity<ScalarFloat>;
+        int bestAxis = -1, bestSplit = -1;
+        bool spatial = false;
+        ScalarBoundingBox3f bestLeft, bestRight;
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (scale[axis] == 0.f)
+                continue;
+
+            ScalarBoundingBox3f rightBBox[KAZEN_BVH_BINS];
+            ScalarSize rightCount[KAZEN_BVH_BINS];
+            ScalarBoundingBox3f accum;
+            ScalarSize count = 0;
+
+            for (int i = KAZEN_BVH_BINS - 1; i > 0; --i) {
+                accum.expand(bins.bbox[axis][i]);
+                count += bins.count[axis][i];
+                rightBBox[i] = accum;
+                rightCount[i] = count;
+            }
+
+            accum.reset();
+            count = 0;
+
+            for (int i = 0; i < KAZEN_BVH_BINS - 1; ++i) {
+                accum.expand(bins.bbox[axis][i]);
+                count += bins.count[axis][i];
+                if (count == 0 || rightCount[i + 1] == 0)
+                    continue;
+
+                ScalarFloat cost = KAZEN_BVH_TRAVERSAL_COST + KAZEN_BVH_INTERSECTION_COST * invArea *
+                    (count * accum.surfaceArea() + rightCount[i + 1] * rightBBox[i + 1].surfaceArea());
+
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                    bestLeft = accum;
+                    bestRight = rightBBox[i + 1];
+                }
+            }
+        }
+
+        /* 2. Try spatial splits if the children of the object split overlap
+              and there are unused reference slots */
+        ScalarBoundingBox3f overlap = bestLeft;
+        overlap.clip(bestRight);
+        bool trySpatial = budget > size &&
+            (bestAxis == -1 || (overlap.valid() && overlap.surfaceArea() > minOverlap));
+
+        ScalarVector3f nodeExtents = node.bbox.extents();
+        ScalarVector3f binWidth = nodeExtents / (ScalarFloat) KAZEN_BVH_BINS;
+
+        auto spatialBin = [&](ScalarFloat value, int axis) {
+            int bin = (int) ((value - node.bbox.min[axis]) / binWidth[axis]);
+            return std::clamp(bin, 0, KAZEN_BVH_BINS - 1);
+        };
+        auto binPlane = [&](int bin, int axis) {
+            return node.bbox.min[axis] + binWidth[axis] * (ScalarFloat) bin;
+        };
+
+        if (trySpatial) {
+            SpatialBins sbins = BVHBuildTask::reduce<SpatialBins>(start, start + size,
+                [&](ScalarIndex from, ScalarIndex to, SpatialBins &result) {
+                    for (ScalarIndex i = from; i < to; ++i) {
+                        const Reference &ref = refs[i];
+                        for (int axis = 0; axis < 3; ++axis) {
+                            if (binWidth[axis] <= 0.f)
+                                continue;
+                            int first = spatialBin(ref.bbox.min[axis], axis),
+                                last  = spatialBin(ref.bbox.max[axis], axis);
+                            for (int bin = first; bin <= last; ++bin) {
+                                ScalarFloat lo = bin == first ? ref.bbox.min[axis] : binPlane(bin, axis),
+                                            hi = bin == last ? ref.bbox.max[axis] : binPlane(bin + 1, axis);
+                                result.bbox[axis][bin].expand(first == last ? ref.bbox : clip(ref, axis, lo, hi));
+                            }
+                            result.entry[axis][first]++;
+                            result.exit[axis][last]++;
+                        }
+                    }
+                }
+            );
+
+            for (int axis = 0; axis < 3; ++axis) {
+                if (binWidth[axis] <= 0.f)
+                    continue;
+
+                ScalarBoundingBox3f rightBBox[KAZEN_BVH_BINS];
+                ScalarSize rightCount[KAZEN_BVH_BINS];
+                ScalarBoundingBox3f accum;
+                ScalarSize count = 0;
+
+                for (int i = KAZEN_BVH_BINS - 1; i > 0; --i) {
+                    accum.expand(sbins.bbox[axis][i]);
+                    count += sbins.exit[axis][i];
+                    rightBBox[i] = accum;
+                    rightCount[i] = count;
+                }
+
+                accum.reset();
+                count = 0;
+
+                for (int i = 0; i < KAZEN_BVH_BINS - 1; ++i) {
+                    accum.expand(sbins.bbox[axis][i]);
+                    count += sbins.entry[axis][i];
+                    if (count == 0 || rightCount[i + 1] == 0 || count + rightCount[i + 1] > budget)
+                        continue;
+
+                    ScalarFloat cost = KAZEN_BVH_TRAVERSAL_COST + KAZEN_BVH_INTERSECTION_COST * invArea *
+                        (count * accum.surfaceArea() + rightCount[i + 1] * rightBBox[i + 1].surfaceArea());
+
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = i;
+                        spatial = true;
+                    }
+                }
+            }
+        }
+
+        /* Stop if splitting does not pay off and the leaf is small enough */
+        if (size <= KAZEN_BVH_MAX_LEAF_SIZE && (bestAxis == -1 || bestCost >= leafCost)) {
+            makeLeaf(node, start, size);
+            return;
+        }
+
+        /* 3. Distribute the references over the children */
+        std::vector<Reference> left, right;
+        if (spatial) {
+            ScalarFloat plane = binPlane(bestSplit + 1, bestAxis);
+            for (ScalarIndex i = start; i < start + size; ++i) {
+                const Reference &ref = refs[i];
+                int first = spatialBin(ref.bbox.min[bestAxis], bestAxis),
+                    last  = spatialBin(ref.bbox.max[bestAxis], bestAxis);
+
+                if (last <= bestSplit) {
+                    left.push_back(ref);
+                } else if (first > bestSplit) {
+                    right.push_back(ref);
+                } else {
+                    /* Straddling reference: continue with a clipped copy on both sides */
+                    Reference l { ref.index, clip(ref, bestAxis, ref.bbox.min[bestAxis], plane) },
+                              r { ref.index, clip(ref, bestAxis, plane, ref.bbox.max[bestAxis]) };
+                    if (l.bbox.valid())
+                        left.push_back(l);
+                    if (r.bbox.valid())
+                        right.push_back(r);
+                }
+            }
+        } else if (bestAxis != -1) {
+            for (ScalarIndex i = start; i < start + size; ++i)
+                (binIndex(refs[i], bestAxis) <= bestSplit ? left : right).push_back(refs[i]);
+        }
+
+        if (left.empty() || right.empty()) {
+            /* No plane separates the references */
+            left.assign(refs.begin() + start, refs.begin() + start + size / 2);
+            right.assign(refs.begin() + start + size / 2, refs.begin() + start + size);
+            bestAxis = 0;
+        }
+
+        ScalarSize leftSize = (ScalarSize) left.size(),
+                   rightSize = (ScalarSize) right.size(),
+                   extra = budget - leftSize - rightSize;
+        ScalarSize leftBudget = leftSize + (ScalarSize) ((uint64_t) extra * leftSize / (leftSize + rightSize)),
+                   rightBudget = budget - leftBudget;
+
+        std::copy(left.begin(), left.end(), refs.begin() + start);
+        std::copy(right.begin(), right.end(), refs.begin() + start + leftBudget);
+        std::vector<Reference>().swap(left);
+        std::vector<Reference>().swap(right);
+
+        ScalarIndex leftIdx  = nodeIdx + 1,
+                    rightIdx = nodeIdx + 2 * leftBudget;
+
+        node.inner.flag = 0;
+        node.inner.axis = (uint32_t) bestAxis;
+        node.inner.rightChild = rightIdx;
+
+        if (size >= KAZEN_BVH_SERIAL_THRESHOLD) {
+            tbb::parallel_invoke(
+                [&] { (*this)(leftIdx, start, leftSize, leftBudget, depth + 1); },
+                [&] { (*this)(rightIdx, start + leftBudget, rightSize, rightBudget, depth + 1); }
+            );
+        } else {
+            (*this)(leftIdx, start, leftSize, leftBudget, depth + 1);
+            (*this)(rightIdx, start + leftBudget, rightSize, rightBudget, depth + 1);
+        }
+    }
+
+    void makeLeaf(Accel::BVHNode &node, ScalarIndex start, ScalarSize size) const {
+        BVHBuildTask::makeLeaf(node, start, size);
+        for (ScalarIndex i = start; i < start + size; ++i)
+            accel.m_indices[i] = refs[i].index;
+    }
+};
+
+/**
+ * \brief Linear BVH construction (LBVH)
+ *
+ * Primitive centroids are quantized to a grid of 2^21 cells per axis
+ * spanning the centroid bounds, and the primitives are sorted by the
+ * 63-bit Morton code of their cell with a parallel radix sort. The
+ * hierarchy then follows the bits of the sorted codes: the primitives of a
+ * node share all code bits above the highest bit in which the first and
+ * the last code of the node differ, and the right child starts with the
+ * first primitive that has this bit set.
+ *
+ * As in HLBVH, the top \c sahLevels levels can instead be split with the
+ * binned SAH of \ref BVHBuildTask. Their partitions are stable, so the
+ * primitives of every child remain sorted by their codes, and the Morton
+ * splits take over below these levels. Nodes are placed as in
+ * \ref BVHBuildTask.
+ */
+struct LBVHBuildTask {
+    using ScalarFloat         = Accel::ScalarFloat;
+    using ScalarIndex         = Accel::ScalarIndex;
+    using ScalarSize          = Accel::ScalarSize;
+    using ScalarPoint3f       = Accel::ScalarPoint3f;
+    using ScalarVector3f      = Accel::ScalarVector3f;
+    using ScalarBoundingBox3f = Accel::ScalarBoundingBox3f;
+    using Bounds              = BVHBuildTask::Bounds;
+
+    /// Primitive along with its Morton code (the unit of the radix sort)
+    struct Key {
+        uint64_t code;
+        ScalarIndex index;
+    };
+
+    Accel &accel;
+    BVHBuildTask sah;
+    uint32_t sahLevels;
+    std::vector<uint64_t> codes;
+
+    LBVHBuildTask(Accel &accel,
+                  const std::vector<ScalarBoundingBox3f> &bboxes,
+                  const std::vector<ScalarPoint3f> &centroids,
+                  uint32_t sahLevels)
+        : accel(accel), sah(accel, bboxes, centroids), sahLevels(sahLevels) {
+        ScalarSize size = (ScalarSize) accel.m_indices.size();
+        Bounds bounds = sah.computeBounds(0u, size);
+
+        MortonEncoder<ScalarBoundingBox3f> morton(bounds.centroidBBox);
+        std::vector<Key> keys(size);
+        codes.resize(size);
+        tbb::parallel_for(tbb::blocked_range<ScalarIndex>(0u, size, KAZEN_BVH_SERIAL_THRESHOLD),
+            [&](const tbb::blocked_range<ScalarIndex> &range) {
+                for (ScalarIndex i = range.begin(); i != range.end(); ++i) {
+                    codes[i] = morton(centroids[i]);
+                    keys[i] = { codes[i], i };
+                }
+            }
+        );
+
+        radixSort(keys);
+        for (ScalarIndex i = 0; i < size; ++i)
+            accel.m_indices[i] = keys[i].index;
+    }
+
+    /**
+     * \brief Stable parallel least-significant-digit radix sort by code
+     *
+     * Every pass sorts by 8 bits: the keys are split into blocks, digits are
+     * counted per block in parallel, and every block then scatters its keys
+     * to the offsets given by a prefix sum over (digit, block). Passes over
+     * digits that are the same for all keys are skipped.
+     */
+    static void radixSort(std::vector<Key> &keys) {
+        size_t size = keys.size();
+        size_t blockCount = std::max((size_t) 1, std::min((size_t) 256, size / KAZEN_BVH_SERIAL_THRESHOLD));
+        std::vector<Key> temp(size);
+        std::vector<std::array<size_t, 256>> offsets(blockCount);
+
+        auto blockRange = [&](size_t block) {
+            return std::make_pair(block * size / blockCount, (block + 1) * size / blockCount);
+        };
+
+        for (int shift = 0; shift < 63; shift += 8) {
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, blockCount, 1),
+                [&](const tbb::blocked_range<size_t> &range) {
+                    for (size_t block = range.begin(); block != range.end(); ++block) {
+                        auto [from, to] = blockRange(block);
+                        offsets[block].fill(0);
+                        for (size_t i = from; i < to; ++i)
+                            offsets[block][(keys[i].code >> shift) & 0xff]++;
+                    }
+                }
+            );
+
+            size_t offset = 0;
+            bool trivial = false;
+            for (size_t digit = 0; digit < 256; ++digit) {
+                size_t start = offset;
+                for (size_t block = 0; block < blockCount; ++block) {
+                    size_t count = offsets[block][digit];
+                    offsets[block][digit] = offset;
+                    offset += count;
+                }
+                if (offset - start == size)
+                    trivial = true;
+            }
+            if (trivial)
+                continue;
+
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, blockCount, 1),
+                [&](const tbb::blocked_range<size_t> &range) {
+                    for (size_t block = range.begin(); block != range.end(); ++block) {
+                        auto [from, to] = blockRange(block);
+                        for (size_t i = from; i < to; ++i)
+                            temp[offsets[block][(keys[i].code >> shift) & 0xff]++] = keys[i];
+                    }
+                }
+            );
+            keys.swap(temp);
+        }
+    }
+
+    /// Build the subtree of the primitives in <tt>[start, end)</tt> and return its bounds
+    ScalarBoundingBox3f operator()(ScalarIndex nodeIdx, ScalarIndex start, ScalarIndex end, uint32_t depth) const {
+        ScalarSize size = end - start;
+        ScalarIndex *indices = accel.m_indices.data();
+        Accel::BVHNode &node = accel.m_nodes[nodeIdx];
+
+        if (size <= KAZEN_LBVH_LEAF_SIZE || depth + 1 >= KAZEN_BVH_MAX_DEPTH) {
+            node.bbox = sah.computeBounds(start, end).bbox;
+            BVHBuildTask::makeLeaf(node, start, size);
+            return node.bbox;
+        }
+
+        ScalarIndex mid = start + size / 2;
+        uint32_t axis = 0;
+
+        if (depth < sahLevels) {
+            BVHBuildTask::Split split = sah.findSplit(start, end, sah.computeBounds(start, end));
+            if (split.axis != -1) {
+                mid = (ScalarIndex) (std::stable_partition(indices + start, indices + end,
+                    [&](ScalarIndex idx) { return split.isLeft(sah.centroids[idx]); }
+                ) - indices);
+                axis = (uint32_t) split.axis;
+            }
+        } else {
+            /* The codes of the range are sorted, so the first and the last one differ in the highest bit */
+            uint64_t diff = codes[indices[start]] ^ codes[indices[end - 1]];
+            if (diff != 0) {
+                int bit = 63 - (int) lzcnt(diff);
+                uint64_t mask = 1ull << bit;
+                mid = (ScalarIndex) (std::partition_point(indices + start, indices + end,
+                    [&](ScalarIndex idx) { return (codes[idx] & mask) == 0; }
+                ) - indices);
+                axis = (uint32_t) (2 - bit % 3);
+            }
+            /* Otherwise, all centroids lie in the same cell and the range is split in the middle */
+        }
+
+        ScalarIndex leftIdx  = nodeIdx + 1,
+                    rightIdx = nodeIdx + 2 * (mid - start);
+
+        node.inner.flag = 0;
+        node.inner.axis = axis;
+        node.inner.rightChild = rightIdx;
+
+        ScalarBoundingBox3f left, right;
+        if (size >= KAZEN_BVH_SERIAL_THRESHOLD) {
+            tbb::parallel_invoke(
+                [&] { left = (*this)(leftIdx, start, mid, depth + 1); },
+                [&] { right = (*this)(rightIdx, mid, end, depth + 1); }
+            );
+        } else {
+            left = (*this)(leftIdx, start, mid, depth + 1);
+            right = (*this)(rightIdx, mid, end, depth + 1);
+        }
+
+        node.bbox = left;
+        node.bbox.expand(right);
+        return node.bbox;
+    }
+};
+
+
+Accel::Accel(const PropertyList &props) {
+    m_meshOffset.push_back(0u);
+    m_particleOffset.push_back(0u);
+
+    std::string format = props.getString("nodeFormat", "wide");
+    if (format == "wide")
+        m_nodeFormat = EWideNodes;
+    else if (format == "quantized")
+        m_nodeFormat = EQuantizedNodes;
+    else
+        throw Exception("Accel: unknown node format \"{}\" (expected \"wide\" or \"quantized\")", format);
+
+    m_refitThreshold = props.getFloat("refitThreshold", KAZEN_BVH_REFIT_THRESHOLD);
+    if (m_refitThreshold < 1.f)
+        throw Exception("Accel: the refit threshold must be at least 1 (got {})", m_refitThreshold);
+
+    std::string builder = props.getString("builder", "sah");
+    if (builder == "sah")
+        m_builder = ESAHBuilder;
+    else if (builder == "lbvh")
+        m_builder = ELinearBuilder;
+    else
+        throw Exception("Accel: unknown builder \"{}\" (expected \"sah\" or \"lbvh\")", builder);
+
+    int sahLevels = props.getInt("lbvhSahLevels", 0);
+    if (sahLevels < 0)
+        throw Exception("Accel: the number of SAH levels of the LBVH builder must be non-negative (got {})", sahLevels);
+    m_lbvhSahLevels = (uint32_t) sahLevels;
+
+    m_reorderNodes = props.getBool("reorderNodes", true);
+
+    m_spatialSplits = props.getBool("spatialSplits", false);
+    if (m_spatialSplits && m_builder == ELinearBuilder)
+        throw Exception("Accel: spatial splits are not supported by the LBVH builder");
+    m_spatialSplitBudget = props.getFloat("spatialSplitBudget", KAZEN_SBVH_BUDGET);
+    if (m_spatialSplitBudget < 0.f)
+        throw Exception("Accel: the spatial split budget must be non-negative (got {})", m_spatialSplitBudget);
+
+    m_cacheDir = props.getString("cacheDir", "");
+
+    std::string backend = props.getString("backend", "kazen");
+    if (backend == "embree") {
+#if defined(KAZEN_USE_EMBREE)
+        m_embree.reset(new EmbreeAccel());
+#else
+        throw Exception("Accel: the \"embree\" backend is not available (configure with KAZEN_USE_EMBREE)");
+#endif
+    } else if (backend != "kazen") {
+        throw Exception("Accel: unknown backend \"{}\" (expected \"kazen\" or \"embree\")", backend);
+    }
+}
+
+Accel::~Accel() {
+    delete m_snapshot.load();
+}
+
 void Accel::addMesh(Mesh *mesh) {
+    if (m_built) {
+        std::lock_guard<std::mutex> lock(m_updateMutex);
+        startEditing();
+        m_sceneMeshes.push_back(mesh);
+        m_pendingEdits = true;
+        return;
+    }
+
+    m_meshes.push_back(mesh);
+    m_meshOffset.push_back(m_meshOffset.back() + mesh->getFaceCount());
+    m_bbox.expand(mesh->bbox());
+}
+
+void Accel::addInstance(const Instance *instance) {
+    if (m_built) {
+        std::lock_guard<std::mutex> lock(m_updateMutex);
+        startEditing();
+        m_sceneInstances.push_back(instance);
+        m_pendingEdits = true;
+        return;
+    }
+
+    m_instances.push_back(instance);
+    m_instanceBBoxes.push_back(instance->getBoundingBox());
+    m_bbox.expand(m_instanceBBoxes.back());
+}
+
+void Accel::addParticles(const Particles *particles) {
+    if (m_built)
+        throw Exception("Accel::addParticles(): particles have to be registered before the build");
+
+    m_particles.push_back(particles);
+    m_particleOffset.push_back(m_particleOffset.back() + particles->getParticleCount());
+    m_bbox.expand(particles->bbox());
+}
+
+void Accel::removeMesh(const Mesh *mesh) {
+    std::lock_guard<std::mutex> lock(m_updateMutex);
+    if (m_built)
+        startEditing();
+
+    std::vector<Mesh *> &meshes = m_editing ? m_sceneMeshes : m_meshes;
+    auto it = std::find(meshes.begin(), meshes.end(), mesh);
+    if (it == meshes.end())
+        throw Exception("Accel::removeMesh(): mesh \"{}\" is not registered", mesh->getName());
+    meshes.erase(it);
+
+    if (m_editing) {
+        m_pendingEdits = true;
+        return;
+    }
+
+    /* Not built yet: renumber the triangles of the remaining meshes */
+    m_meshOffset.assign(1, 0u);
+    m_bbox.reset();
+    for (const Mesh *m : m_meshes) {
+        m_meshOffset.push_back(m_meshOffset.back() + m->getFaceCount());
+        m_bbox.expand(m->bbox());
+    }
+    for (const Particles *particles : m_particles)
+        m_bbox.expand(particles->bbox());
+    for (const ScalarBoundingBox3f &bbox : m_instanceBBoxes)
+        m_bbox.expand(bbox);
+}
+
+void Accel::removeInstance(const Instance *instance) {
+    std::lock_guard<std::mutex> lock(m_updateMutex);
+    if (m_built)
+        startEditing();
+
+    std::vector<const Instance *> &instances = m_editing ? m_sceneInstances : m_instances;
+    auto it = std::find(instances.begin(), instances.end(), instance);
+    if (it == instances.end())
+        throw Exception("Accel::removeInstance(): instance is not registered");
+
+    if (m_editing) {
+        instances.erase(it);
+        m_pendingEdits = true;
+        return;
+    }
+
+    m_instanceBBoxes.erase(m_instanceBBoxes.begin() + (it - instances.begin()));
+    instances.erase(it);
+    m_bbox.reset();
+    for (const Mesh *m : m_meshes)
+        m_bbox.expand(m->bbox());
+    for (const Particles *particles : m_particles)
+        m_bbox.expand(particles->bbox());
+    for (const ScalarBoundingBox3f &bbox : m_instanceBBoxes)
+        m_bbox.expand(bbox);
+}
+
+void Accel::startEditing() {
+    if (m_editing)
+        return;
+    m_sceneMeshes = m_meshes;
+    m_sceneInstances = m_instances;
+    m_editing = true;
+}
+
+void Accel::update() {
+    std::lock_guard<std::mutex> lock(m_updateMutex);
+    if (!m_pendingEdits)
+        return;
+    if (usesEmbree())
+        throw Exception("Accel::update(): incremental updates are not supported by the Embree backend");
+
+    Timer timer;
+    Accel *previous = m_snapshot.load();
+
+    /* Every mesh becomes an object of its own, placed with an identity transformation */
+    std::unordered_map<const Mesh *, std::shared_ptr<const Instance>> meshInstances;
+    std::unique_ptr<Accel> snapshot = createChild();
+    snapshot->m_cacheDir.clear();
+    for (Mesh *mesh : m_sceneMeshes) {
+        std::shared_ptr<const Instance> &instance = meshInstances[mesh];
+        auto it = m_meshInstances.find(mesh);
+        instance = it != m_meshInstances.end() ? it->second : std::make_shared<const Instance>(mesh, ScalarTransform4f());
+        snapshot->m_ownedInstances.push_back(instance);
+        snapshot->addInstance(instance.get());
+    }
+    for (const Instance *instance : m_sceneInstances)
+        snapshot->addInstance(instance);
+    for (const Particles *particles : m_particles)
+        snapshot->addParticles(particles);
+    m_meshInstances = std::move(meshInstances);
+
+    /* Bottom-level hierarchies of objects that are still present are reused */
+    const Accel *source = previous ? previous : this;
+    for (const Instance *instance : snapshot->m_instances) {
+        auto it = source->m_bottomLevel.find(instance->getMesh());
+        if (it != source->m_bottomLevel.end())
+            snapshot->m_bottomLevel.insert(*it);
+    }
+    snapshot->build();
+
+    /* Publish the new hierarchy and release the old one once no query uses it anymore */
+    m_snapshot.store(snapshot.release());
+    waitForReaders();
+    /* The hierarchy of the initial build stays valid, as queries that started
+       before the first publish did not announce themselves (see rayIntersect()) */
+    delete previous;
+    m_pendingEdits = false;
+
+    const Accel *current = getSnapshot();
+    m_bbox = current->m_bbox;
+    if (m_verbose)
+        std::cout << "Updated BVH (" << m_sceneMeshes.size()
+                  << (m_sceneMeshes.size() == 1 ? " mesh, " : " meshes, ")
+                  << m_sceneInstances.size() << " instances, took " << timer.elapsedString() << ", "
+                  << current->m_bottomLevel.size() << " bottom-level BVHs)." << std::endl;
+}
+
+std::unique_ptr<Accel> Accel::copy() const {
+    std::unique_ptr<Accel> accel = createChild();
+    accel->m_verbose = m_verbose;
+    accel->m_meshes = m_meshes;
+    accel->m_meshOffset = m_meshOffset;
+    accel->m_particles = m_particles;
+    accel->m_particleOffset = m_particleOffset;
+    accel->m_instances = m_instances;
+    accel->m_instanceBBoxes = m_instanceBBoxes;
+    accel->m_ownedInstances = m_ownedInstances;
+    accel->m_buildCost = m_buildCost;
+    accel->m_geometryRevision = m_geometryRevision;
+    accel->m_cacheKey = m_cacheKey;
+    accel->m_timeSteps = m_timeSteps;
+    accel->m_bbox = m_bbox;
+    accel->m_built = m_built;
+
+    /* Bottom-level hierarchies of moved meshes are copied as well, since a refit
+       modifies them. The others are shared, as the refit skips them. */
+    for (const auto &[mesh, bottomLevel] : m_bottomLevel) {
+        if (bottomLevel->m_geometryRevision != bottomLevel->getGeometryRevision())
+            accel->m_bottomLevel[mesh] = bottomLevel->copy();
+        else
+            accel->m_bottomLevel[mesh] = bottomLevel;
+    }
+    accel->m_instanceAccels.resize(m_instances.size());
+    for (size_t i = 0; i < m_instances.size(); ++i)
+        accel->m_instanceAccels[i] = accel->m_bottomLevel[m_instances[i]->getMesh()].get();
+
+    /* The traversal data may be memory-mapped, so it is copied from there */
+    if (m_nodeFormat == EQuantizedNodes) {
+        const QuantizedBVHNode *nodes = getNodes<QuantizedBVHNode>();
+        accel->m_quantizedNodes.assign(nodes, nodes + m_nodeCount);
+        accel->m_nodeData = accel->m_quantizedNodes.data();
+    } else {
+        const WideBVHNode *nodes = getNodes<WideBVHNode>();
+        accel->m_wideNodes.assign(nodes, nodes + m_nodeCount);
+        accel->m_nodeData = accel->m_wideNodes.data();
+    }
+    accel->m_indices.assign(m_indexData, m_indexData + m_indexCount);
+    accel->m_indexData = accel->m_indices.data();
+    accel->m_nodeCount = m_nodeCount;
+    accel->m_indexCount = m_indexCount;
+
+    accel->m_motionBounds = m_motionBounds;
+    accel->m_triangleData = m_triangleData;
+    accel->m_triangleIndices = m_triangleIndices;
+    accel->m_triangleStride = m_triangleStride;
+    accel->m_particleData = m_particleData;
+    accel->m_particleIndices = m_particleIndices;
+    return accel;
+}
+
+uint64_t Accel::getGeometryRevision() const {
+    uint64_t revision = 0;
+    for (const Mesh *mesh : m_meshes)
+        revision += mesh->getRevision();
+    return revision;
+}
+
+std::unique_ptr<Accel> Accel::createChild() const {
+    std::unique_ptr<Accel> accel(new Accel());
+    accel->m_nodeFormat = m_nodeFormat;
+    accel->m_refitThreshold = m_refitThreshold;
+    accel->m_spatialSplits = m_spatialSplits;
+    accel->m_spatialSplitBudget = m_spatialSplitBudget;
+    accel->m_builder = m_builder;
+    accel->m_lbvhSahLevels = m_lbvhSahLevels;
+    accel->m_reorderNodes = m_reorderNodes;
+    accel->m_cacheDir = m_cacheDir;
+    accel->m_verbose = false;
+    return accel;
+}
+
+void Accel::buildBottomLevel() {
+    m_instanceAccels.resize(m_instances.size());
+
+    /* Register the hierarchies of all newly referenced meshes first, so
+       that the concurrent builds below do not modify the map */
+    std::vector<Accel *> builds;
+    for (size_t i = 0; i < m_instances.size(); ++i) {
+        const Mesh *mesh = m_instances[i]->getMesh();
+        std::shared_ptr<Accel> &accel = m_bottomLevel[mesh];
+        if (!accel) {
+            accel = createChild();
+            accel->addMesh(const_cast<Mesh *>(mesh));
+            builds.push_back(accel.get());
+        }
+        m_instanceAccels[i] = accel.get();
+    }
+
+    /* Start with the largest meshes, whose builds take the longest */
+    std::sort(builds.begin(), builds.end(), [](const Accel *a, const Accel *b) {
+        return a->getPrimitiveCount() > b->getPrimitiveCount();
+    });
+    auto small = std::find_if(builds.begin(), builds.end(), [](const Accel *accel) {
+        return accel->getPrimitiveCount() < KAZEN_BVH_SERIAL_THRESHOLD;
+    });
 
+    /* Large meshes are built by a task each, which itself builds in parallel.
+       Small meshes are built serially, but many of them at once. All tasks
+       share the same worker threads, so that threads that are done with the
+       small meshes help with the large ones and vice versa. */
+    tbb::task_group group;
+    for (auto it = builds.begin(); it != small; ++it) {
+        Accel *accel = *it;
+        group.run([accel] { accel->build(); });
+    }
+    if (small != builds.end()) {
+        group.run([&builds, small] {
+            size_t first = (size_t) (small - builds.begin());
+            tbb::parallel_for(tbb::blocked_range<size_t>(first, builds.size()),
+                [&](const tbb::blocked_range<size_t> &range) {
+                    for (size_t i = range.begin(); i != range.end(); ++i)
+                        builds[i]->build();
+                }
+            );
+        });
+    }
+    group.wait();
 }
 
 void Accel::build() {
-    /* Nothing to do here for now */
+    m_built = true;
+    m_geometryRevision = getGeometryRevision();
+    if (getPrimitiveCount() == 0)
+        return;
+
+    /* Moving meshes have to agree on their key frames, static meshes are held in place */
+    m_timeSteps = 1;
+    for (const Mesh *mesh : m_meshes) {
+        ScalarSize timeSteps = mesh->getTimeStepCount();
+        if (timeSteps == 1)
+            continue;
+        if (m_timeSteps != 1 && timeSteps != m_timeSteps)
+            throw Exception("Accel: all moving meshes must have the same number of time steps (got {} and {})",
+                            m_timeSteps, timeSteps);
+        m_timeSteps = timeSteps;
+    }
+
+#if defined(KAZEN_USE_EMBREE)
+    if (m_embree) {
+        if (!m_particles.empty())
+            throw Exception("Accel: particles are not supported by the Embree backend");
+        Timer timer;
+        m_embree->build(m_meshes, m_meshOffset, m_instances);
+        if (m_verbose)
+            std::cout << "Constructed Embree scene (" << m_meshes.size()
+                      << (m_meshes.size() == 1 ? " mesh, " : " meshes, ")
+                      << getTriangleCount() << " triangles, " << m_instances.size()
+                      << " instances, took " << timer.elapsedString() << ")." << std::endl;
+        return;
+    }
+#endif
+
+    if (m_timeSteps > 1 && m_nodeFormat == EQuantizedNodes)
+        throw Exception("Accel: moving meshes are not supported by the quantized node format");
+    if (m_timeSteps > 1 && m_spatialSplits)
+        throw Exception("Accel: moving meshes are not supported by spatial-split builds");
+
+    /* The instances are leaves of this hierarchy and need their own hierarchies first */
+    buildBottomLevel();
+
+    if (m_cacheDir.empty()) {
+        buildHierarchy();
+        return;
+    }
+
+    Timer timer;
+    m_cacheKey = cacheKey();
+    std::string filename = fmt::format("{}/{:016x}.bvh", m_cacheDir, m_cacheKey);
+
+    if (loadCache(filename, m_cacheKey)) {
+        if (m_verbose)
+            std::cout << "Loaded BVH from cache \"" << filename << "\" (took " << timer.elapsedString()
+                      << ", " << getNodeCount() << (m_nodeFormat == EQuantizedNodes ? " quantized" : " wide")
+                      << " nodes, " << util::memString(getMemoryUsage()) << ")." << std::endl;
+        return;
+    }
+
+    buildHierarchy();
+    writeCache(filename, m_cacheKey);
+}
+
+void Accel::buildHierarchy() {
+    ScalarSize size = getPrimitiveCount();
+
+    if (m_verbose) {
+        std::cout << "Constructing a " << (m_builder == ELinearBuilder ? "linear" : m_spatialSplits ? "spatial-split" : "SAH")
+                  << " BVH (" << m_meshes.size()
+                  << (m_meshes.size() == 1 ? " mesh, " : " meshes, ")
+                  << getTriangleCount() << " triangles";
+        if (!m_particles.empty())
+            std::cout << ", " << getParticleCount() << " particles";
+        if (!m_instances.empty())
+            std::cout << ", " << m_instances.size() << " instances";
+        std::cout << ") .. " << std::flush;
+    }
+    Timer timer;
+
+    /* Precompute primitive bounds and centroids */
+    std::vector<ScalarBoundingBox3f> bboxes(size);
+    std::vector<ScalarPoint3f> centroids(size);
+    m_indices.resize(size);
+
+    tbb::parallel_for(tbb::blocked_range<ScalarIndex>(0u, size, KAZEN_BVH_SERIAL_THRESHOLD),
+        [&](const tbb::blocked_range<ScalarIndex> &range) {
+            for (ScalarIndex i = range.begin(); i != range.end(); ++i) {
+                m_indices[i] = i;
+                bboxes[i] = getBoundingBox(i);
+                centroids[i] = bboxes[i].center();
+            }
+        }
+    );
+
+    if (m_spatialSplits) {
+        /* Build the hierarchy over a reference array with room for duplicates (see \ref SBVHBuildTask) */
+        ScalarSize budget = size + (ScalarSize) (size * m_spatialSplitBudget);
+        std::vector<SBVHBuildTask::Reference> refs(budget);
+        for (ScalarIndex i = 0; i < size; ++i)
+            refs[i] = { i, bboxes[i] };
+        std::vector<ScalarPoint3f>().swap(centroids);
+
+        m_indices.resize(budget);
+        m_nodes.resize(2 * budget);
+        SBVHBuildTask(*this, refs, KAZEN_SBVH_ALPHA * m_bbox.surfaceArea())(0u, 0u, size, budget, 0u);
+    } else if (m_builder == ELinearBuilder) {
+        /* Sort the primitives by Morton code and split along the code bits (see \ref LBVHBuildTask) */
+        m_nodes.resize(2 * size);
+        LBVHBuildTask task(*this, bboxes, centroids, m_lbvhSahLevels);
+        task(0u, 0u, size, 0u);
+    } else {
+        /* Build the hierarchy into a sparse node array (see \ref BVHBuildTask) */
+        m_nodes.resize(2 * size);
+        BVHBuildTask(*this, bboxes, centroids)(0u, 0u, size, 0u);
+    }
+
+    /* Remove unused entries, keeping left children adjacent to their parents.
+       Leaves are visited in order, which also removes unused index slots. */
+    std::vector<BVHNode> compactified;
+    std::vector<ScalarIndex> indices;
+    compactified.reserve(m_nodes.size());
+    indices.reserve(m_indices.size());
+    std::vector<std::pair<ScalarIndex, ScalarIndex>> stack;
+    stack.emplace_back(0u, (ScalarIndex) -1);
+
+    while (!stack.empty()) {
+        auto [nodeIdx, parentIdx] = stack.back();
+        stack.pop_back();
+
+        ScalarIndex newIdx = (ScalarIndex) compactified.size();
+        compactified.push_back(m_nodes[nodeIdx]);
+        if (parentIdx != (ScalarIndex) -1)
+            compactified[parentIdx].inner.rightChild = newIdx;
+
+        const BVHNode &node = m_nodes[nodeIdx];
+        if (node.isInner()) {
+            stack.emplace_back(node.inner.rightChild, newIdx);
+            stack.emplace_back(nodeIdx + 1, (ScalarIndex) -1);
+        } else {
+            compactified[newIdx].leaf.start = (uint32_t) indices.size();
+            indices.insert(indices.end(), m_indices.begin() + node.start(), m_indices.begin() + node.end());
+        }
+    }
+    m_nodes = std::move(compactified);
+    m_indices = std::move(indices);
+    m_bbox = m_nodes[0].bbox;
+
+    ScalarSize leafCount = 0;
+    ScalarFloat binaryCost = statistics(0u, leafCount);
+
+    /* Collapse into wide nodes for traversal, the binary nodes are no longer needed */
+    m_wideNodes.clear();
+    m_wideNodes.reserve(m_nodes.size() / (KAZEN_BVH_WIDTH / 2) + 1);
+    collapse(0u);
+    std::vector<BVHNode>().swap(m_nodes);
+
+    if (m_nodeFormat == EQuantizedNodes) {
+        /* Quantized nodes are stored breadth-first, which fixes their order */
+        quantize();
+        std::vector<WideBVHNode>().swap(m_wideNodes);
+    } else if (m_reorderNodes) {
+        reorderNodes();
+    }
+    updateTraversalData();
+    m_buildCost = sahCost();
+
+    if (!m_verbose)
+        return;
+
+    size_t bottomLevelMemory = 0;
+    for (const auto &[mesh, accel] : m_bottomLevel)
+        bottomLevelMemory += accel->getMemoryUsage();
+
+    std::cout << "done (took " << timer.elapsedString() << ", "
+              << getNodeCount() << (m_nodeFormat == EQuantizedNodes ? " quantized" : " wide")
+              << " nodes, " << leafCount << " leaves, "
+              << util::memString(getMemoryUsage());
+    if (m_spatialSplits)
+        std::cout << ", " << m_indexCount - size << " duplicated references";
+    if (!m_bottomLevel.empty())
+        std::cout << ", " << m_bottomLevel.size() << " bottom-level BVHs using "
+                  << util::memString(bottomLevelMemory);
+    std::cout << ", SAH cost = " << binaryCost << ")." << std::endl;
+}
+
+void Accel::updateTraversalData() {
+    if (m_nodeFormat == EQuantizedNodes) {
+        m_nodeData = m_quantizedNodes.data();
+        m_nodeCount = (ScalarSize) m_quantizedNodes.size();
+    } else {
+        m_nodeData = m_wideNodes.data();
+        m_nodeCount = (ScalarSize) m_wideNodes.size();
+    }
+    m_indexData = m_indices.data();
+    m_indexCount = (ScalarSize) m_indices.size();
+
+    /* A previously loaded cache file is no longer referenced */
+    m_cacheFile.reset();
+
+    updateTriangleData();
+    updateParticleData();
+    updateMotionBounds();
+}
+
+void Accel::updateTriangleData() {
+    /* Pad every array, so that KAZEN_BVH_WIDTH slots can be loaded starting at any slot */
+    m_triangleStride = m_indexCount + KAZEN_BVH_WIDTH;
+    m_triangleData.assign((size_t) 9 * m_timeSteps * m_triangleStride, 0.f);
+    m_triangleIndices.assign(m_triangleStride, NoTriangle);
+
+    tbb::parallel_for(tbb::blocked_range<ScalarIndex>(0u, m_indexCount, KAZEN_BVH_SERIAL_THRESHOLD),
+        [&](const tbb::blocked_range<ScalarIndex> &range) {
+            for (ScalarIndex slot = range.begin(); slot != range.end(); ++slot) {
+                ScalarIndex idx = m_indexData[slot];
+                if (idx >= getTriangleCount())
+                    continue;
+                m_triangleIndices[slot] = idx;
+
+                /* Static triangles are repeated at every key frame */
+                const Mesh *mesh = m_meshes[findMesh(idx)];
+                auto fi = mesh->getFaceIndices(idx);
+                for (uint32_t step = 0; step < m_timeSteps; ++step) {
+                    ScalarSize meshStep = mesh->getTimeStepCount() > 1 ? step : 0u;
+                    for (uint32_t k = 0; k < 3; ++k) {
+                        ScalarPoint3f p = mesh->getVertexPosition(fi[k], meshStep);
+                        for (uint32_t axis = 0; axis < 3; ++axis)
+                            m_triangleData[(size_t) (step * 9 + k * 3 + axis) * m_triangleStride + slot] = p[axis];
+                    }
+                }
+            }
+        }
+    );
+}
+
+void Accel::updateParticleData() {
+    if (m_particles.empty())
+        return;
+
+    /* Same padded layout as the triangle records (see \ref updateTriangleData()) */
+    m_particleData.assign((size_t) 4 * m_triangleStride, 0.f);
+    m_particleIndices.assign(m_triangleStride, NoParticle);
+
+    tbb::parallel_for(tbb::blocked_range<ScalarIndex>(0u, m_indexCount, KAZEN_BVH_SERIAL_THRESHOLD),
+        [&](const tbb::blocked_range<ScalarIndex> &range) {
+            for (ScalarIndex slot = range.begin(); slot != range.end(); ++slot) {
+                ScalarIndex idx = m_indexData[slot];
+                if (idx < getTriangleCount() || idx >= getInstanceBase())
+                    continue;
+                m_particleIndices[slot] = idx;
+
+                const Particles *particles = m_particles[findParticles(idx)];
+                ScalarPoint3f center = particles->getCenter(idx);
+                ScalarFloat radius = particles->getRadius(idx);
+                for (uint32_t axis = 0; axis < 3; ++axis)
+                    m_particleData[(size_t) axis * m_triangleStride + slot] = center[axis];
+                m_particleData[(size_t) 3 * m_triangleStride + slot] =
+                    particles->getShape() == Particles::EDisk ? -radius : radius;
+            }
+        }
+    );
+}
+
+uint64_t Accel::cacheKey() const {
+    /* Build settings that affect the cached data */
+    uint32_t settings[] = {
+        KAZEN_BVH_CACHE_VERSION, KAZEN_BVH_WIDTH, (uint32_t) m_nodeFormat,
+        (uint32_t) m_spatialSplits, memcpy_cast<uint32_t>(m_spatialSplitBudget),
+        (uint32_t) m_builder, m_lbvhSahLevels, (uint32_t) m_reorderNodes
+    };
+    uint64_t key = util::hash(settings, sizeof(settings));
+
+    /* Large buffers are hashed in chunks, in parallel */
+    auto hashBuffer = [&key](const void *data, size_t size) {
+        size_t chunkCount = (size + KAZEN_BVH_CACHE_CHUNK_SIZE - 1) / KAZEN_BVH_CACHE_CHUNK_SIZE;
+        std::vector<uint64_t> chunks(chunkCount);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, chunkCount),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i != range.end(); ++i) {
+                    size_t offset = i * KAZEN_BVH_CACHE_CHUNK_SIZE;
+                    chunks[i] = util::hash((const uint8_t *) data + offset,
+                                           std::min((size_t) KAZEN_BVH_CACHE_CHUNK_SIZE, size - offset));
+                }
+            }
+        );
+        key = util::hash(chunks.data(), chunks.size() * sizeof(uint64_t), key);
+    };
+
+    for (const Mesh *mesh : m_meshes) {
+        for (ScalarSize step = 0; step < mesh->getTimeStepCount(); ++step) {
+            const Mesh::FloatStorage &positions = mesh->getVertexPositions(step);
+            hashBuffer(positions.data(), slices(positions) * sizeof(Mesh::InputFloat));
+        }
+        const DynamicBuffer<UInt32> &indices = mesh->getIndices();
+        hashBuffer(indices.data(), slices(indices) * sizeof(uint32_t));
+    }
+
+    for (const Particles *particles : m_particles) {
+        const Particles::FloatStorage &centers = particles->getCenters(),
+                                      &radii = particles->getRadii();
+        hashBuffer(centers.data(), slices(centers) * sizeof(Particles::InputFloat));
+        hashBuffer(radii.data(), slices(radii) * sizeof(Particles::InputFloat));
+        ScalarFloat radius = particles->getRadius(0);
+        key = util::hash(&radius, sizeof(radius), key);
+    }
+
+    /* Instances are identified by their transformation and the key of their bottom-level hierarchy */
+    for (size_t i = 0; i < m_instances.size(); ++i) {
+        const auto &matrix = m_instances[i]->getToWorld().matrix;
+        key = util::hash(&matrix, sizeof(matrix), key);
+        key = util::hash(&m_instanceAccels[i]->m_cacheKey, sizeof(uint64_t), key);
+    }
+
+    return key;
+}
+
+bool Accel::loadCache(const std::string &filename, uint64_t key) {
+    /* The mapping is copy-on-write, so that the hierarchy can still be refit */
+    std::unique_ptr<MemoryMappedFile> file;
+    try {
+        file.reset(new MemoryMappedFile(filename, true));
+    } catch (const std::exception &) {
+        return false;
+    }
+
+    if (file->size() < sizeof(BVHCacheHeader))
+        return false;
+
+    const BVHCacheHeader &header = *(const BVHCacheHeader *) file->data();
+    size_t nodeSize = m_nodeFormat == EQuantizedNodes ? sizeof(QuantizedBVHNode) : sizeof(WideBVHNode);
+
+    bool valid = memcmp(header.magic, "KBVH", 4) == 0 &&
+        header.version == KAZEN_BVH_CACHE_VERSION &&
+        header.key == key &&
+        header.width == KAZEN_BVH_WIDTH &&
+        header.nodeFormat == (uint32_t) m_nodeFormat &&
+        header.nodeSize == nodeSize &&
+        header.nodeCount > 0 &&
+        header.nodeOffset % KAZEN_BVH_CACHE_ALIGNMENT == 0 &&
+        header.indexOffset % KAZEN_BVH_CACHE_ALIGNMENT == 0 &&
+        header.nodeOffset + (uint64_t) header.nodeCount * nodeSize <= file->size() &&
+        header.indexOffset + (uint64_t) header.indexCount * sizeof(ScalarIndex) <= file->size();
+
+    /* Spatial splits duplicate references, otherwise every primitive is referenced once */
+    ScalarSize primCount = getPrimitiveCount();
+    valid = valid && (m_spatialSplits ? header.indexCount >= primCount : header.indexCount == primCount);
+
+    /* A corrupt cache must not send the traversal outside of the mapped arrays */
+    if (valid) {
+        const uint8_t *data = (const uint8_t *) file->data();
+        const ScalarIndex *indices = (const ScalarIndex *) (data + header.indexOffset);
+        if (m_nodeFormat == EQuantizedNodes)
+            valid = validCacheData((const QuantizedBVHNode *) (data + header.nodeOffset), header.nodeCount,
+                                   indices, header.indexCount, primCount);
+        else
+            valid = validCacheData((const WideBVHNode *) (data + header.nodeOffset), header.nodeCount,
+                                   indices, header.indexCount, primCount);
+    }
+
+    if (!valid) {
+        std::cerr << "Ignoring invalid or outdated BVH cache file \"" << filename << "\"" << std::endl;
+        return false;
+    }
+
+    uint8_t *data = (uint8_t *) file->data();
+    m_nodeData = data + header.nodeOffset;
+    m_nodeCount = header.nodeCount;
+    m_indexData = (ScalarIndex *) (data + header.indexOffset);
+    m_indexCount = header.indexCount;
+    m_bbox = ScalarBoundingBox3f(ScalarPoint3f(header.bboxMin[0], header.bboxMin[1], header.bboxMin[2]),
+                                 ScalarPoint3f(header.bboxMax[0], header.bboxMax[1], header.bboxMax[2]));
+    m_buildCost = header.buildCost;
+
+    std::vector<WideBVHNode>().swap(m_wideNodes);
+    std::vector<QuantizedBVHNode>().swap(m_quantizedNodes);
+    std::vector<ScalarIndex>().swap(m_indices);
+    m_cacheFile = std::move(file);
+
+    /* Triangle records and key frame bounds depend on the vertex positions and are not cached */
+    updateTriangleData();
+    updateParticleData();
+    updateMotionBounds();
+    return true;
+}
+
+void Accel::writeCache(const std::string &filename, uint64_t key) const {
+    size_t nodeSize = m_nodeFormat == EQuantizedNodes ? sizeof(QuantizedBVHNode) : sizeof(WideBVHNode);
+
+    BVHCacheHeader header;
+    memset(&header, 0, sizeof(BVHCacheHeader));
+    memcpy(header.magic, "KBVH", 4);
+    header.version = KAZEN_BVH_CACHE_VERSION;
+    header.key = key;
+    header.width = KAZEN_BVH_WIDTH;
+    header.nodeFormat = (uint32_t) m_nodeFormat;
+    header.nodeSize = (uint32_t) nodeSize;
+    header.nodeCount = m_nodeCount;
+    header.indexCount = m_indexCount;
+    for (int i = 0; i < 3; ++i) {
+        header.bboxMin[i] = m_bbox.min[i];
+        header.bboxMax[i] = m_bbox.max[i];
+    }
+    header.buildCost = m_buildCost;
+    header.nodeOffset = alignCacheOffset(sizeof(BVHCacheHeader));
+    header.indexOffset = alignCacheOffset(header.nodeOffset + (uint64_t) m_nodeCount * nodeSize);
+
+    /* Write to a temporary file that is renamed at the end, so that
+       concurrent jobs never observe a partially written cache file */
+    std::string tempName = fmt::format("{}.{:08x}.tmp", filename, std::random_device()());
+    std::ofstream os(tempName, std::ios::binary);
+    if (!os) {
+        std::cerr << "Could not create BVH cache file \"" << tempName << "\"" << std::endl;
+        return;
+    }
+
+    const char padding[KAZEN_BVH_CACHE_ALIGNMENT] = { };
+    os.write((const char *) &header, sizeof(BVHCacheHeader));
+    os.write(padding, header.nodeOffset - sizeof(BVHCacheHeader));
+    os.write((const char *) m_nodeData, (std::streamsize) (m_nodeCount * nodeSize));
+    os.write(padding, header.indexOffset - header.nodeOffset - m_nodeCount * nodeSize);
+    os.write((const char *) m_indexData, (std::streamsize) (m_indexCount * sizeof(ScalarIndex)));
+    os.close();
+
+    if (!os || std::rename(tempName.c_str(), filename.c_str()) != 0) {
+        std::cerr << "Could not write BVH cache file \"" << filename << "\"" << std::endl;
+        std::remove(tempName.c_str());
+    }
+}
+
+Accel::ScalarIndex Accel::collapse(ScalarIndex nodeIdx) {
+    ScalarIndex children[KAZEN_BVH_WIDTH];
+    ScalarSize childCount = 0;
+
+    if (m_nodes[nodeIdx].isLeaf()) {
+        /* Only happens for a root that is a leaf */
+        children[childCount++] = nodeIdx;
+    } else {
+        children[childCount++] = nodeIdx + 1;
+        children[childCount++] = m_nodes[nodeIdx].inner.rightChild;
+
+        /* Repeatedly open the inner child with the largest surface area */
+        while (childCount < KAZEN_BVH_WIDTH) {
+            int best = -1;
+            ScalarFloat bestArea = -1.f;
+            for (ScalarSize i = 0; i < childCount; ++i) {
+                const BVHNode &child = m_nodes[children[i]];
+                if (child.isInner() && child.bbox.surfaceArea() > bestArea) {
+                    best = (int) i;
+                    bestArea = child.bbox.surfaceArea();
+                }
+            }
+            if (best == -1)
+                break;
+
+            ScalarIndex idx = children[best];
+            children[best] = idx + 1;
+            children[childCount++] = m_nodes[idx].inner.rightChild;
+        }
+    }
+
+    ScalarIndex wideIdx = (ScalarIndex) m_wideNodes.size();
+    m_wideNodes.emplace_back();
+
+    for (ScalarSize i = 0; i < childCount; ++i) {
+        const BVHNode &child = m_nodes[children[i]];
+        uint32_t target, count;
+
+        if (child.isLeaf()) {
+            target = child.leaf.start;
+            count = child.leaf.size;
+        } else {
+            target = collapse(children[i]);
+            count = 0;
+        }
+
+        /* Note: 'collapse' may reallocate m_wideNodes */
+        WideBVHNode &node = m_wideNodes[wideIdx];
+        node.minX[i] = child.bbox.min.x(); node.maxX[i] = child.bbox.max.x();
+        node.minY[i] = child.bbox.min.y(); node.maxY[i] = child.bbox.max.y();
+        node.minZ[i] = child.bbox.min.z(); node.maxZ[i] = child.bbox.max.z();
+        node.child[i] = target;
+        node.count[i] = count;
+    }
+
+    return wideIdx;
+}
+
+void Accel::reorderNodes() {
+    /// Wide node that is about to be emitted, and the child slot that references it
+    struct StackItem {
+        ScalarIndex nodeIdx;
+        ScalarIndex parentIdx;
+        uint32_t slot;
+    };
+
+    std::vector<WideBVHNode> nodes;
+    std::vector<ScalarIndex> indices;
+    nodes.reserve(m_wideNodes.size());
+    indices.reserve(m_indices.size());
+
+    std::vector<StackItem> stack;
+    stack.push_back({ 0u, (ScalarIndex) -1, 0u });
+
+    while (!stack.empty()) {
+        StackItem item = stack.back();
+        stack.pop_back();
+
+        ScalarIndex newIdx = (ScalarIndex) nodes.size();
+        nodes.push_back(m_wideNodes[item.nodeIdx]);
+        if (item.parentIdx != (ScalarIndex) -1)
+            nodes[item.parentIdx].child[item.slot] = newIdx;
+
+        WideBVHNode &node = nodes.back();
+        std::pair<ScalarFloat, uint32_t> inner[KAZEN_BVH_WIDTH];
+        uint32_t innerCount = 0;
+
+        for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+            ScalarBoundingBox3f bbox;
+            if (!node.getChildBounds(i, bbox))
+                continue;
+
+            if (node.count[i] == 0) {
+                inner[innerCount++] = { bbox.surfaceArea(), i };
+            } else {
+                /* Move the primitives of the leaf next to those of its siblings */
+                ScalarIndex start = node.child[i];
+                node.child[i] = (ScalarIndex) indices.size();
+                indices.insert(indices.end(), m_indices.begin() + start, m_indices.begin() + start + node.count[i]);
+            }
+        }
+
+        /* Push the largest child last, so that it is emitted right after this node */
+        std::sort(inner, inner + innerCount);
+        for (uint32_t i = 0; i < innerCount; ++i)
+            stack.push_back({ node.child[inner[i].second], newIdx, inner[i].second });
+    }
+
+    m_wideNodes = std::move(nodes);
+    m_indices = std::move(indices);
+}
+
+void Accel::quantize() {
+    /// Child reference of a quantized node that is about to be emitted
+    struct Child {
+        enum EType { EWide, ELeaf, ESplitLeaf };
+        EType type;
+        ScalarBoundingBox3f bbox;
+        uint32_t target;    ///< Wide node index or first primitive
+        uint32_t count;     ///< Number of primitives (leaves only)
+    };
+
+    /* Return the children of a wide node */
+    auto wideChildren = [&](uint32_t wideIdx) {
+        const WideBVHNode &node = m_wideNodes[wideIdx];
+        std::vector<Child> children;
+        for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+            if (node.count[i] == WideBVHNode::EmptySlot)
+                continue;
+            ScalarBoundingBox3f bbox(
+                ScalarPoint3f(node.minX[i], node.minY[i], node.minZ[i]),
+                ScalarPoint3f(node.maxX[i], node.maxY[i], node.maxZ[i]));
+            uint32_t count = node.count[i];
+            if (count == 0)
+                children.push_back({ Child::EWide, bbox, node.child[i], 0u });
+            else
+                children.push_back({ count > QuantizedBVHNode::MaxLeafSize ? Child::ESplitLeaf : Child::ELeaf,
+                                     bbox, node.child[i], count });
+        }
+        return children;
+    };
+
+    /* Leaves that are too large for an 8-bit count are split into several
+       leaves below an extra node. Each part conservatively reuses the
+       bounds of the original leaf. */
+    auto splitLeaf = [](const Child &leaf) {
+        std::vector<Child> children;
+        uint32_t partSize = (leaf.count + KAZEN_BVH_WIDTH - 1) / KAZEN_BVH_WIDTH;
+        for (uint32_t start = 0; start < leaf.count; start += partSize) {
+            uint32_t count = std::min(partSize, leaf.count - start);
+            children.push_back({ count > QuantizedBVHNode::MaxLeafSize ? Child::ESplitLeaf : Child::ELeaf,
+                                 leaf.bbox, leaf.target + start, count });
+        }
+        return children;
+    };
+
+    std::vector<QuantizedBVHNode> nodes;
+    std::vector<ScalarIndex> indices;
+    nodes.reserve(m_wideNodes.size());
+    indices.reserve(m_indices.size());
+
+    /* Emit nodes in breadth-first order, so that the inner children
+       of every node are stored consecutively */
+    std::deque<std::pair<uint32_t, std::vector<Child>>> queue;
+    nodes.emplace_back();
+    queue.emplace_back(0u, wideChildren(0u));
+
+    while (!queue.empty()) {
+        auto [nodeIdx, children] = std::move(queue.front());
+        queue.pop_front();
+
+        QuantizedBVHNode node;
+        memset(&node, 0, sizeof(QuantizedBVHNode));
+        for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i)
+            node.count[i] = QuantizedBVHNode::EmptySlot;
+
+        node.childBase = (uint32_t) nodes.size();
+        node.primBase = (uint32_t) indices.size();
+
+        ScalarBoundingBox3f bounds[KAZEN_BVH_WIDTH];
+        for (uint32_t i = 0; i < (uint32_t) children.size(); ++i) {
+            const Child &child = children[i];
+            bounds[i] = child.bbox;
+
+            if (child.type == Child::ELeaf) {
+                node.count[i] = (uint8_t) child.count;
+                for (uint32_t j = 0; j < child.count; ++j)
+                    indices.push_back(m_indices[child.target + j]);
+            } else {
+                node.count[i] = QuantizedBVHNode::InnerChild;
+                uint32_t childIdx = (uint32_t) nodes.size();
+                nodes.emplace_back();
+                queue.emplace_back(childIdx, child.type == Child::EWide
+                    ? wideChildren(child.target) : splitLeaf(child));
+            }
+        }
+
+        node.setChildBounds(bounds);
+        nodes[nodeIdx] = node;
+    }
+
+    m_quantizedNodes = std::move(nodes);
+    m_indices = std::move(indices);
+}
+
+void Accel::QuantizedBVHNode::setChildBounds(const ScalarBoundingBox3f *bounds) {
+    /* Set up the quantization grid */
+    ScalarBoundingBox3f bbox;
+    for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+        if (!isEmpty(i))
+            bbox.expand(bounds[i]);
+    }
+
+    for (int axis = 0; axis < 3; ++axis) {
+        origin[axis] = bbox.min[axis];
+        ScalarFloat extent = bbox.max[axis] - bbox.min[axis];
+
+        int exp = -126;
+        if (extent > 0.f) {
+            std::frexp(extent / 255.f, &exp);
+            exp = std::max(exp, -126);
+        }
+        exponent[axis] = (int8_t) exp;
+
+        /* Guard against rounding in 'origin + 255 * scale' */
+        while (exponent[axis] < 127 && origin[axis] + 255.f * scale(axis) < bbox.max[axis])
+            exponent[axis]++;
+    }
+
+    /* Quantize the child bounds, rounding outward */
+    for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+        if (isEmpty(i))
+            continue;
+        for (int axis = 0; axis < 3; ++axis) {
+            float s = scale(axis), o = origin[axis];
+            int lo = (int) std::floor((bounds[i].min[axis] - o) / s),
+                hi = (int) std::ceil((bounds[i].max[axis] - o) / s);
+            lo = std::clamp(lo, 0, 255);
+            hi = std::clamp(hi, 0, 255);
+            while (lo > 0 && o + lo * s > bounds[i].min[axis])
+                lo--;
+            while (hi < 255 && o + hi * s < bounds[i].max[axis])
+                hi++;
+            qmin[axis][i] = (uint8_t) lo;
+            qmax[axis][i] = (uint8_t) hi;
+        }
+    }
 }
 
-bool Accel::rayIntersect(const Ray3f &ray_, Intersection &its, bool shadowRay) const {
-    bool foundIntersection = false;  // Was an intersection found so far?
+bool Accel::refit() {
+#if defined(KAZEN_USE_EMBREE)
+    if (m_embree) {
+        m_embree->update();
+        m_bbox.reset();
+        for (const Mesh *mesh : m_meshes)
+            m_bbox.expand(mesh->bbox());
+        for (size_t i = 0; i < m_instances.size(); ++i) {
+            m_instanceBBoxes[i] = m_instances[i]->getBoundingBox();
+            m_bbox.expand(m_instanceBBoxes[i]);
+        }
+        return true;
+    }
+#endif
+
+    /* After incremental updates, all geometry lives in the published hierarchy.
+       Queries may be running inside of it, so a copy is refit and published. */
+    if (getSnapshot()) {
+        std::lock_guard<std::mutex> lock(m_updateMutex);
+        Accel *previous = m_snapshot.load();
+        std::unique_ptr<Accel> snapshot = previous->copy();
+        bool refit = snapshot->refit();
+        m_bbox = snapshot->m_bbox;
+
+        m_snapshot.store(snapshot.release());
+        waitForReaders();
+        delete previous;
+        return refit;
+    }
+
+    m_geometryRevision = getGeometryRevision();
+    if (getNodeCount() == 0)
+        return true;
+
+    Timer timer;
+
+    /* Refit the bottom-level hierarchies of moved meshes first, as they determine the bounds of the instances */
+    std::vector<Accel *> bottomLevel;
+    for (auto &[mesh, accel] : m_bottomLevel)
+        if (accel->m_geometryRevision != accel->getGeometryRevision())
+            bottomLevel.push_back(accel.get());
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, bottomLevel.size(), 1),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i != range.end(); ++i)
+                bottomLevel[i]->refit();
+        }
+    );
 
-    /* Do intersection test here */
+    for (size_t i = 0; i < m_instances.size(); ++i)
+        m_instanceBBoxes[i] = m_instances[i]->getBoundingBox(m_instanceAccels[i]->getBoundingBox());
+
+    m_bbox = m_nodeFormat == EQuantizedNodes
+        ? refit(getNodes<QuantizedBVHNode>(), 0u, 0u)
+        : refit(getNodes<WideBVHNode>(), 0u, 0u);
+
+    ScalarFloat cost = sahCost();
+    if (cost > m_refitThreshold * m_buildCost) {
+        if (m_verbose)
+            std::cout << "BVH refit increased the SAH cost from " << m_buildCost << " to " << cost
+                      << ", rebuilding." << std::endl;
+        buildHierarchy();
+        return false;
+    }
+
+    /* The topology is unchanged, but the triangle records and key
+       frame bounds still hold the old vertex positions */
+    updateTriangleData();
+    updateParticleData();
+    updateMotionBounds();
+
+    if (m_verbose)
+        std::cout << "Refit BVH (took " << timer.elapsedString() << ", SAH cost = " << cost
+                  << ", " << cost / m_buildCost << "x that of the last build)." << std::endl;
+    return true;
+}
+
+template <typename Node>
+Accel::ScalarBoundingBox3f Accel::refit(Node *nodes, ScalarIndex nodeIdx, uint32_t depth) {
+    Node &node = nodes[nodeIdx];
+    ScalarBoundingBox3f bounds[KAZEN_BVH_WIDTH];
+
+    auto refitChild = [&](uint32_t i) {
+        if (node.isEmpty(i))
+            return;
+
+        uint32_t target, count;
+        node.getChild(i, target, count);
+        if (count == 0) {
+            bounds[i] = refit(nodes, target, depth + 1);
+        } else {
+            for (ScalarIndex j = target; j < target + count; ++j)
+                bounds[i].expand(getBoundingBox(m_indexData[j]));
+        }
+    };
+
+    /* Children are stored after their parents, hence distinct
+       subtrees never touch the same node */
+    if (depth < KAZEN_BVH_REFIT_PARALLEL_DEPTH) {
+        tbb::parallel_for((uint32_t) 0, (uint32_t) KAZEN_BVH_WIDTH, refitChild);
+    } else {
+        for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i)
+            refitChild(i);
+    }
+
+    node.setChildBounds(bounds);
+
+    ScalarBoundingBox3f bbox;
+    for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+        if (!node.isEmpty(i))
+            bbox.expand(bounds[i]);
+    }
+    return bbox;
+}
+
+void Accel::updateMotionBounds() {
+    if (m_timeSteps == 1 || getNodeCount() == 0) {
+        std::vector<MotionBounds>().swap(m_motionBounds);
+        return;
+    }
+
+    m_motionBounds.resize((size_t) m_nodeCount * m_timeSteps);
+    std::vector<ScalarBoundingBox3f> bounds(m_timeSteps);
+    updateMotionBounds(0u, 0u, bounds.data());
+}
+
+void Accel::updateMotionBounds(ScalarIndex nodeIdx, uint32_t depth, ScalarBoundingBox3f *result) {
+    const WideBVHNode &node = getNodes<WideBVHNode>()[nodeIdx];
+
+    /* Bounds of every child at every key frame, child-major */
+    std::vector<ScalarBoundingBox3f> bounds((size_t) KAZEN_BVH_WIDTH * m_timeSteps);
+
+    auto updateChild = [&](uint32_t i) {
+        if (node.isEmpty(i))
+            return;
+
+        uint32_t target, count;
+        node.getChild(i, target, count);
+        ScalarBoundingBox3f *childBounds = bounds.data() + (size_t) i * m_timeSteps;
+        if (count == 0) {
+            updateMotionBounds(target, depth + 1, childBounds);
+        } else {
+            for (ScalarIndex j = target; j < target + count; ++j)
+                for (ScalarSize step = 0; step < m_timeSteps; ++step)
+                    childBounds[step].expand(getBoundingBox(m_indexData[j], step));
+        }
+    };
+
+    /* Distinct subtrees never touch the same records (see \ref refit()) */
+    if (depth < KAZEN_BVH_REFIT_PARALLEL_DEPTH) {
+        tbb::parallel_for((uint32_t) 0, (uint32_t) KAZEN_BVH_WIDTH, updateChild);
+    } else {
+        for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i)
+            updateChild(i);
+    }
+
+    for (ScalarSize step = 0; step < m_timeSteps; ++step) {
+        MotionBounds &record = m_motionBounds[(size_t) nodeIdx * m_timeSteps + step];
+        result[step].reset();
+
+        for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+            if (node.isEmpty(i)) {
+                /* Never hit, as the slot is masked by the node */
+                record.minX[i] = record.minY[i] = record.minZ[i] = 0.f;
+                record.maxX[i] = record.maxY[i] = record.maxZ[i] = 0.f;
+                continue;
+            }
+
+            const ScalarBoundingBox3f &bbox = bounds[(size_t) i * m_timeSteps + step];
+            record.minX[i] = bbox.min.x(); record.maxX[i] = bbox.max.x();
+            record.minY[i] = bbox.min.y(); record.maxY[i] = bbox.max.y();
+            record.minZ[i] = bbox.min.z(); record.maxZ[i] = bbox.max.z();
+            result[step].expand(bbox);
+        }
+    }
+}
+
+template <typename Node>
+Accel::ScalarFloat Accel::sahCost(const Node *nodes, ScalarIndex nodeIdx) const {
+    const Node &node = nodes[nodeIdx];
+    ScalarBoundingBox3f bounds[KAZEN_BVH_WIDTH], bbox;
+    for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+        if (node.getChildBounds(i, bounds[i]))
+            bbox.expand(bounds[i]);
+    }
+
+    ScalarFloat area = bbox.surfaceArea();
+    ScalarFloat invArea = area > 0.f ? 1.f / area : 0.f;
+    ScalarFloat cost = KAZEN_BVH_TRAVERSAL_COST;
+
+    for (uint32_t i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+        if (node.isEmpty(i))
+            continue;
+
+        uint32_t target, count;
+        node.getChild(i, target, count);
+        ScalarFloat childCost = count == 0 ? sahCost(nodes, target)
+                                           : KAZEN_BVH_INTERSECTION_COST * count;
+        cost += invArea * bounds[i].surfaceArea() * childCost;
+    }
+
+    return cost;
+}
+
+Accel::ScalarFloat Accel::statistics(ScalarIndex nodeIdx, ScalarSize &leafCount) const {
+    const BVHNode &node = m_nodes[nodeIdx];
+
+    if (node.isLeaf()) {
+        leafCount++;
+        return KAZEN_BVH_INTERSECTION_COST * node.leaf.size;
+    }
+
+    const BVHNode &left  = m_nodes[nodeIdx + 1],
+                  &right = m_nodes[node.inner.rightChild];
+
+    ScalarFloat area = node.bbox.surfaceArea();
+    ScalarFloat invArea = area > 0.f ? 1.f / area : 0.f;
+
+    return KAZEN_BVH_TRAVERSAL_COST + invArea * (
+        left.bbox.surfaceArea() * statistics(nodeIdx + 1, leafCount) +
+        right.bbox.surfaceArea() * statistics(node.inner.rightChild, leafCount));
+}
+
+template <typename Value>
+Accel::WatertightRay<Value>::WatertightRay(const Ray<Point3> &ray) : o(ray.o) {
+    /* Permute the dominant axis of the direction to z */
+    Vector<Value, 3> dAbs = abs(ray.d);
+    kz = select(dAbs.x() >= dAbs.y() && dAbs.x() >= dAbs.z(), Index(0),
+                select(dAbs.y() >= dAbs.z(), Index(1), Index(2)));
+    kx = select(eq(kz, 2u), Index(0), kz + 1u);
+    ky = select(eq(kx, 2u), Index(0), kx + 1u);
+
+    Value dz = permute(ray.d, kz);
+    sx = permute(ray.d, kx) / dz;
+    sy = permute(ray.d, ky) / dz;
+    sz = rcp(dz);
+}
+
+template <typename Node, typename FloatP>
+KAZEN_INLINE FloatP Accel::intersectChildren(const Node &node, ScalarIndex nodeIdx,
+                                             const TimeSegment<ScalarFloat> &segment,
+                                             const Vector<FloatP, 3> &oRcp, const Vector<FloatP, 3> &dRcp,
+                                             const FloatP &mint, const FloatP &maxt) const {
+    if constexpr (std::is_same_v<Node, WideBVHNode>) {
+        if (m_timeSteps > 1) {
+            const MotionBounds &b0 = m_motionBounds[(size_t) nodeIdx * m_timeSteps + segment.index],
+                               &b1 = (&b0)[1];
+            FloatP w(segment.weight);
+            return slabTest(Vector<FloatP, 3>(lerpKeyFrames(b0.minX, b1.minX, w),
+                                              lerpKeyFrames(b0.minY, b1.minY, w),
+                                              lerpKeyFrames(b0.minZ, b1.minZ, w)),
+                            Vector<FloatP, 3>(lerpKeyFrames(b0.maxX, b1.maxX, w),
+                                              lerpKeyFrames(b0.maxY, b1.maxY, w),
+                                              lerpKeyFrames(b0.maxZ, b1.maxZ, w)),
+                            oRcp, dRcp, mint, maxt, neq(node.count, WideBVHNode::EmptySlot));
+        }
+    }
+    return node.rayIntersect(oRcp, dRcp, mint, maxt);
+}
+
+template <typename Node>
+KAZEN_INLINE bool Accel::getChildBounds(const Node &node, ScalarIndex nodeIdx, uint32_t i,
+                                        const TimeSegment<Float> &segment, BoundingBox3f &bbox) const {
+    ScalarBoundingBox3f bounds;
+    if (!node.getChildBounds(i, bounds))
+        return false;
+
+    if constexpr (std::is_same_v<Node, WideBVHNode>) {
+        if (m_timeSteps > 1) {
+            /* Lanes may fall into different key frame intervals */
+            constexpr uint32_t RecordSize = sizeof(MotionBounds) / sizeof(ScalarFloat);
+            const ScalarFloat *records = (const ScalarFloat *) m_motionBounds.data();
+            UInt32 offset = (nodeIdx * m_timeSteps + segment.index) * RecordSize + i;
+
+            auto component = [&](uint32_t plane) {
+                Float v0 = gather<Float>(records, offset + plane * KAZEN_BVH_WIDTH),
+                      v1 = gather<Float>(records, offset + (plane * KAZEN_BVH_WIDTH + RecordSize));
+                return lerpKeyFrames(v0, v1, segment.weight);
+            };
+            bbox.min = Point3f(component(0), component(1), component(2));
+            bbox.max = Point3f(component(3), component(4), component(5));
+            return true;
+        }
+    }
+    bbox = BoundingBox3f(bounds);
+    return true;
+}
+
+Accel::TriangleMaskP Accel::intersectTriangles(ScalarIndex slot, ScalarSize count,
+                                               const WatertightRay<ScalarFloat> &wray,
+                                               const TimeSegment<ScalarFloat> &segment, const ScalarRay3f &ray,
+                                               TriangleFloatP &t, TriangleFloatP &u, TriangleFloatP &v) const {
+    using UInt32P   = WideBVHNode::UInt32P;
+    using Vector3fP = Vector<TriangleFloatP, 3>;
+
+    /* Load a vertex coordinate of all slots, interpolated to the time of the ray */
+    auto load = [&](uint32_t k, uint32_t axis) {
+        TriangleFloatP value = load_unaligned<TriangleFloatP>(getTriangleData(k, axis, segment.index) + slot);
+        if (m_timeSteps > 1)
+            value = lerpKeyFrames(value, load_unaligned<TriangleFloatP>(getTriangleData(k, axis, segment.index + 1) + slot),
+                                  TriangleFloatP(segment.weight));
+        return value - wray.o[axis];
+    };
+
+    /* The ray is the same for all lanes, hence the axes can be permuted while loading */
+    Vector3fP p[3];
+    for (uint32_t k = 0; k < 3; ++k)
+        p[k] = Vector3fP(load(k, wray.kx), load(k, wray.ky), load(k, wray.kz));
+
+    TriangleMaskP active = arange<UInt32P>() < count &&
+        neq(load_unaligned<UInt32P>(m_triangleIndices.data() + slot), NoTriangle);
+    KAZEN_ACCEL_STAT(triangles, enoki::count(active));
+
+    return active && watertightTest(p[0], p[1], p[2], wray.sx, wray.sy, wray.sz, ray.mint, ray.maxt, t, u, v);
+}
+
+Accel::Mask Accel::intersectTriangle(ScalarIndex slot, const WatertightRay<Float> &wray,
+                                     const TimeSegment<Float> &segment, const Ray3f &ray,
+                                     Float &t, Float &u, Float &v, Mask active) const {
+    /* The triangle is shared by all lanes, only the rays (and their permutations) differ.
+       Moving triangles are interpolated per lane, as the rays may have different times. */
+    auto load = [&](uint32_t k, uint32_t axis) {
+        if (m_timeSteps == 1)
+            return Float(getTriangleData(k, axis)[slot]);
+        UInt32 offset = (segment.index * 9 + k * 3 + axis) * m_triangleStride + slot;
+        return lerpKeyFrames(gather<Float>(m_triangleData.data(), offset, active),
+                             gather<Float>(m_triangleData.data(), offset + 9 * m_triangleStride, active),
+                             segment.weight);
+    };
+
+    Vector3f p[3];
+    for (uint32_t k = 0; k < 3; ++k) {
+        Vector3f d = Point3f(load(k, 0), load(k, 1), load(k, 2)) - wray.o;
+        p[k] = Vector3f(permute(d, wray.kx), permute(d, wray.ky), permute(d, wray.kz));
+    }
+    KAZEN_ACCEL_STAT(triangles, count(active));
+
+    return active && watertightTest(p[0], p[1], p[2], wray.sx, wray.sy, wray.sz, ray.mint, ray.maxt, t, u, v);
+}
+
+Accel::TriangleMaskP Accel::intersectParticles(ScalarIndex slot, ScalarSize count, const ScalarRay3f &ray,
+                                               TriangleFloatP &t) const {
+    using UInt32P   = WideBVHNode::UInt32P;
+    using Vector3fP = Vector<TriangleFloatP, 3>;
+
+    /* The ray is the same for all lanes, only the particles differ */
+    Vector3fP f(ray.o.x() - load_unaligned<TriangleFloatP>(getParticleData(0) + slot),
+                ray.o.y() - load_unaligned<TriangleFloatP>(getParticleData(1) + slot),
+                ray.o.z() - load_unaligned<TriangleFloatP>(getParticleData(2) + slot));
+    TriangleFloatP radius = load_unaligned<TriangleFloatP>(getParticleData(3) + slot);
+
+    TriangleMaskP active = arange<UInt32P>() < count &&
+        neq(load_unaligned<UInt32P>(m_particleIndices.data() + slot), NoParticle);
+    KAZEN_ACCEL_STAT(particles, enoki::count(active));
+
+    return active && particleTest(f, Vector3fP(ray.d.x(), ray.d.y(), ray.d.z()), radius,
+                                  TriangleFloatP(ray.mint), TriangleFloatP(ray.maxt), t);
+}
+
+Accel::Mask Accel::intersectParticle(ScalarIndex slot, const Ray3f &ray, Float &t, Mask active) const {
+    /* The particle is shared by all lanes, only the rays differ */
+    Point3f center(getParticleData(0)[slot], getParticleData(1)[slot], getParticleData(2)[slot]);
+    KAZEN_ACCEL_STAT(particles, count(active));
+
+    return active && particleTest(ray.o - center, ray.d, Float(getParticleData(3)[slot]), ray.mint, ray.maxt, t);
+}
+
+bool Accel::rayIntersect(const ScalarRay3f &ray_, ScalarIntersection3f &its, bool shadowRay) const {
+    if (shadowRay)
+        return rayTest(ray_);
+    /* Queries only announce themselves once a hierarchy has been published. Those that
+       find none use the hierarchy of the initial build, which update() keeps valid. */
+    if (m_snapshot.load(std::memory_order_relaxed)) {
+        ReadGuard guard;
+        return getSnapshot()->rayIntersect(ray_, its, false);
+    }
+    KAZEN_ACCEL_STAT(rays, 1);
+
+    /// Make a copy of the ray (we will need to update its '.maxt' value)
+    ScalarRay3f ray(ray_);
+    ScalarIndex f;          // Triangle index of the closest intersection
+    ScalarIndex instance;   // Instance containing that triangle (if any)
+    ScalarPoint2f uv;
+
+#if defined(KAZEN_USE_EMBREE)
+    bool foundIntersection = m_embree ? m_embree->rayIntersect(ray, f, instance, ray.maxt, uv)
+                                      : traverse(ray, f, instance, uv);
+#else
+    bool foundIntersection = traverse(ray, f, instance, uv);
+#endif
+
+    if (foundIntersection) {
+        its.t = ray.maxt;
+        its.uv = uv;
+        setHitInformation(f, instance, ray, its);
+    }
 
     return foundIntersection;
 }
 
-NAMESPACE_END(kazen)
+Accel::Mask Accel::rayIntersect(const Ray3f &ray, Intersection3f &its, bool shadowRay, Mask active) const {
+    if (shadowRay)
+        return rayTest(ray, active);
+    /* Announce the query before loading the published hierarchy (see rayIntersect()) */
+    if (m_snapshot.load(std::memory_order_relaxed)) {
+        ReadGuard guard;
+        return getSnapshot()->rayIntersect(ray, its, false, active);
+    }
+    KAZEN_ACCEL_STAT(rays, count(active));
+
+    UInt32 f;               // Triangle indices of the closest intersections
+    UInt32 instance;        // Instances containing those triangles (if any)
+    Float t, u, v;
+
+#if defined(KAZEN_USE_EMBREE)
+    Mask foundIntersection = m_embree ? m_embree->rayIntersect(ray, f, instance, t, u, v, active)
+                                      : traversePacket(ray, f, instance, t, u, v, active);
+#else
+    Mask foundIntersection = traversePacket(ray, f, instance, t, u, v, active);
+#endif
+
+    if (any(foundIntersection)) {
+        /* Hit information is computed per lane, as lanes may refer to different meshes */
+        for (size_t i = 0; i < Float::Size; ++i) {
+            if (!foundIntersection[i])
+                continue;
+
+            ScalarIntersection3f its1;
+            its1.t = t[i];
+            its1.uv = ScalarPoint2f(u[i], v[i]);
+            ScalarRay3f ray1(ScalarPoint3f(ray.o.x()[i], ray.o.y()[i], ray.o.z()[i]),
+                             ScalarVector3f(ray.d.x()[i], ray.d.y()[i], ray.d.z()[i]),
+                             ray.mint[i], ray.maxt[i], ray.time[i]);
+            setHitInformation(f[i], instance[i], ray1, its1);
+
+            for (size_t k = 0; k < 3; ++k) {
+                its.p[k][i] = its1.p[k];
+                its.shFrame.s[k][i] = its1.shFrame.s[k];
+                its.shFrame.t[k][i] = its1.shFrame.t[k];
+                its.shFrame.n[k][i] = its1.shFrame.n[k];
+                its.geoFrame.s[k][i] = its1.geoFrame.s[k];
+                its.geoFrame.t[k][i] = its1.geoFrame.t[k];
+                its.geoFrame.n[k][i] = its1.geoFrame.n[k];
+            }
+            its.uv.x()[i] = its1.uv.x();
+            its.uv.y()[i] = its1.uv.y();
+            its.t[i] = its1.t;
+            its.mesh[i] = its1.mesh;
+            its.particles[i] = its1.particles;
+        }
+    }
+
+    return foundIntersection;
+}
 
+bool Accel::rayTest(const ScalarRay3f &ray) const {
+    /* Announce the query before loading the published hierarchy (see rayIntersect()) */
+    if (m_snapshot.load(std::memory_order_relaxed)) {
+        ReadGuard guard;
+        return getSnapshot()->rayTest(ray);
+    }
+    KAZEN_ACCEL_STAT(rays, 1);
+#if defined(KAZEN_USE_EMBREE)
+    if (m_embree)
+        return m_embree->rayTest(ray);
+#endif
+    return m_nodeFormat == EQuantizedNodes
+        ? occluded(getNodes<QuantizedBVHNode>(), ray, 0u, 0u)
+        : occluded(getNodes<WideBVHNode>(), ray, 0u, 0u);
+}
+
+Accel::Mask Accel::rayTest(const Ray3f &ray, Mask active) const {
+    /* Announce the query before loading the published hierarchy (see rayIntersect()) */
+    if (m_snapshot.load(std::memory_order_relaxed)) {
+        ReadGuard guard;
+        return getSnapshot()->rayTest(ray, active);
+    }
+    KAZEN_ACCEL_STAT(rays, count(active));
+#if defined(KAZEN_USE_EMBREE)
+    if (m_embree)
+        return m_embree->rayTest(ray, active);
+#endif
+    return m_nodeFormat == EQuantizedNodes
+        ? occludedPacket(getNodes<QuantizedBVHNode>(), ray, active)
+        : occludedPacket(getNodes<WideBVHNode>(), ray, active);
+}
+
+template <typename Node>
+bool Accel::traverse(const Node *nodes, ScalarRay3f &ray, ScalarIndex root, ScalarSize rootCount,
+                     ScalarIndex &f, ScalarIndex &instance, ScalarPoint2f &uv) const {
+    using FloatP    = typename Node::FloatP;
+    using Vector3fP = Vector<FloatP, 3>;
+
+    bool foundIntersection = false;         // Was an intersection found so far?
+
+    if (m_nodeCount == 0)
+        return false;
+
+    /* Per-ray constants of the slab test, broadcast to all lanes */
+    ScalarVector3f rcpD = slabRcp(ray.d);
+    Vector3fP dRcp(rcpD.x(), rcpD.y(), rcpD.z());
+    Vector3fP oRcp(ray.o.x() * rcpD.x(),
+                   ray.o.y() * rcpD.y(),
+                   ray.o.z() * rcpD.z());
+    WatertightRay<ScalarFloat> wray(ray);
+    TimeSegment<ScalarFloat> segment(ray.time, m_timeSteps);
+
+    /// Traversal stack entry: a wide node or a leaf along with its entry distance
+    struct StackItem {
+        ScalarIndex child;
+        ScalarSize count;
+        ScalarFloat t;
+    };
+
+    StackItem stack[KAZEN_BVH_STACK_SIZE];
+    ScalarSize stackIdx = 0;
+    stack[stackIdx++] = { root, rootCount, ray.mint };
+
+    while (stackIdx > 0) {
+        const StackItem item = stack[--stackIdx];
+
+        /* Skip entries that lie behind the closest intersection found so far */
+        if (item.t > ray.maxt)
+            continue;
+
+        if (item.count > 0) {
+            ScalarIndex end = item.child + item.count;
+
+            /* Test the triangles of the leaf KAZEN_BVH_WIDTH at a time */
+            for (ScalarIndex i = item.child; i < end; i += KAZEN_BVH_WIDTH) {
+                FloatP u, v, t;
+                auto hit = intersectTriangles(i, end - i, wray, segment, ray, t, u, v);
+                if (none(hit))
+                    continue;
+
+                /* An intersection was found! Keep the closest one */
+                t = select(hit, t, math::Infinity<FloatP>);
+                ScalarFloat tMin = hmin(t);
+                for (ScalarSize j = 0; j < KAZEN_BVH_WIDTH; ++j) {
+                    if (t[j] != tMin)
+                        continue;
+                    ray.maxt = tMin;
+                    uv = ScalarPoint2f(u[j], v[j]);
+                    f = m_triangleIndices[i + j];
+                    instance = NoInstance;
+                    foundIntersection = true;
+                    break;
+                }
+            }
+
+            /* Test the particles of the leaf KAZEN_BVH_WIDTH at a time */
+            for (ScalarIndex i = item.child; !m_particles.empty() && i < end; i += KAZEN_BVH_WIDTH) {
+                FloatP t;
+                auto hit = intersectParticles(i, end - i, ray, t);
+                if (none(hit))
+                    continue;
+
+                t = select(hit, t, math::Infinity<FloatP>);
+                ScalarFloat tMin = hmin(t);
+                for (ScalarSize j = 0; j < KAZEN_BVH_WIDTH; ++j) {
+                    if (t[j] != tMin)
+                        continue;
+                    ray.maxt = tMin;
+                    uv = ScalarPoint2f(0.f);
+                    f = m_particleIndices[i + j];
+                    instance = NoInstance;
+                    foundIntersection = true;
+                    break;
+                }
+            }
+
+            if (m_instances.empty())
+                continue;
+
+            for (ScalarIndex i = item.child; i < end; ++i) {
+                ScalarIndex idx = m_indexData[i];
+                if (idx < getInstanceBase())
+                    continue;
+
+                /* Descend into the bottom-level hierarchy of an instance */
+                ScalarIndex f1;
+                if (intersectInstance(idx - getInstanceBase(), ray, f1, uv)) {
+                    f = f1;
+                    instance = idx - getInstanceBase();
+                    foundIntersection = true;
+                }
+            }
+            continue;
+        }
+
+        const Node &node = nodes[item.child];
+        KAZEN_ACCEL_STAT(nodes, 1);
+        KAZEN_ACCEL_STAT(boxes, node.getChildCount());
+        alignas(alignof(FloatP)) ScalarFloat tNear[KAZEN_BVH_WIDTH];
+        store(tNear, intersectChildren(node, item.child, segment, oRcp, dRcp, FloatP(ray.mint), FloatP(ray.maxt)));
+
+        /* Push the children that were hit, farthest first, so that
+           the nearest child ends up on top of the stack */
+        StackItem hits[KAZEN_BVH_WIDTH];
+        ScalarSize hitCount = 0;
+        for (ScalarSize i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+            if (tNear[i] == math::Infinity<ScalarFloat>)
+                continue;
+
+            StackItem entry { 0u, 0u, tNear[i] };
+            node.getChild(i, entry.child, entry.count);
+            ScalarSize j = hitCount++;
+            while (j > 0 && hits[j - 1].t < entry.t) {
+                hits[j] = hits[j - 1];
+                --j;
+            }
+            hits[j] = entry;
+        }
+
+        for (ScalarSize i = 0; i < hitCount; ++i)
+            stack[stackIdx++] = hits[i];
+    }
+
+    return foundIntersection;
+}
+
+template <typename Node>
+bool Accel::occluded(const Node *nodes, const ScalarRay3f &ray, ScalarIndex root, ScalarSize rootCount) const {
+    using FloatP    = typename Node::FloatP;
+    using Vector3fP = Vector<FloatP, 3>;
+
+    if (m_nodeCount == 0)
+        return false;
+
+    ScalarVector3f rcpD = slabRcp(ray.d);
+    Vector3fP dRcp(rcpD.x(), rcpD.y(), rcpD.z());
+    Vector3fP oRcp(ray.o.x() * rcpD.x(),
+                   ray.o.y() * rcpD.y(),
+                   ray.o.z() * rcpD.z());
+    FloatP mint(ray.mint), maxt(ray.maxt);
+    WatertightRay<ScalarFloat> wray(ray);
+    TimeSegment<ScalarFloat> segment(ray.time, m_timeSteps);
+
+    /* The ray segment never shrinks, hence the stack only needs the children */
+    struct StackItem {
+        ScalarIndex child;
+        ScalarSize count;
+    };
+
+    StackItem stack[KAZEN_BVH_STACK_SIZE];
+    ScalarSize stackIdx = 0;
+    stack[stackIdx++] = { root, rootCount };
+
+    while (stackIdx > 0) {
+        const StackItem item = stack[--stackIdx];
+
+        if (item.count > 0) {
+            ScalarIndex end = item.child + item.count;
+
+            for (ScalarIndex i = item.child; i < end; i += KAZEN_BVH_WIDTH) {
+                FloatP u, v, t;
+                if (any(intersectTriangles(i, end - i, wray, segment, ray, t, u, v)))
+                    return true;
+            }
+
+            for (ScalarIndex i = item.child; !m_particles.empty() && i < end; i += KAZEN_BVH_WIDTH) {
+                FloatP t;
+                if (any(intersectParticles(i, end - i, ray, t)))
+                    return true;
+            }
+
+            if (m_instances.empty())
+                continue;
+
+            for (ScalarIndex i = item.child; i < end; ++i) {
+                ScalarIndex idx = m_indexData[i];
+                if (idx >= getInstanceBase() && occludedInstance(idx - getInstanceBase(), ray))
+                    return true;
+            }
+            continue;
+        }
+
+        /* Push the children that were hit in storage order */
+        const Node &node = nodes[item.child];
+        KAZEN_ACCEL_STAT(nodes, 1);
+        KAZEN_ACCEL_STAT(boxes, node.getChildCount());
+        alignas(alignof(FloatP)) ScalarFloat tNear[KAZEN_BVH_WIDTH];
+        store(tNear, intersectChildren(node, item.child, segment, oRcp, dRcp, mint, maxt));
+
+        for (ScalarSize i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+            if (tNear[i] == math::Infinity<ScalarFloat>)
+                continue;
+            StackItem &entry = stack[stackIdx++];
+            node.getChild(i, entry.child, entry.count);
+        }
+    }
+
+    return false;
+}
+
+template <typename Node>
+Accel::Mask Accel::traversePacket(const Node *nodes, const Ray3f &ray_, UInt32 &f, UInt32 &instance,
+                                  Float &tHit, Float &uHit, Float &vHit, Mask active) const {
+    /* Lanes that have been culled from the packet are represented
+       by an empty ray segment, which no box or triangle can hit */
+    Ray3f ray(ray_);
+    ray.maxt = select(active, ray.maxt, -math::Infinity<Float>);
+    ray.dRcp = slabRcp(ray.d);
+    Mask foundIntersection = false;
+
+    if (m_nodeCount == 0 || none(active))
+        return foundIntersection;
+
+    size_t minLanes = std::max((size_t) 1, (size_t) (KAZEN_BVH_PACKET_COHERENCE * Float::Size));
+    WatertightRay<Float> wray(ray);
+    TimeSegment<Float> segment(ray.time, m_timeSteps);
+    UInt32 laneIndex = arange<UInt32>();
+
+    /// Traversal stack entry: a node or leaf along with the per-lane entry distances
+    struct StackItem {
+        ScalarIndex child;
+        ScalarSize count;
+        Float t;
+    };
+
+    StackItem stack[KAZEN_BVH_STACK_SIZE];
+    ScalarSize stackIdx = 0;
+    stack[stackIdx++] = { 0u, 0u, ray.mint };
+
+    while (stackIdx > 0) {
+        const StackItem item = stack[--stackIdx];
+
+        /* Lanes that still need to visit this entry */
+        Mask lanes = item.t <= ray.maxt;
+        size_t laneCount = count(lanes);
+        if (laneCount == 0)
+            continue;
+
+        if (laneCount < minLanes) {
+            /* The packet has lost its coherence: finish this subtree ray by ray */
+            for (size_t i = 0; i < Float::Size; ++i) {
+                if (!lanes[i])
+                    continue;
+
+                ScalarRay3f ray1(ScalarPoint3f(ray.o.x()[i], ray.o.y()[i], ray.o.z()[i]),
+                                 ScalarVector3f(ray.d.x()[i], ray.d.y()[i], ray.d.z()[i]),
+                                 ray.mint[i], ray.maxt[i], ray.time[i]);
+                ScalarIndex f1, instance1;
+                ScalarPoint2f uv1;
+
+                if (traverse(nodes, ray1, item.child, item.count, f1, instance1, uv1)) {
+                    foundIntersection |= eq(laneIndex, (uint32_t) i);
+                    ray.maxt[i] = ray1.maxt;
+                    f[i] = f1;
+                    instance[i] = instance1;
+                    uHit[i] = uv1.x();
+                    vHit[i] = uv1.y();
+                }
+            }
+            continue;
+        }
+
+        if (item.count > 0) {
+            for (ScalarIndex i = item.child; i < item.child + item.count; ++i) {
+                ScalarIndex idx = m_indexData[i];
+
+                Float u, v, t;
+                UInt32 f1;
+                Mask hit;
+                if (idx >= getInstanceBase()) {
+                    /* Descend into the bottom-level hierarchy of an instance */
+                    Ray3f ray1(ray);
+                    hit = intersectInstance(idx - getInstanceBase(), ray1, f1, u, v, lanes);
+                    t = ray1.maxt;
+                } else if (idx >= getTriangleCount()) {
+                    hit = intersectParticle(i, ray, t, lanes);
+                    u = v = 0.f;
+                    f1 = idx;
+                } else {
+                    hit = intersectTriangle(i, wray, segment, ray, t, u, v, lanes);
+                    f1 = idx;
+                }
+                if (none(hit))
+                    continue;
+
+                foundIntersection |= hit;
+                masked(ray.maxt, hit) = t;
+                masked(uHit, hit) = u;
+                masked(vHit, hit) = v;
+                masked(f, hit) = f1;
+                masked(instance, hit) = idx >= getInstanceBase() ? idx - getInstanceBase() : NoInstance;
+            }
+            continue;
+        }
+
+        /* Test every child once for all lanes of the packet */
+        const Node &node = nodes[item.child];
+        KAZEN_ACCEL_STAT(nodes, laneCount);
+        KAZEN_ACCEL_STAT(boxes, laneCount * node.getChildCount());
+        StackItem hits[KAZEN_BVH_WIDTH];
+        ScalarFloat order[KAZEN_BVH_WIDTH];
+        ScalarSize hitCount = 0;
+
+        for (ScalarSize i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+            BoundingBox3f bbox;
+            if (!getChildBounds(node, item.child, i, segment, bbox))
+                continue;
+
+            auto [hit, nearT, farT] = bbox.rayIntersect(ray);
+            hit &= lanes && farT >= ray.mint && nearT <= ray.maxt;
+            if (none(hit))
+                continue;
+
+            StackItem entry { 0u, 0u, select(hit, max(nearT, ray.mint), math::Infinity<Float>) };
+            node.getChild(i, entry.child, entry.count);
+
+            /* Order children by their closest entry distance over all lanes */
+            ScalarFloat key = hmin(entry.t);
+            ScalarSize j = hitCount++;
+            while (j > 0 && order[j - 1] < key) {
+                hits[j] = hits[j - 1];
+                order[j] = order[j - 1];
+                --j;
+            }
+            hits[j] = entry;
+            order[j] = key;
+        }
+
+        for (ScalarSize i = 0; i < hitCount; ++i)
+            stack[stackIdx++] = hits[i];
+    }
+
+    tHit = ray.maxt;
+    return foundIntersection;
+}
+
+template <typename Node>
+Accel::Mask Accel::occludedPacket(const Node *nodes, const Ray3f &ray_, Mask active) const {
+    Mask result = false;
+
+    if (m_nodeCount == 0 || none(active))
+        return result;
+
+    Ray3f ray(ray_);
+    ray.dRcp = slabRcp(ray.d);
+
+    size_t minLanes = std::max((size_t) 1, (size_t) (KAZEN_BVH_PACKET_COHERENCE * Float::Size));
+    WatertightRay<Float> wray(ray);
+    TimeSegment<Float> segment(ray.time, m_timeSteps);
+
+    /// Traversal stack entry: a node or leaf along with the lanes that reached it
+    struct StackItem {
+        ScalarIndex child;
+        ScalarSize count;
+        Mask lanes;
+    };
+
+    StackItem stack[KAZEN_BVH_STACK_SIZE];
+    ScalarSize stackIdx = 0;
+    stack[stackIdx++] = { 0u, 0u, active };
+
+    while (stackIdx > 0) {
+        const StackItem item = stack[--stackIdx];
+
+        /* Occluded lanes are done */
+        Mask lanes = item.lanes && !result;
+        size_t laneCount = count(lanes);
+        if (laneCount == 0)
+            continue;
+
+        if (laneCount < minLanes) {
+            /* The packet has lost its coherence: finish this subtree ray by ray */
+            for (size_t i = 0; i < Float::Size; ++i) {
+                if (!lanes[i])
+                    continue;
+
+                ScalarRay3f ray1(ScalarPoint3f(ray.o.x()[i], ray.o.y()[i], ray.o.z()[i]),
+                                 ScalarVector3f(ray.d.x()[i], ray.d.y()[i], ray.d.z()[i]),
+                                 ray.mint[i], ray.maxt[i], ray.time[i]);
+                if (occluded(nodes, ray1, item.child, item.count))
+                    result[i] = true;
+            }
+            continue;
+        }
+
+        if (item.count > 0) {
+            for (ScalarIndex i = item.child; i < item.child + item.count; ++i) {
+                ScalarIndex idx = m_indexData[i];
+
+                Mask hit;
+                if (idx >= getInstanceBase()) {
+                    hit = occludedInstance(idx - getInstanceBase(), ray, lanes);
+                } else if (idx >= getTriangleCount()) {
+                    Float t;
+                    hit = intersectParticle(i, ray, t, lanes);
+                } else {
+                    Float u, v, t;
+                    hit = intersectTriangle(i, wray, segment, ray, t, u, v, lanes);
+                }
+
+                result |= hit;
+                lanes &= !hit;
+                if (none(lanes))
+                    break;
+            }
+            continue;
+        }
+
+        /* Push the children that were hit by any lane in storage order */
+        const Node &node = nodes[item.child];
+        KAZEN_ACCEL_STAT(nodes, laneCount);
+        KAZEN_ACCEL_STAT(boxes, laneCount * node.getChildCount());
+        for (ScalarSize i = 0; i < KAZEN_BVH_WIDTH; ++i) {
+            BoundingBox3f bbox;
+            if (!getChildBounds(node, item.child, i, segment, bbox))
+                continue;
+
+            auto [hit, nearT, farT] = bbox.rayIntersect(ray);
+            hit &= lanes && farT >= ray.mint && nearT <= ray.maxt;
+            if (none(hit))
+                continue;
+
+            StackItem &entry = stack[stackIdx++];
+            node.getChild(i, entry.child, entry.count);
+            entry.lanes = hit;
+        }
+    }
+
+    return result;
+}
+
+bool Accel::intersectInstance(ScalarIndex instance, ScalarRay3f &ray, ScalarIndex &f, ScalarPoint2f &uv) const {
+    /* The direction is not renormalized, so that distances along
+       the ray are the same in object and in world space */
+    const Instance *inst = m_instances[instance];
+    const ScalarTransform4f &toObject = inst->getToObject();
+    ScalarRay3f ray1 = inst->isIdentity() ? ray
+        : ScalarRay3f(toObject * ray.o, toObject * ray.d, ray.mint, ray.maxt, ray.time);
+
+    ScalarIndex unused;
+    if (!m_instanceAccels[instance]->traverse(ray1, f, unused, uv))
+        return false;
+
+    ray.maxt = ray1.maxt;
+    return true;
+}
+
+Accel::Mask Accel::intersectInstance(ScalarIndex instance, Ray3f &ray, UInt32 &f, Float &u, Float &v,
+                                     Mask active) const {
+    const Instance *inst = m_instances[instance];
+    const ScalarTransform4f &toObject = inst->getToObject();
+    Ray3f ray1 = inst->isIdentity() ? ray
+        : Ray3f(toObject * ray.o, toObject * ray.d, ray.mint, ray.maxt, ray.time);
+
+    UInt32 unused;
+    Float t;
+    Mask hit = m_instanceAccels[instance]->traversePacket(ray1, f, unused, t, u, v, active);
+    masked(ray.maxt, hit) = t;
+    return hit;
+}
+
+bool Accel::occludedInstance(ScalarIndex instance, const ScalarRay3f &ray) const {
+    if (m_instances[instance]->isIdentity())
+        return m_instanceAccels[instance]->rayTest(ray);
+    const ScalarTransform4f &toObject = m_instances[instance]->getToObject();
+    return m_instanceAccels[instance]->rayTest(
+        ScalarRay3f(toObject * ray.o, toObject * ray.d, ray.mint, ray.maxt, ray.time));
+}
+
+Accel::Mask Accel::occludedInstance(ScalarIndex instance, const Ray3f &ray, Mask active) const {
+    if (m_instances[instance]->isIdentity())
+        return m_instanceAccels[instance]->rayTest(ray, active);
+    const ScalarTransform4f &toObject = m_instances[instance]->getToObject();
+    return m_instanceAccels[instance]->rayTest(
+        Ray3f(toObject * ray.o, toObject * ray.d, ray.mint, ray.maxt, ray.time), active);
+}
+
+void Accel::setHitInformation(ScalarIndex index, ScalarIndex instance, const ScalarRay3f &ray,
+                              ScalarIntersection3f &its) const {
+    if (instance != NoInstance) {
+        /* Compute the hit information in object space and transform it to world space */
+        setHitInformation(m_instances[instance]->getMesh(), index, ray.time, its);
+        if (m_instances[instance]->isIdentity())
+            return;
+
+        const ScalarTransform4f &toWorld = m_instances[instance]->getToWorld();
+        its.p = toWorld * its.p;
+        its.geoFrame = ScalarFrame3f(ScalarVector3f(normalize(toWorld * ScalarNormal3f(its.geoFrame.n))));
+        its.shFrame = ScalarFrame3f(ScalarVector3f(normalize(toWorld * ScalarNormal3f(its.shFrame.n))));
+        return;
+    }
+
+    if (index >= getTriangleCount()) {
+        ScalarIndex particleIdx = index;
+        const Particles *particles = m_particles[findParticles(particleIdx)];
+        setHitInformation(particles, particleIdx, ray, its);
+        return;
+    }
+
+    ScalarIndex triIdx = index;
+    const Mesh *mesh = m_meshes[findMesh(triIdx)];
+    setHitInformation(mesh, triIdx, ray.time, its);
+}
+
+void Accel::setHitInformation(const Mesh *mesh, ScalarIndex triIdx, ScalarFloat time, ScalarIntersection3f &its) {
+    /* At this point, we now know that there is an intersection,
+       and we know the triangle index of the closest such intersection.
+
+       The following computes a number of additional properties which
+       characterize the intersection (normals, texture coordinates, etc..)
+    */
+    its.mesh = mesh;
+    its.particles = nullptr;
+
+    /* Find the barycentric coordinates */
+    ScalarVector3f bary(1.f - its.uv.x() - its.uv.y(), its.uv.x(), its.uv.y());
+
+    auto fi = mesh->getFaceIndices(triIdx);
+    ScalarPoint3f p0 = mesh->getVertexPositionAt(fi[0], time),
+                  p1 = mesh->getVertexPositionAt(fi[1], time),
+                  p2 = mesh->getVertexPositionAt(fi[2], time);
+
+    /* Compute the intersection positon accurately
+       using barycentric coordinates */
+    its.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
+
+    /* Compute proper texture coordinates if provided by the mesh */
+    if (mesh->hasVertexTexCoords())
+        its.uv = bary.x() * mesh->getVertexTexCoord(fi[0]) +
+                 bary.y() * mesh->getVertexTexCoord(fi[1]) +
+                 bary.z() * mesh->getVertexTexCoord(fi[2]);
+
+    /* Compute the geometry frame */
+    its.geoFrame = ScalarFrame3f(normalize(cross(p1 - p0, p2 - p0)));
+
+    if (mesh->hasVertexNormals()) {
+        /* Compute the shading frame. Note that for simplicity,
+           the current implementation doesn't attempt to provide
+           tangents that are continuous across the surface. That
+           means that this code will need to be modified to be able
+           use anisotropic BRDFs, which need tangent continuity */
+        ScalarNormal3f n = bary.x() * mesh->getVertexNormal(fi[0]) +
+                           bary.y() * mesh->getVertexNormal(fi[1]) +
+                           bary.z() * mesh->getVertexNormal(fi[2]);
+        its.shFrame = ScalarFrame3f(ScalarVector3f(normalize(n)));
+    } else {
+        its.shFrame = its.geoFrame;
+    }
+}
+
+void Accel::setHitInformation(const Particles *particles, ScalarIndex index, const ScalarRay3f &ray,
+                              ScalarIntersection3f &its) {
+    its.mesh = nullptr;
+    its.particles = particles;
+
+    ScalarPoint3f center = particles->getCenter(index);
+    ScalarFloat radius = particles->getRadius(index);
+
+    if (particles->getShape() == Particles::EDisk) {
+        /* The disk faces the ray, uv are polar coordinates around its center */
+        its.p = ray(its.t);
+        its.geoFrame = ScalarFrame3f(normalize(-ray.d));
+        ScalarVector3f local = its.geoFrame.toLocal(its.p - center);
+        ScalarFloat phi = std::atan2(local.y(), local.x());
+        its.uv = ScalarPoint2f((phi < 0.f ? phi + math::TwoPi<ScalarFloat> : phi) * math::InvTwoPi<ScalarFloat>,
+                               std::min(norm(local) / radius, 1.f));
+    } else {
+        /* Project the hit point onto the sphere, which removes the error of the ray distance */
+        ScalarVector3f n = normalize(ray(its.t) - center);
+        its.p = fmadd(n, radius, center);
+        its.geoFrame = ScalarFrame3f(n);
+        ScalarFloat phi = std::atan2(n.y(), n.x());
+        its.uv = ScalarPoint2f((phi < 0.f ? phi + math::TwoPi<ScalarFloat> : phi) * math::InvTwoPi<ScalarFloat>,
+                               safe_acos(n.z()) * math::InvPi<ScalarFloat>);
+    }
+    its.shFrame = its.geoFrame;
+}
+
+std::string Accel::toString() const {
+    return fmt::format(
+        "Accel[\n"
+        "  meshes = {},\n"
+        "  triangles = {},\n"
+        "  particles = {},\n"
+        "  instances = {},\n"
+        "  bottomLevel = {},\n"
+        "  backend = {},\n"
+        "  nodeFormat = {},\n"
+        "  timeSteps = {},\n"
+        "  nodes = {}\n"
+        "]",
+        m_meshes.size(),
+        getTriangleCount(),
+        getParticleCount(),
+        m_instances.size(),
+        m_bottomLevel.size(),
+        usesEmbree() ? "embree" : "kazen",
+        m_nodeFormat == EQuantizedNodes ? "quantized" : "wide",
+        m_timeSteps,
+        getNodeCount()
+    );
+}
+
+#if defined(KAZEN_ENABLE_ACCEL_STATS)
+AccelStatistics &Accel::getThreadStatistics() {
+    return threadStatistics.statistics;
+}
+
+AccelStatistics Accel::getStatistics() {
+    std::lock_guard<std::mutex> lock(statisticsMutex);
+    AccelStatistics result = retiredStatistics;
+    for (const AccelStatistics *statistics : statisticsRegistry)
+        result += *statistics;
+    return result;
+}
+
+void Accel::resetStatistics() {
+    std::lock_guard<std::mutex> lock(statisticsMutex);
+    retiredStatistics = AccelStatistics();
+    for (AccelStatistics *statistics : statisticsRegistry)
+        *statistics = AccelStatistics();
+}
+#endif
+
+std::string AccelStatistics::toString() const {
+    double scale = rays > 0 ? 1.0 / (double) rays : 0.0;
+    return fmt::format(
+        "AccelStatistics[\n"
+        "  rays = {},\n"
+        "  nodes = {} ({:.2f} per ray),\n"
+        "  boxes = {} ({:.2f} per ray),\n"
+        "  triangles = {} ({:.2f} per ray),\n"
+        "  particles = {} ({:.2f} per ray)\n"
+        "]",
+        rays,
+        nodes, nodes * scale,
+        boxes, boxes * scale,
+        triangles, triangles * scale,
+        particles, particles * scale
+    );
+}
+
+NAMESPACE_END(kazen)
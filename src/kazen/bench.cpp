@@ -0,0 +1,585 @@
+#include <kazen/bench.h>
+#include <kazen/scene.h>
+#include <kazen/camera.h>
+#include <kazen/parser.h>
+#include <kazen/warp.h>
+#include <kazen/timer.h>
+#include <kazen/renderer.h>
+#include <experimental/arch/sorted.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <thread>
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_arena.h>
+#include <tbb/enumerable_thread_specific.h>
+
+/* Number of rays generated from the same random number stream */
+#define KAZEN_BENCH_BLOCK_SIZE 4096
+
+NAMESPACE_BEGIN(kazen)
+
+NAMESPACE_BEGIN()
+    /// Raw ray record of a ray file (see \ref RayBenchmark::saveRays())
+    struct RayRecord {
+        float o[3], d[3];
+        float mint, maxt, time;
+    };
+
+    const char *distributionName(RayBenchmark::EDistribution distribution) {
+        switch (distribution) {
+            case RayBenchmark::ECameraRays: return "camera";
+            case RayBenchmark::ESphereRays: return "sphere";
+            case RayBenchmark::EBounceRays: return "bounce";
+            case RayBenchmark::EAxisRays:   return "axis";
+            default:                        return "<unknown>";
+        }
+    }
+
+    /// Parse a comma-separated list of thread counts
+    std::vector<int> parseThreadCounts(const std::string &value) {
+        std::vector<int> result;
+        size_t start = 0;
+        while (start <= value.size()) {
+            size_t end = value.find(',', start);
+            if (end == std::string::npos)
+                end = value.size();
+            int threads = std::stoi(value.substr(start, end - start));
+            if (threads <= 0)
+                throw Exception("Invalid thread count {}", threads);
+            result.push_back(threads);
+            start = end + 1;
+        }
+        return result;
+    }
+NAMESPACE_END()
+
+RayBenchmark::RayBenchmark(const Scene *scene, const Settings &settings)
+    : m_scene(scene), m_settings(settings) {
+    if (m_settings.threadCounts.empty()) {
+        int cores = (int) std::max(1u, std::thread::hardware_concurrency());
+        for (int threads = 1; threads < cores; threads *= 2)
+            m_settings.threadCounts.push_back(threads);
+        m_settings.threadCounts.push_back(cores);
+    }
+
+    if (m_settings.rayFile.empty())
+        generateRays();
+    else
+        loadRays(m_settings.rayFile);
+
+    if (!m_settings.recordFile.empty())
+        saveRays(m_settings.recordFile);
+}
+
+void RayBenchmark::generateRays() {
+    size_t count = m_settings.rayCount;
+    if (m_settings.distribution == ECameraRays) {
+        generateCameraRays(m_rays, count, m_settings.seed, &m_pixels);
+        return;
+    }
+
+    if (m_settings.distribution == ESphereRays || m_settings.distribution == EAxisRays) {
+        const ScalarBoundingBox3f &bbox = m_scene->getBoundingBox();
+        m_rays.resize(count);
+        size_t blocks = (count + KAZEN_BENCH_BLOCK_SIZE - 1) / KAZEN_BENCH_BLOCK_SIZE;
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, blocks, 1),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t block = range.begin(); block != range.end(); ++block) {
+                    std::mt19937_64 rng(m_settings.seed * blocks + block);
+                    std::uniform_real_distribution<ScalarFloat> uniform(0.f, 1.f);
+                    size_t end = std::min(count, (block + 1) * KAZEN_BENCH_BLOCK_SIZE);
+                    for (size_t i = block * KAZEN_BENCH_BLOCK_SIZE; i < end; ++i) {
+                        ScalarPoint3f o;
+                        for (int axis = 0; axis < 3; ++axis)
+                            o[axis] = bbox.min[axis] + uniform(rng) * (bbox.max[axis] - bbox.min[axis]);
+                        ScalarVector3f d;
+                        if (m_settings.distribution == EAxisRays) {
+                            /* One of the six axis directions, the other components are +0 or -0 */
+                            uint32_t axis = std::min((uint32_t) (uniform(rng) * 6.f), 5u);
+                            d = ScalarVector3f(uniform(rng) < .5f ? 0.f : -0.f);
+                            d[axis / 2] = axis % 2 == 0 ? 1.f : -1.f;
+                        } else {
+                            d = warp::squareToUniformSphere(ScalarPoint2f(uniform(rng), uniform(rng)));
+                        }
+                        m_rays[i] = ScalarRay3f(o, d, 0.f);
+                    }
+                }
+            }
+        );
+        return;
+    }
+
+    /* Bounce rays: trace camera rays and continue every hit in a cosine-distributed direction.
+       Camera rays that leave the scene are replaced by further camera rays. */
+    const Accel *accel = m_scene->getAccel();
+    m_rays.clear();
+    m_rays.reserve(count);
+    std::vector<ScalarRay3f> primary;
+    for (uint32_t pass = 0; m_rays.size() < count; ++pass) {
+        size_t remaining = count - m_rays.size();
+        generateCameraRays(primary, remaining, m_settings.seed + pass);
+        std::vector<ScalarRay3f> bounces(primary.size());
+        std::vector<uint8_t> valid(primary.size(), 0);
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, primary.size(), KAZEN_BENCH_BLOCK_SIZE),
+            [&](const tbb::blocked_range<size_t> &range) {
+                std::mt19937_64 rng(~((m_settings.seed + pass) * count + range.begin()));
+                std::uniform_real_distribution<ScalarFloat> uniform(0.f, 1.f);
+                for (size_t i = range.begin(); i != range.end(); ++i) {
+                    ScalarIntersection3f its;
+                    if (!accel->rayIntersect(primary[i], its))
+                        continue;
+                    ScalarVector3f d = warp::squareToCosineHemisphere(ScalarPoint2f(uniform(rng), uniform(rng)));
+                    if (dot(its.geoFrame.n, primary[i].d) > 0.f)
+                        d.z() = -d.z();
+                    bounces[i] = ScalarRay3f(its.p, its.geoFrame.toWorld(d), primary[i].time);
+                    valid[i] = 1;
+                }
+            }
+        );
+
+        size_t before = m_rays.size();
+        for (size_t i = 0; i < bounces.size() && m_rays.size() < count; ++i)
+            if (valid[i])
+                m_rays.push_back(bounces[i]);
+        if (m_rays.size() == before)
+            throw Exception("RayBenchmark: no camera ray hits the scene, cannot generate bounce rays");
+    }
+}
+
+void RayBenchmark::generateCameraRays(std::vector<ScalarRay3f> &rays, size_t count, uint64_t seed,
+                                      std::vector<uint32_t> *pixels) const {
+    const Camera *camera = m_scene->getCamera();
+    ScalarVector2i outputSize = camera->getOutputSize();
+    ScalarVector2f size(outputSize);
+    size_t packets = (count + Float::Size - 1) / Float::Size;
+    size_t blocks = (packets * Float::Size + KAZEN_BENCH_BLOCK_SIZE - 1) / KAZEN_BENCH_BLOCK_SIZE;
+    rays.resize(packets * Float::Size);
+    if (pixels)
+        pixels->resize(packets * Float::Size);
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, blocks, 1),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t block = range.begin(); block != range.end(); ++block) {
+                std::mt19937_64 rng(seed * blocks + block);
+                std::uniform_real_distribution<ScalarFloat> uniform(0.f, 1.f);
+                size_t end = std::min(rays.size(), (block + 1) * KAZEN_BENCH_BLOCK_SIZE);
+
+                /* The camera samples a packet of rays at once */
+                for (size_t i = block * KAZEN_BENCH_BLOCK_SIZE; i < end; i += Float::Size) {
+                    Point2f position, aperture;
+                    Float time;
+                    for (size_t j = 0; j < Float::Size; ++j) {
+                        position.x()[j] = uniform(rng) * size.x();
+                        position.y()[j] = uniform(rng) * size.y();
+                        aperture.x()[j] = uniform(rng);
+                        aperture.y()[j] = uniform(rng);
+                        time[j] = uniform(rng);
+                    }
+
+                    Ray3f ray;
+                    camera->sampleRay(ray, position, aperture, time);
+                    for (size_t j = 0; j < Float::Size; ++j) {
+                        rays[i + j] = ScalarRay3f(ScalarPoint3f(ray.o.x()[j], ray.o.y()[j], ray.o.z()[j]),
+                                                  ScalarVector3f(ray.d.x()[j], ray.d.y()[j], ray.d.z()[j]),
+                                                  ray.mint[j], ray.maxt[j], ray.time[j]);
+                        if (pixels) {
+                            uint32_t x = std::min((uint32_t) position.x()[j], (uint32_t) outputSize.x() - 1),
+                                     y = std::min((uint32_t) position.y()[j], (uint32_t) outputSize.y() - 1);
+                            (*pixels)[i + j] = y * (uint32_t) outputSize.x() + x;
+                        }
+                    }
+                }
+            }
+        }
+    );
+    rays.resize(count);
+    if (pixels)
+        pixels->resize(count);
+}
+
+void RayBenchmark::loadRays(const std::string &filename) {
+    std::ifstream is(filename, std::ios::binary | std::ios::ate);
+    if (!is)
+        throw Exception("RayBenchmark: unable to open ray file \"{}\"", filename);
+
+    size_t size = (size_t) is.tellg();
+    if (size % sizeof(RayRecord) != 0)
+        throw Exception("RayBenchmark: \"{}\" is not a ray file (size {} is not a multiple of {})",
+                        filename, size, sizeof(RayRecord));
+
+    std::vector<RayRecord> records(size / sizeof(RayRecord));
+    is.seekg(0);
+    is.read((char *) records.data(), size);
+    if (!is)
+        throw Exception("RayBenchmark: error while reading \"{}\"", filename);
+
+    m_rays.resize(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        const RayRecord &r = records[i];
+        m_rays[i] = ScalarRay3f(ScalarPoint3f(r.o[0], r.o[1], r.o[2]), ScalarVector3f(r.d[0], r.d[1], r.d[2]),
+                                r.mint, r.maxt, r.time);
+    }
+}
+
+void RayBenchmark::saveRays(const std::string &filename) const {
+    std::vector<RayRecord> records(m_rays.size());
+    for (size_t i = 0; i < m_rays.size(); ++i) {
+        const ScalarRay3f &ray = m_rays[i];
+        records[i] = { { ray.o.x(), ray.o.y(), ray.o.z() }, { ray.d.x(), ray.d.y(), ray.d.z() },
+                       ray.mint, ray.maxt, ray.time };
+    }
+
+    std::ofstream os(filename, std::ios::binary);
+    os.write((const char *) records.data(), records.size() * sizeof(RayRecord));
+    if (!os)
+        throw Exception("RayBenchmark: unable to write ray file \"{}\"", filename);
+}
+
+size_t RayBenchmark::verify() const {
+    const Accel *accel = m_scene->getAccel();
+    std::atomic<size_t> mismatches { 0 };
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_rays.size(), KAZEN_BENCH_BLOCK_SIZE),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i < range.end(); i += Float::Size) {
+                size_t count = std::min((size_t) Float::Size, range.end() - i);
+
+                Ray3f ray;
+                Mask active = false;
+                for (size_t j = 0; j < count; ++j) {
+                    const ScalarRay3f &r = m_rays[i + j];
+                    for (size_t k = 0; k < 3; ++k) {
+                        ray.o[k][j] = r.o[k];
+                        ray.d[k][j] = r.d[k];
+                        ray.dRcp[k][j] = r.dRcp[k];
+                    }
+                    ray.mint[j] = r.mint;
+                    ray.maxt[j] = r.maxt;
+                    ray.time[j] = r.time;
+                    active[j] = true;
+                }
+                Intersection3f its;
+                Mask hitPacket = accel->rayIntersect(ray, its, false, active),
+                     occludedPacket = accel->rayTest(ray, active);
+
+                for (size_t j = 0; j < count; ++j) {
+                    ScalarIntersection3f its1;
+                    bool hit = accel->rayIntersect(m_rays[i + j], its1),
+                         occluded = accel->rayTest(m_rays[i + j]);
+
+                    bool consistent = hit == (bool) hitPacket[j] && hit == occluded &&
+                                      hit == (bool) occludedPacket[j];
+                    if (consistent && hit)
+                        consistent = std::abs(its1.t - its.t[j]) <= 1e-4f * std::max(1.f, its1.t);
+                    if (!consistent)
+                        mismatches++;
+                }
+            }
+        }
+    );
+    return mismatches;
+}
+
+#if defined(KAZEN_ENABLE_ACCEL_STATS)
+void RayBenchmark::saveHeatmap(const std::string &filename) const {
+    if (m_pixels.size() != m_rays.size())
+        throw Exception("RayBenchmark: a heatmap needs generated camera rays");
+
+    const Accel *accel = m_scene->getAccel();
+    ScalarVector2i size = m_scene->getCamera()->getOutputSize();
+    size_t pixelCount = size.x() * (size_t) size.y();
+
+    /* Every thread sums up the cost and the number of rays of each pixel on its own */
+    struct PixelCost {
+        std::vector<double> cost;
+        std::vector<uint32_t> rays;
+    };
+    tbb::enumerable_thread_specific<PixelCost> buffers([pixelCount] {
+        return PixelCost { std::vector<double>(pixelCount, 0.), std::vector<uint32_t>(pixelCount, 0u) };
+    });
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_rays.size(), KAZEN_BENCH_BLOCK_SIZE),
+        [&](const tbb::blocked_range<size_t> &range) {
+            PixelCost &buffer = buffers.local();
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                AccelStatistics before = Accel::getThreadStatistics();
+                ScalarIntersection3f its;
+                accel->rayIntersect(m_rays[i], its);
+                buffer.cost[m_pixels[i]] += (double) (Accel::getThreadStatistics() - before).cost();
+                buffer.rays[m_pixels[i]]++;
+            }
+        }
+    );
+
+    std::vector<double> cost(pixelCount, 0.);
+    std::vector<uint32_t> rays(pixelCount, 0u);
+    for (const PixelCost &buffer : buffers) {
+        for (size_t i = 0; i < pixelCount; ++i) {
+            cost[i] += buffer.cost[i];
+            rays[i] += buffer.rays[i];
+        }
+    }
+
+    std::vector<ScalarFloat> average(pixelCount, 0.f);
+    for (size_t i = 0; i < pixelCount; ++i)
+        average[i] = rays[i] > 0 ? (ScalarFloat) (cost[i] / rays[i]) : 0.f;
+    Renderer::saveTraversalCost(average, size, filename);
+}
+#endif
+
+double RayBenchmark::measure(int threads, bool occlusion, ETraceMode mode) const {
+    const Accel *accel = m_scene->getAccel();
+    tbb::enumerable_thread_specific<RayStream> streams([accel] { return RayStream(accel); });
+
+    auto pass = [&]() {
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, m_rays.size(), KAZEN_BENCH_BLOCK_SIZE),
+            [&](const tbb::blocked_range<size_t> &range) {
+                if (mode == EStreams) {
+                    /* The stream of a thread is reused, so that its buffers are only allocated once */
+                    RayStream &stream = streams.local();
+                    stream.clear();
+                    for (size_t i = range.begin(); i != range.end(); ++i)
+                        stream.push(m_rays[i]);
+                    stream.trace(occlusion);
+                } else if (mode == ESingleRays) {
+                    for (size_t i = range.begin(); i != range.end(); ++i) {
+                        ScalarIntersection3f its;
+                        if (occlusion)
+                            accel->rayTest(m_rays[i]);
+                        else
+                            accel->rayIntersect(m_rays[i], its);
+                    }
+                } else {
+                    /* Consecutive rays form a packet, the last one may be partially filled */
+                    for (size_t i = range.begin(); i < range.end(); i += Float::Size) {
+                        Ray3f ray;
+                        Mask active = false;
+                        for (size_t j = 0; j < Float::Size && i + j < range.end(); ++j) {
+                            const ScalarRay3f &r = m_rays[i + j];
+                            for (size_t k = 0; k < 3; ++k) {
+                                ray.o[k][j] = r.o[k];
+                                ray.d[k][j] = r.d[k];
+                                ray.dRcp[k][j] = r.dRcp[k];
+                            }
+                            ray.mint[j] = r.mint;
+                            ray.maxt[j] = r.maxt;
+                            ray.time[j] = r.time;
+                            active[j] = true;
+                        }
+                        Intersection3f its;
+                        if (occlusion)
+                            accel->rayTest(ray, active);
+                        else
+                            accel->rayIntersect(ray, its, false, active);
+                    }
+                }
+            }
+        );
+    };
+
+    tbb::task_arena arena(threads);
+    double best = std::numeric_limits<double>::infinity();
+    arena.execute([&] {
+        /* Untimed pass to warm up the caches and the thread pool */
+        pass();
+        for (uint32_t i = 0; i < std::max(m_settings.repetitions, 1u); ++i) {
+            auto start = std::chrono::steady_clock::now();
+            pass();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+    });
+    return best;
+}
+
+std::string RayBenchmark::run() const {
+    const Accel *accel = m_scene->getAccel();
+    double mrays = (double) m_rays.size() * 1e-6;
+
+    std::string results;
+    for (size_t i = 0; i < m_settings.threadCounts.size(); ++i) {
+        int threads = m_settings.threadCounts[i];
+        results += fmt::format(
+            "    {{ \"threads\": {}, \"closestHit\": {:.3f}, \"occlusion\": {:.3f}, "
+            "\"closestHitPacket\": {:.3f}, \"occlusionPacket\": {:.3f}, "
+            "\"closestHitStream\": {:.3f}, \"occlusionStream\": {:.3f} }}{}\n",
+            threads,
+            mrays / measure(threads, false, ESingleRays),
+            mrays / measure(threads, true, ESingleRays),
+            mrays / measure(threads, false, EPackets),
+            mrays / measure(threads, true, EPackets),
+            mrays / measure(threads, false, EStreams),
+            mrays / measure(threads, true, EStreams),
+            i + 1 < m_settings.threadCounts.size() ? "," : "");
+    }
+
+    return fmt::format(
+        "{{\n"
+        "  \"scene\": {{ \"primitives\": {}, \"triangles\": {}, \"particles\": {}, \"instances\": {}, "
+        "\"nodes\": {}, \"memory\": {}, \"backend\": \"{}\" }},\n"
+        "  \"rays\": {{ \"distribution\": \"{}\", \"count\": {}, \"repetitions\": {} }},\n"
+        "  \"unit\": \"Mrays/s\",\n"
+        "  \"results\": [\n"
+        "{}"
+        "  ]\n"
+        "}}",
+        accel->getPrimitiveCount(), accel->getTriangleCount(), accel->getParticleCount(),
+        accel->getInstanceCount(), accel->getNodeCount(), accel->getMemoryUsage(),
+        accel->usesEmbree() ? "embree" : "kazen",
+        m_settings.rayFile.empty() ? distributionName(m_settings.distribution) : "recorded",
+        m_rays.size(), m_settings.repetitions,
+        results
+    );
+}
+
+std::string RayBenchmark::toString() const {
+    return fmt::format(
+        "RayBenchmark[\n"
+        "  distribution = {},\n"
+        "  rays = {},\n"
+        "  repetitions = {}\n"
+        "]",
+        m_settings.rayFile.empty() ? distributionName(m_settings.distribution) : m_settings.rayFile,
+        m_rays.size(),
+        m_settings.repetitions
+    );
+}
+
+int benchRays(int argc, char **argv) {
+    const char *usage =
+        "Usage: kazen --bench-rays <scene.xml> [options]\n"
+        "  --rays <n>             Number of rays (default: 1048576)\n"
+        "  --distribution <name>  camera, sphere, bounce or axis (default: camera)\n"
+        "  --threads <n,m,..>     Thread counts (default: powers of two up to all cores)\n"
+        "  --repetitions <n>      Timed passes per measurement (default: 3)\n"
+        "  --seed <n>             Seed of the ray generator (default: 0)\n"
+        "  --load-rays <file>     Replay recorded rays instead of generating them\n"
+        "  --record-rays <file>   Store the benchmarked rays\n"
+        "  --verify               Check that all kernels agree, fail otherwise\n"
+        "  --heatmap <file>       Write the traversal cost of camera rays per pixel\n"
+        "                         (needs a build with KAZEN_ENABLE_ACCEL_STATS)\n"
+        "  --output <file>        Write the JSON result to a file instead of stdout\n";
+
+    RayBenchmark::Settings settings;
+    std::string sceneFile, outputFile;
+
+    try {
+        for (int i = 0; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc)
+                    throw Exception("Missing value after \"{}\"", arg);
+                return argv[++i];
+            };
+
+            if (arg == "--rays") {
+                settings.rayCount = (size_t) std::stoull(value());
+            } else if (arg == "--distribution") {
+                std::string name = value();
+                if (name == "camera")
+                    settings.distribution = RayBenchmark::ECameraRays;
+                else if (name == "sphere")
+                    settings.distribution = RayBenchmark::ESphereRays;
+                else if (name == "bounce")
+                    settings.distribution = RayBenchmark::EBounceRays;
+                else if (name == "axis")
+                    settings.distribution = RayBenchmark::EAxisRays;
+                else
+                    throw Exception("Unknown ray distribution \"{}\"", name);
+            } else if (arg == "--threads") {
+                settings.threadCounts = parseThreadCounts(value());
+            } else if (arg == "--repetitions") {
+                settings.repetitions = (uint32_t) std::stoul(value());
+            } else if (arg == "--seed") {
+                settings.seed = (uint64_t) std::stoull(value());
+            } else if (arg == "--load-rays") {
+                settings.rayFile = value();
+            } else if (arg == "--record-rays") {
+                settings.recordFile = value();
+            } else if (arg == "--heatmap") {
+                settings.heatmapFile = value();
+            } else if (arg == "--verify") {
+                settings.verify = true;
+            } else if (arg == "--output") {
+                outputFile = value();
+            } else if (sceneFile.empty() && arg.rfind("--", 0) != 0) {
+                sceneFile = arg;
+            } else {
+                throw Exception("Unknown argument \"{}\"", arg);
+            }
+        }
+        if (sceneFile.empty())
+            throw Exception("No scene file was specified");
+        if (settings.rayCount == 0)
+            throw Exception("The number of rays must be positive");
+        if (!settings.heatmapFile.empty()) {
+#if defined(KAZEN_ENABLE_ACCEL_STATS)
+            if (settings.distribution != RayBenchmark::ECameraRays || !settings.rayFile.empty())
+                throw Exception("--heatmap needs generated camera rays");
+#else
+            throw Exception("--heatmap needs a build with KAZEN_ENABLE_ACCEL_STATS");
+#endif
+        }
+
+        /* Progress messages go to stderr, so that stdout only holds the JSON result */
+        std::streambuf *coutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+        std::unique_ptr<Object> root(loadFromXML(sceneFile));
+        std::cout.rdbuf(coutBuffer);
+        if (!root || root->getClassType() != Object::EScene)
+            throw Exception("\"{}\" does not describe a scene", sceneFile);
+        const Scene *scene = static_cast<const Scene *>(root.get());
+
+        Timer timer;
+        RayBenchmark benchmark(scene, settings);
+        std::cerr << "Prepared " << benchmark.getRayCount() << " rays (took "
+                  << timer.elapsedString() << ")." << std::endl;
+
+        if (settings.verify) {
+            std::cerr << "Verifying .. " << std::flush;
+            size_t mismatches = benchmark.verify();
+            if (mismatches > 0) {
+                std::cerr << "failed: the kernels disagree on " << mismatches << " of "
+                          << benchmark.getRayCount() << " rays." << std::endl;
+                return 1;
+            }
+            std::cerr << "done." << std::endl;
+        }
+
+#if defined(KAZEN_ENABLE_ACCEL_STATS)
+        if (!settings.heatmapFile.empty()) {
+            /* Keep the progress messages of the bitmap out of stdout as well */
+            std::streambuf *coutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+            benchmark.saveHeatmap(settings.heatmapFile);
+            std::cout.rdbuf(coutBuffer);
+        }
+#endif
+
+        std::cerr << "Benchmarking .. " << std::flush;
+        std::string result = benchmark.run();
+        std::cerr << "done." << std::endl;
+
+        if (outputFile.empty()) {
+            std::cout << result << std::endl;
+        } else {
+            std::ofstream os(outputFile);
+            os << result << std::endl;
+            if (!os)
+                throw Exception("Unable to write \"{}\"", outputFile);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl << usage;
+        return 1;
+    }
+
+    return 0;
+}
+
+NAMESPACE_END(kazen)
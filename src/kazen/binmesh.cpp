@@ -0,0 +1,247 @@
+#include <kazen/binmesh.h>
+#include <kazen/timer.h>
+#include <kazen/transform.h>
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+
+/* Version of the binary mesh format, must be increased whenever the layout changes */
+#define KAZEN_BINARY_MESH_VERSION 1
+/* Alignment and padding of the arrays stored in a binary mesh file (a multiple of the packet size) */
+#define KAZEN_BINARY_MESH_ALIGNMENT 64
+
+NAMESPACE_BEGIN(kazen)
+
+NAMESPACE_BEGIN()
+    /// Header of a binary mesh file, followed by the vertex and face arrays
+    struct BinaryMeshHeader {
+        char magic[4];              ///< "KMSH"
+        uint32_t version;           ///< \ref KAZEN_BINARY_MESH_VERSION
+        uint32_t flags;             ///< Combination of \ref EBinaryMeshFlags
+        uint32_t vertexCount;       ///< Number of vertices
+        uint32_t faceCount;         ///< Number of triangles
+        float bboxMin[3];           ///< Bounds of the vertex positions
+        float bboxMax[3];
+        uint64_t positionOffset;    ///< Offset of the positions (3 floats per vertex) in bytes
+        uint64_t normalOffset;      ///< Offset of the normals (3 floats per vertex) in bytes
+        uint64_t texCoordOffset;    ///< Offset of the texture coordinates (2 floats per vertex) in bytes
+        uint64_t faceOffset;        ///< Offset of the face indices (3 per triangle) in bytes
+        uint64_t fileSize;          ///< Size of the complete file in bytes
+    };
+
+    enum EBinaryMeshFlags : uint32_t {
+        EHasNormals   = 1,
+        EHasTexCoords = 2
+    };
+
+    inline uint64_t alignMeshOffset(uint64_t offset) {
+        return (offset + KAZEN_BINARY_MESH_ALIGNMENT - 1) / KAZEN_BINARY_MESH_ALIGNMENT * KAZEN_BINARY_MESH_ALIGNMENT;
+    }
+NAMESPACE_END()
+
+BinaryMesh::BinaryMesh(const PropertyList &props) {
+    std::string filename = props.getString("filename");
+    m_name = filename;
+    m_compressAttributes = props.getBool("compressAttributes", false);
+    m_weldVertices = props.getBool("weldVertices", false);
+    m_weldTolerance = props.getFloat("weldTolerance", 0.f);
+    m_reorderForLocality = props.getBool("reorderForLocality", false);
+
+    Timer timer;
+
+    /* The mapping is copy-on-write, so that the mesh can still be transformed or deformed */
+    m_file.reset(new MemoryMappedFile(filename, true));
+    if (m_file->size() < sizeof(BinaryMeshHeader))
+        throw Exception("BinaryMesh: \"{}\" is too small to be a binary mesh", filename);
+
+    const BinaryMeshHeader &header = *(const BinaryMeshHeader *) m_file->data();
+    if (memcmp(header.magic, "KMSH", 4) != 0)
+        throw Exception("BinaryMesh: \"{}\" is not a binary mesh", filename);
+    if (header.version != KAZEN_BINARY_MESH_VERSION)
+        throw Exception("BinaryMesh: \"{}\" has version {}, expected version {} (convert it again)",
+                        filename, header.version, KAZEN_BINARY_MESH_VERSION);
+
+    bool hasNormals = (header.flags & EHasNormals) != 0,
+         hasTexCoords = (header.flags & EHasTexCoords) != 0;
+    uint64_t vertexCount = header.vertexCount, faceCount = header.faceCount;
+
+    /* Every array must be aligned and lie completely within the file, including its padding */
+    auto valid = [&](uint64_t offset, uint64_t size) {
+        return offset % KAZEN_BINARY_MESH_ALIGNMENT == 0 &&
+               offset >= sizeof(BinaryMeshHeader) &&
+               offset + alignMeshOffset(size) <= m_file->size();
+    };
+    if (header.fileSize != m_file->size() ||
+        !valid(header.positionOffset, vertexCount * 3 * sizeof(InputFloat)) ||
+        (hasNormals && !valid(header.normalOffset, vertexCount * 3 * sizeof(InputFloat))) ||
+        (hasTexCoords && !valid(header.texCoordOffset, vertexCount * 2 * sizeof(InputFloat))) ||
+        !valid(header.faceOffset, faceCount * 3 * sizeof(uint32_t)))
+        throw Exception("BinaryMesh: \"{}\" is truncated or corrupt", filename);
+
+    /* Point the mesh buffers at the mapped arrays without copying them */
+    uint8_t *data = (uint8_t *) m_file->data();
+    m_vertexCount = header.vertexCount;
+    m_faceCount = header.faceCount;
+    m_V = FloatStorage::map(data + header.positionOffset, vertexCount * 3);
+    if (hasNormals)
+        m_N = FloatStorage::map(data + header.normalOffset, vertexCount * 3);
+    if (hasTexCoords)
+        m_UV = FloatStorage::map(data + header.texCoordOffset, vertexCount * 2);
+    m_F = DynamicBuffer<UInt32>::map(data + header.faceOffset, faceCount * 3);
+    m_bbox = ScalarBoundingBox3f(ScalarPoint3f(header.bboxMin[0], header.bboxMin[1], header.bboxMin[2]),
+                                 ScalarPoint3f(header.bboxMax[0], header.bboxMax[1], header.bboxMax[2]));
+
+    /* Face indices are used without further checks. Scanning them reads all of
+       their pages, so this is only done on request for untrusted files. */
+    if (props.getBool("validate", false)) {
+        const uint32_t *F = (const uint32_t *) m_F.data();
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, faceCount * 3, 1 << 16),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i != range.end(); ++i) {
+                    if (F[i] >= vertexCount)
+                        throw Exception("BinaryMesh: face index out of range in \"{}\"", filename);
+                }
+            }
+        );
+    }
+
+    if (props.hasProperty("toWorld")) {
+        ScalarTransform4f toWorld = props.getTransform("toWorld");
+        InputFloat *V = (InputFloat *) m_V.data(),
+                   *N = hasNormals ? (InputFloat *) m_N.data() : nullptr;
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, vertexCount, 1 << 14),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i != range.end(); ++i) {
+                    ScalarPoint3f p = toWorld * ScalarPoint3f(V[3 * i], V[3 * i + 1], V[3 * i + 2]);
+                    for (int k = 0; k < 3; ++k)
+                        V[3 * i + k] = p[k];
+                    if (N) {
+                        ScalarNormal3f n = normalize(toWorld * ScalarNormal3f(N[3 * i], N[3 * i + 1], N[3 * i + 2]));
+                        for (int k = 0; k < 3; ++k)
+                            N[3 * i + k] = n[k];
+                    }
+                }
+            }
+        );
+        updateBoundingBox();
+    }
+
+    std::cout << "Mapped \"" << filename << "\" (" << m_faceCount << " triangles, " << m_vertexCount
+              << " vertices, " << util::memString(m_file->size()) << ", took " << timer.elapsedString()
+              << ")." << std::endl;
+
+    loadKeyFrames(props, "kmesh");
+}
+
+void BinaryMesh::write(const Mesh *mesh, const std::string &filename) {
+    if (mesh->hasCompressedAttributes())
+        throw Exception("BinaryMesh::write(): \"{}\" has compressed attributes, which the format does not store",
+                        mesh->getName());
+    if (mesh->getTimeStepCount() > 1)
+        throw Exception("BinaryMesh::write(): \"{}\" has {} key frames, but the format stores a single one "
+                        "(convert every key frame separately and list them in \"keyFrames\")",
+                        mesh->getName(), mesh->getTimeStepCount());
+
+    uint64_t vertexCount = mesh->getVertexCount(), faceCount = mesh->getFaceCount();
+    bool hasNormals = mesh->hasVertexNormals(), hasTexCoords = mesh->hasVertexTexCoords();
+
+    BinaryMeshHeader header;
+    memset(&header, 0, sizeof(BinaryMeshHeader));
+    memcpy(header.magic, "KMSH", 4);
+    header.version = KAZEN_BINARY_MESH_VERSION;
+    header.flags = (hasNormals ? EHasNormals : 0) | (hasTexCoords ? EHasTexCoords : 0);
+    header.vertexCount = mesh->getVertexCount();
+    header.faceCount = mesh->getFaceCount();
+    for (int i = 0; i < 3; ++i) {
+        header.bboxMin[i] = mesh->bbox().min[i];
+        header.bboxMax[i] = mesh->bbox().max[i];
+    }
+
+    /* Missing attributes occupy no space, their offset equals the one of the next array */
+    struct Section {
+        const void *data;
+        uint64_t size;
+        uint64_t *offset;
+    } sections[] = {
+        { mesh->getVertexPositions().data(), vertexCount * 3 * sizeof(InputFloat), &header.positionOffset },
+        { hasNormals ? mesh->getVertexNormals().data() : nullptr,
+          hasNormals ? vertexCount * 3 * sizeof(InputFloat) : 0, &header.normalOffset },
+        { hasTexCoords ? mesh->getVertexTexCoords().data() : nullptr,
+          hasTexCoords ? vertexCount * 2 * sizeof(InputFloat) : 0, &header.texCoordOffset },
+        { mesh->getIndices().data(), faceCount * 3 * sizeof(uint32_t), &header.faceOffset }
+    };
+    uint64_t offset = alignMeshOffset(sizeof(BinaryMeshHeader));
+    for (Section &section : sections) {
+        *section.offset = offset;
+        offset = alignMeshOffset(offset + section.size);
+    }
+    header.fileSize = offset;
+
+    /* Write to a temporary file that is renamed at the end, so that
+       readers never observe a partially written mesh */
+    std::string tempName = fmt::format("{}.{:08x}.tmp", filename, std::random_device()());
+    std::ofstream os(tempName, std::ios::binary);
+    if (!os)
+        throw Exception("BinaryMesh::write(): could not create \"{}\"", tempName);
+
+    const char padding[KAZEN_BINARY_MESH_ALIGNMENT] = { };
+    os.write((const char *) &header, sizeof(BinaryMeshHeader));
+    uint64_t position = sizeof(BinaryMeshHeader);
+    for (const Section &section : sections) {
+        os.write(padding, (std::streamsize) (*section.offset - position));
+        os.write((const char *) section.data, (std::streamsize) section.size);
+        position = *section.offset + section.size;
+    }
+    os.write(padding, (std::streamsize) (header.fileSize - position));
+    os.close();
+
+    if (!os || std::rename(tempName.c_str(), filename.c_str()) != 0) {
+        std::remove(tempName.c_str());
+        throw Exception("BinaryMesh::write(): could not write \"{}\"", filename);
+    }
+}
+
+int convertMesh(int argc, char **argv) {
+    bool reorder = false;
+    if (argc > 0 && std::string(argv[0]) == "--reorder") {
+        reorder = true;
+        argc--;
+        argv++;
+    }
+    if (argc != 2) {
+        std::cerr << "Syntax: kazen --convert-mesh [--reorder] <input.obj> <output.kmesh>" << std::endl;
+        return 1;
+    }
+    std::string input = argv[0], output = argv[1];
+
+    std::string extension = input.substr(std::min(input.rfind('.'), input.size()));
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension != ".obj") {
+        std::cerr << "Unsupported mesh format \"" << extension << "\" (expected .obj)" << std::endl;
+        return 1;
+    }
+
+    try {
+        PropertyList props;
+        props.setString("filename", input);
+        std::unique_ptr<Mesh> mesh(static_cast<Mesh *>(ObjectFactory::createInstance("obj", props)));
+
+        Timer timer;
+        if (reorder)
+            mesh->reorderForLocality();
+        BinaryMesh::write(mesh.get(), output);
+        std::cout << "Wrote \"" << output << "\" (took " << timer.elapsedString() << ")." << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+KAZEN_REGISTER_CLASS(BinaryMesh, "kmesh");
+NAMESPACE_END(kazen)
@@ -18,6 +18,12 @@ void Bitmap::clear() {
     memset(m_data.get(), 0, bufferSize());
 }
 
+void Bitmap::setPixel(const ScalarPoint2i &p, const ScalarColor3f &value) {
+    ScalarFloat *pixel = m_data.get() + (p.y() * (size_t) m_size.x() + p.x()) * KAZEN_BITMAP_CHANNEL_COUNT;
+    for (int i = 0; i < KAZEN_BITMAP_CHANNEL_COUNT; ++i)
+        pixel[i] = value[i];
+}
+
 size_t Bitmap::bufferSize() const {
     return pixelCount() * KAZEN_BITMAP_CHANNEL_COUNT * sizeof(ScalarFloat);
 }
@@ -35,9 +41,9 @@ void Bitmap::savePNG(const std::string &filename) {
 
     uint8_t *rgb8 = new uint8_t[3 * pixelCount()];
     uint8_t *dst = rgb8;
-    for (int i = 0; i <  m_size.x(); ++i) {
-        for (int j = 0; j <  m_size.y(); ++j) {
-            auto index = i * m_size.x() + m_size.y();
+    for (int j = 0; j < m_size.y(); ++j) {
+        for (int i = 0; i < m_size.x(); ++i) {
+            auto index = (j * (size_t) m_size.x() + i) * KAZEN_BITMAP_CHANNEL_COUNT;
             dst[0] = (uint8_t) std::clamp(255.f * enoki::linear_to_srgb(m_data[index]), 0.f, 255.f);
             dst[1] = (uint8_t) std::clamp(255.f * enoki::linear_to_srgb(m_data[index+1]), 0.f, 255.f);
             dst[2] = (uint8_t) std::clamp(255.f * enoki::linear_to_srgb(m_data[index+2]), 0.f, 255.f);
@@ -9,6 +9,10 @@ NAMESPACE_BEGIN(kazen)
  *
  * This class implements a simple perspective camera model. It uses an
  * infinitesimally small aperture, creating an infinite depth of field.
+ *
+ * The shutter is open between the times \c shutterOpen and \c shutterClose
+ * (default: 0 and 1), on the normalized time axis of \ref Ray::time along
+ * which the key frames of moving meshes are spread.
  */
 class PerspectiveCamera final : public Camera {
 public:
@@ -19,7 +23,7 @@ public:
         /* Width and height in pixels. Default: 720p */
         m_outputSize.x() = propList.getInt("width", 1280);
         m_outputSize.y() = propList.getInt("height", 720);
-        m_invOutputSize = enoki::rcp(m_outputSize);
+        m_invOutputSize = ScalarVector2f(1.f / m_outputSize.x(), 1.f / m_outputSize.y());
 
         /* Specifies an optional camera-to-world transformation. Default: none */
         m_cameraToWorld = propList.getTransform("toWorld", ScalarTransform4f());
@@ -31,6 +35,12 @@ public:
         m_nearClip = propList.getFloat("nearClip", 1e-4f);
         m_farClip = propList.getFloat("farClip", 1e4f);
 
+        /* Shutter interval on the normalized time axis of the key frames */
+        m_shutterOpen = propList.getFloat("shutterOpen", 0.f);
+        m_shutterClose = propList.getFloat("shutterClose", 1.f);
+        if (m_shutterClose < m_shutterOpen)
+            throw Exception("PerspectiveCamera: the shutter closes before it opens!");
+
         m_rfilter = nullptr;
     }
 
@@ -49,8 +59,8 @@ public:
          * range from zero to one. Also takes the aspect ratio into account.
          */
         m_sampleToCamera = 
-            ScalarTransform4f::scale(Vector3f(-0.5f, -0.5f * aspect, 1.f)) *
-            ScalarTransform4f::translate(Vector3f(-1.f, -1.f / aspect, 0.f)) * 
+            ScalarTransform4f::scale(ScalarVector3f(-0.5f, -0.5f * aspect, 1.f)) *
+            ScalarTransform4f::translate(ScalarVector3f(-1.f, -1.f / aspect, 0.f)) * 
             ScalarTransform4f::perspective(m_fov, m_nearClip, m_farClip);
 
         /* If no reconstruction filter was assigned, instantiate a Gaussian filter */
@@ -62,7 +72,7 @@ public:
     Color3f sampleRay(Ray3f &ray,
             const Point2f &samplePosition,
             const Point2f &apertureSample,
-            Mask mask=true) const {
+            const Float &timeSample) const {
         /* Compute the corresponding position on the near plane (in local camera space) */
         Point3f nearP = m_sampleToCamera * Point3f(
             samplePosition.x() * m_invOutputSize.x(),
@@ -70,12 +80,13 @@ public:
 
         /* Turn into a normalized ray direction, and adjust the ray interval accordingly */
         Vector3f d = normalize(Vector3f(nearP));
-        float invZ = enoki::rcp(d.z());
+        Float invZ = enoki::rcp(d.z());
 
-        ray.o = m_cameraToWorld.translation();
+        ray.o = Point3f(m_cameraToWorld.translation());
         ray.d = m_cameraToWorld * d;
         ray.mint = m_nearClip * invZ;
         ray.maxt = m_farClip * invZ;
+        ray.time = m_shutterOpen + timeSample * (m_shutterClose - m_shutterOpen);
         ray.update();
 
         return Color3f(1.0f);
@@ -95,10 +106,15 @@ public:
 
     /// Return a human-readable summary
     std::string toString() const {
-        using string::indent;
-        oss << "PerspectiveCamera[]" << '\n'
-            << "]";
-        return oss.str();
+        return fmt::format(
+            "PerspectiveCamera[\n"
+            "  outputSize = {}x{},\n"
+            "  fov = {},\n"
+            "  clip = [{}, {}],\n"
+            "  shutter = [{}, {}]\n"
+            "]",
+            m_outputSize.x(), m_outputSize.y(), m_fov, m_nearClip, m_farClip,
+            m_shutterOpen, m_shutterClose);
     }
 private:
     ScalarVector2f m_invOutputSize;
@@ -107,6 +123,8 @@ private:
     ScalarFloat m_fov;
     ScalarFloat m_nearClip;
     ScalarFloat m_farClip;
+    ScalarFloat m_shutterOpen;
+    ScalarFloat m_shutterClose;
 };
 
 KAZEN_REGISTER_CLASS(PerspectiveCamera, "perspective");
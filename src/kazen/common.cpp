@@ -102,6 +102,17 @@ NAMESPACE_BEGIN(util)
             KAZEN_AUTHORS
         );
     }
+
+    // hash
+    uint64_t hash(const void *data, size_t size, uint64_t seed) {
+        const uint8_t *bytes = (const uint8_t *) data;
+        uint64_t result = seed;
+        for (size_t i = 0; i < size; ++i) {
+            result ^= bytes[i];
+            result *= 0x100000001b3ull;
+        }
+        return result;
+    }
 NAMESPACE_END(util)
 
 
@@ -0,0 +1,344 @@
+#include <kazen/embree.h>
+
+#include <embree3/rtcore.h>
+
+NAMESPACE_BEGIN(kazen)
+
+NAMESPACE_BEGIN()
+    /// Embree ray packet types matching a packet width
+    template <size_t Size> struct EmbreePacket { static constexpr bool Supported = false; };
+
+    template <> struct EmbreePacket<4> {
+        static constexpr bool Supported = true;
+        using Ray = RTCRay4;
+        using RayHit = RTCRayHit4;
+        static void intersect(const int *valid, RTCScene scene, RTCIntersectContext *context, RayHit *rayHit) {
+            rtcIntersect4(valid, scene, context, rayHit);
+        }
+        static void occluded(const int *valid, RTCScene scene, RTCIntersectContext *context, Ray *ray) {
+            rtcOccluded4(valid, scene, context, ray);
+        }
+    };
+
+    template <> struct EmbreePacket<8> {
+        static constexpr bool Supported = true;
+        using Ray = RTCRay8;
+        using RayHit = RTCRayHit8;
+        static void intersect(const int *valid, RTCScene scene, RTCIntersectContext *context, RayHit *rayHit) {
+            rtcIntersect8(valid, scene, context, rayHit);
+        }
+        static void occluded(const int *valid, RTCScene scene, RTCIntersectContext *context, Ray *ray) {
+            rtcOccluded8(valid, scene, context, ray);
+        }
+    };
+
+    template <> struct EmbreePacket<16> {
+        static constexpr bool Supported = true;
+        using Ray = RTCRay16;
+        using RayHit = RTCRayHit16;
+        static void intersect(const int *valid, RTCScene scene, RTCIntersectContext *context, RayHit *rayHit) {
+            rtcIntersect16(valid, scene, context, rayHit);
+        }
+        static void occluded(const int *valid, RTCScene scene, RTCIntersectContext *context, Ray *ray) {
+            rtcOccluded16(valid, scene, context, ray);
+        }
+    };
+
+    inline void setRay(RTCRay &target, const EmbreeAccel::ScalarRay3f &ray) {
+        target.org_x = ray.o.x(); target.org_y = ray.o.y(); target.org_z = ray.o.z();
+        target.dir_x = ray.d.x(); target.dir_y = ray.d.y(); target.dir_z = ray.d.z();
+        target.tnear = ray.mint;
+        target.tfar = ray.maxt;
+        target.time = ray.time;
+        target.mask = (unsigned) -1;
+        target.id = 0;
+        target.flags = 0;
+    }
+
+    template <typename RayN>
+    void setRay(RayN &target, const EmbreeAccel::Ray3f &ray, size_t i) {
+        target.org_x[i] = ray.o.x()[i]; target.org_y[i] = ray.o.y()[i]; target.org_z[i] = ray.o.z()[i];
+        target.dir_x[i] = ray.d.x()[i]; target.dir_y[i] = ray.d.y()[i]; target.dir_z[i] = ray.d.z()[i];
+        target.tnear[i] = ray.mint[i];
+        target.tfar[i] = ray.maxt[i];
+        target.time[i] = ray.time[i];
+        target.mask[i] = (unsigned) -1;
+        target.id[i] = (unsigned) i;
+        target.flags[i] = 0;
+    }
+
+    /// Extract a single ray from a packet
+    inline EmbreeAccel::ScalarRay3f getRay(const EmbreeAccel::Ray3f &ray, size_t i) {
+        return EmbreeAccel::ScalarRay3f(EmbreeAccel::ScalarPoint3f(ray.o.x()[i], ray.o.y()[i], ray.o.z()[i]),
+                                        EmbreeAccel::ScalarVector3f(ray.d.x()[i], ray.d.y()[i], ray.d.z()[i]),
+                                        ray.mint[i], ray.maxt[i], ray.time[i]);
+    }
+NAMESPACE_END()
+
+EmbreeAccel::EmbreeAccel() {
+    m_device = rtcNewDevice(nullptr);
+    if (!m_device)
+        throw Exception("EmbreeAccel: could not create an Embree device (error {})", (int) rtcGetDeviceError(nullptr));
+}
+
+EmbreeAccel::~EmbreeAccel() {
+    for (RTCGeometry geometry : m_instanceGeometries)
+        rtcReleaseGeometry(geometry);
+    for (Geometry &geometry : m_geometries)
+        rtcReleaseGeometry(geometry.geometry);
+    for (auto &[mesh, scene] : m_bottomLevel)
+        rtcReleaseScene(scene);
+    if (m_scene)
+        rtcReleaseScene(m_scene);
+    rtcReleaseDevice(m_device);
+}
+
+void EmbreeAccel::checkError(const char *operation) const {
+    RTCError error = rtcGetDeviceError(m_device);
+    if (error != RTC_ERROR_NONE)
+        throw Exception("EmbreeAccel: {} failed (error {})", operation, (int) error);
+}
+
+void EmbreeAccel::setVertexBuffer(Geometry &geometry) {
+    /* Key frames map to Embree time steps, which are also spread uniformly over [0, 1] */
+    Mesh::ScalarSize timeSteps = geometry.mesh->getTimeStepCount();
+    geometry.positions.resize(timeSteps, nullptr);
+    geometry.padded.resize(timeSteps);
+
+    for (Mesh::ScalarSize step = 0; step < timeSteps; ++step) {
+        const Mesh::FloatStorage &positions = geometry.mesh->getVertexPositions(step);
+        size_t size = slices(positions);
+
+        /* Embree reads the last vertex with a 16-byte load. The mesh buffer is
+           allocated in whole packets, so it can be shared unless it is full. */
+        const void *data = positions.data();
+        if (size % Float::Size == 0) {
+            geometry.padded[step].resize(size + 1);
+            std::copy(positions.data(), positions.data() + size, geometry.padded[step].begin());
+            data = geometry.padded[step].data();
+        }
+
+        if (data != geometry.positions[step]) {
+            rtcSetSharedGeometryBuffer(geometry.geometry, RTC_BUFFER_TYPE_VERTEX, step, RTC_FORMAT_FLOAT3,
+                                       data, 0, 3 * sizeof(float), geometry.mesh->getVertexCount());
+            geometry.positions[step] = data;
+        } else {
+            rtcUpdateGeometryBuffer(geometry.geometry, RTC_BUFFER_TYPE_VERTEX, step);
+        }
+    }
+    rtcCommitGeometry(geometry.geometry);
+}
+
+void EmbreeAccel::attachMesh(RTCScene scene, const Mesh *mesh, ScalarIndex geometryId) {
+    RTCGeometry geometry = rtcNewGeometry(m_device, RTC_GEOMETRY_TYPE_TRIANGLE);
+    rtcSetGeometryTimeStepCount(geometry, mesh->getTimeStepCount());
+    rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
+                               mesh->getIndices().data(), 0, 3 * sizeof(uint32_t), mesh->getFaceCount());
+
+    m_geometries.push_back({ geometry, mesh, {}, {} });
+    setVertexBuffer(m_geometries.back());
+    rtcAttachGeometryByID(scene, geometry, geometryId);
+}
+
+void EmbreeAccel::build(const std::vector<Mesh *> &meshes, const std::vector<ScalarIndex> &meshOffset,
+                        const std::vector<const Instance *> &instances) {
+    m_meshOffset = meshOffset;
+    m_meshCount = (ScalarIndex) meshes.size();
+
+    m_scene = rtcNewScene(m_device);
+    rtcSetSceneBuildQuality(m_scene, RTC_BUILD_QUALITY_HIGH);
+
+    /* Geometry IDs of the meshes match their indices in Accel */
+    for (ScalarIndex i = 0; i < m_meshCount; ++i)
+        attachMesh(m_scene, meshes[i], i);
+
+    /* Instances follow the meshes and reference one scene per unique mesh */
+    for (size_t i = 0; i < instances.size(); ++i) {
+        const Mesh *mesh = instances[i]->getMesh();
+        RTCScene &scene = m_bottomLevel[mesh];
+        if (!scene) {
+            scene = rtcNewScene(m_device);
+            rtcSetSceneBuildQuality(scene, RTC_BUILD_QUALITY_HIGH);
+            attachMesh(scene, mesh, 0u);
+            rtcCommitScene(scene);
+        }
+
+        RTCGeometry geometry = rtcNewGeometry(m_device, RTC_GEOMETRY_TYPE_INSTANCE);
+        rtcSetGeometryInstancedScene(geometry, scene);
+        rtcSetGeometryTimeStepCount(geometry, 1);
+        /* Enoki matrices are stored column by column */
+        rtcSetGeometryTransform(geometry, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, &instances[i]->getToWorld().matrix);
+        rtcCommitGeometry(geometry);
+        rtcAttachGeometryByID(m_scene, geometry, m_meshCount + (ScalarIndex) i);
+        m_instanceGeometries.push_back(geometry);
+    }
+
+    rtcCommitScene(m_scene);
+    checkError("scene construction");
+}
+
+void EmbreeAccel::update() {
+    if (!m_scene)
+        return;
+
+    /* Meshes may have been given a new vertex buffer (see \ref Mesh::setVertexPositions()) */
+    for (Geometry &geometry : m_geometries)
+        setVertexBuffer(geometry);
+    for (auto &[mesh, scene] : m_bottomLevel)
+        rtcCommitScene(scene);
+    for (RTCGeometry geometry : m_instanceGeometries)
+        rtcCommitGeometry(geometry);
+    rtcCommitScene(m_scene);
+    checkError("scene update");
+}
+
+bool EmbreeAccel::rayIntersect(const ScalarRay3f &ray, ScalarIndex &f, ScalarIndex &instance,
+                               ScalarFloat &t, ScalarPoint2f &uv) const {
+    if (!m_scene)
+        return false;
+
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+
+    RTCRayHit rayHit;
+    setRay(rayHit.ray, ray);
+    rayHit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+    rayHit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+
+    rtcIntersect1(m_scene, &context, &rayHit);
+    if (rayHit.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+        return false;
+
+    if (rayHit.hit.instID[0] != RTC_INVALID_GEOMETRY_ID) {
+        instance = rayHit.hit.instID[0] - m_meshCount;
+        f = rayHit.hit.primID;
+    } else {
+        instance = NoInstance;
+        f = m_meshOffset[rayHit.hit.geomID] + rayHit.hit.primID;
+    }
+    t = rayHit.ray.tfar;
+    uv = ScalarPoint2f(rayHit.hit.u, rayHit.hit.v);
+    return true;
+}
+
+EmbreeAccel::Mask EmbreeAccel::rayIntersect(const Ray3f &ray, UInt32 &f, UInt32 &instance,
+                                            Float &t, Float &u, Float &v, Mask active) const {
+    using Packet = EmbreePacket<Float::Size>;
+    Mask result = false;
+
+    if constexpr (Packet::Supported) {
+        if (!m_scene || none(active))
+            return result;
+
+        RTCIntersectContext context;
+        rtcInitIntersectContext(&context);
+        context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+        alignas(64) int valid[Float::Size];
+        alignas(64) typename Packet::RayHit rayHit;
+        for (size_t i = 0; i < Float::Size; ++i) {
+            valid[i] = active[i] ? -1 : 0;
+            setRay(rayHit.ray, ray, i);
+            rayHit.hit.geomID[i] = RTC_INVALID_GEOMETRY_ID;
+            rayHit.hit.instID[0][i] = RTC_INVALID_GEOMETRY_ID;
+        }
+
+        Packet::intersect(valid, m_scene, &context, &rayHit);
+
+        for (size_t i = 0; i < Float::Size; ++i) {
+            if (!valid[i] || rayHit.hit.geomID[i] == RTC_INVALID_GEOMETRY_ID)
+                continue;
+            result[i] = true;
+            if (rayHit.hit.instID[0][i] != RTC_INVALID_GEOMETRY_ID) {
+                instance[i] = rayHit.hit.instID[0][i] - m_meshCount;
+                f[i] = rayHit.hit.primID[i];
+            } else {
+                instance[i] = NoInstance;
+                f[i] = m_meshOffset[rayHit.hit.geomID[i]] + rayHit.hit.primID[i];
+            }
+            t[i] = rayHit.ray.tfar[i];
+            u[i] = rayHit.hit.u[i];
+            v[i] = rayHit.hit.v[i];
+        }
+    } else {
+        /* No Embree packet type of this width, trace the rays one by one */
+        for (size_t i = 0; i < Float::Size; ++i) {
+            ScalarIndex f1, instance1;
+            ScalarFloat t1;
+            ScalarPoint2f uv1;
+            if (!active[i] || !rayIntersect(getRay(ray, i), f1, instance1, t1, uv1))
+                continue;
+            result[i] = true;
+            f[i] = f1;
+            instance[i] = instance1;
+            t[i] = t1;
+            u[i] = uv1.x();
+            v[i] = uv1.y();
+        }
+    }
+
+    return result;
+}
+
+bool EmbreeAccel::rayTest(const ScalarRay3f &ray) const {
+    if (!m_scene)
+        return false;
+
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+
+    RTCRay target;
+    setRay(target, ray);
+    rtcOccluded1(m_scene, &context, &target);
+
+    /* Embree sets the far distance to -infinity for occluded rays */
+    return target.tfar == -math::Infinity<float>;
+}
+
+EmbreeAccel::Mask EmbreeAccel::rayTest(const Ray3f &ray, Mask active) const {
+    using Packet = EmbreePacket<Float::Size>;
+    Mask result = false;
+
+    if constexpr (Packet::Supported) {
+        if (!m_scene || none(active))
+            return result;
+
+        RTCIntersectContext context;
+        rtcInitIntersectContext(&context);
+        context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+        alignas(64) int valid[Float::Size];
+        alignas(64) typename Packet::Ray target;
+        for (size_t i = 0; i < Float::Size; ++i) {
+            valid[i] = active[i] ? -1 : 0;
+            setRay(target, ray, i);
+        }
+
+        Packet::occluded(valid, m_scene, &context, &target);
+
+        for (size_t i = 0; i < Float::Size; ++i)
+            result[i] = valid[i] && target.tfar[i] == -math::Infinity<float>;
+    } else {
+        for (size_t i = 0; i < Float::Size; ++i)
+            result[i] = active[i] && rayTest(getRay(ray, i));
+    }
+
+    return result;
+}
+
+std::string EmbreeAccel::toString() const {
+    return fmt::format(
+        "EmbreeAccel[\n"
+        "  version = \"{}\",\n"
+        "  geometries = {},\n"
+        "  instances = {},\n"
+        "  bottomLevel = {}\n"
+        "]",
+        RTC_VERSION_STRING,
+        m_geometries.size(),
+        m_instanceGeometries.size(),
+        m_bottomLevel.size()
+    );
+}
+
+NAMESPACE_END(kazen)
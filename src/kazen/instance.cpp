@@ -0,0 +1,45 @@
+#include <kazen/instance.h>
+
+NAMESPACE_BEGIN(kazen)
+
+Instance::Instance(const PropertyList &props) {
+    m_toWorld = props.getTransform("toWorld", ScalarTransform4f());
+    m_toObject = m_toWorld.inverse();
+    m_identity = m_toWorld == ScalarTransform4f();
+}
+
+Instance::Instance(const Mesh *mesh, const ScalarTransform4f &toWorld)
+    : m_mesh(mesh), m_toWorld(toWorld), m_toObject(toWorld.inverse()),
+      m_identity(toWorld == ScalarTransform4f()) { }
+
+void Instance::addChild(Object *child) {
+    if (child->getClassType() != EMesh)
+        throw Exception("Instance::addChild(<{}>) is not supported!", classTypeName(child->getClassType()));
+    if (m_mesh)
+        throw Exception("Instance: tried to register multiple meshes!");
+    m_mesh = static_cast<const Mesh *>(child);
+}
+
+void Instance::activate() {
+    if (!m_mesh)
+        throw Exception("Instance: no mesh was specified!");
+}
+
+Instance::ScalarBoundingBox3f Instance::getBoundingBox(const ScalarBoundingBox3f &bbox) const {
+    ScalarBoundingBox3f result;
+    for (size_t i = 0; i < 8; ++i)
+        result.expand(m_toWorld * bbox.corner(i));
+    return result;
+}
+
+std::string Instance::toString() const {
+    return fmt::format(
+        "Instance[\n"
+        "  mesh = \"{}\"\n"
+        "]",
+        m_mesh ? m_mesh->getName() : "<none>"
+    );
+}
+
+KAZEN_REGISTER_CLASS(Instance, "instance");
+NAMESPACE_END(kazen)
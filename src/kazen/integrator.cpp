@@ -4,7 +4,7 @@
 
 NAMESPACE_BEGIN(kazen)
 
-classTempIntegrator : public Integrator {
+class TempIntegrator : public Integrator {
 public:
     TempIntegrator(const PropertyList &props) {
         /* No parameters this time */
@@ -13,6 +13,8 @@
 #include <kazen/renderer.h>
 #include <kazen/transform.h>
 #include <kazen/parser.h>
+#include <kazen/bench.h>
+#include <kazen/binmesh.h>
 // #include <array>
 // #include <tbb/blocked_range.h>
 // #include <tbb/parallel_for.h>
@@ -22,10 +24,18 @@
 
 using namespace kazen;
 
-int main()
+int main(int argc, char **argv)
 {
     using Float = float;//Packet<float>;
     KAZEN_BASE_TYPES()
+
+    // ---------------- ray throughput benchmark ----------------
+    if (argc > 1 && std::string(argv[1]) == "--bench-rays")
+        return benchRays(argc - 2, argv + 2);
+
+    // ---------------- binary mesh converter ----------------
+    if (argc > 1 && std::string(argv[1]) == "--convert-mesh")
+        return convertMesh(argc - 2, argv + 2);
     
     // main test 
 
@@ -1,4 +1,11 @@
 #include <kazen/mesh.h>
+#include <kazen/bsdf.h>
+#include <kazen/light.h>
+#include <kazen/morton.h>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
+#include <tbb/blocked_range.h>
 
 NAMESPACE_BEGIN(kazen)
 
@@ -14,7 +21,430 @@ void Mesh::activate() {
         /* If no material was assigned, instantiate a diffuse BRDF */
         m_bsdf = static_cast<BSDF *>(ObjectFactory::createInstance("diffuse", PropertyList()));
     }
+
+    if (m_weldVertices)
+        weldVertices(m_weldTolerance);
+
+    if (m_reorderForLocality)
+        reorderForLocality();
+
+    if (m_compressAttributes)
+        compressAttributes();
+}
+
+void Mesh::reorderForLocality() {
+    if (m_faceCount == 0)
+        return;
+
+    /* Sort the triangles by the 63-bit Morton code of their centroid (in the first key frame) */
+    ScalarBoundingBox3f centroidBBox;
+    for (ScalarIndex i = 0; i < m_faceCount; ++i)
+        centroidBBox.expand(getCentroid(i));
+    MortonEncoder<ScalarBoundingBox3f> morton(centroidBBox);
+
+    std::vector<std::pair<uint64_t, ScalarIndex>> order(m_faceCount);
+    tbb::parallel_for(tbb::blocked_range<ScalarIndex>(0, m_faceCount, 1 << 14),
+        [&](const tbb::blocked_range<ScalarIndex> &range) {
+            for (ScalarIndex i = range.begin(); i != range.end(); ++i)
+                order[i] = { morton(getCentroid(i)), i };
+        }
+    );
+    tbb::parallel_sort(order.begin(), order.end());
+
+    /* Number the vertices in the order of their first use by the sorted triangles */
+    const uint32_t *F = (const uint32_t *) m_F.data();
+    std::vector<ScalarIndex> remap(m_vertexCount, (ScalarIndex) -1);
+    DynamicBuffer<UInt32> faces = empty<DynamicBuffer<UInt32>>(3 * (size_t) m_faceCount);
+    uint32_t *target = (uint32_t *) faces.data();
+    ScalarSize vertexCount = 0;
+    for (ScalarIndex i = 0; i < m_faceCount; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            uint32_t &index = remap[F[3 * order[i].second + k]];
+            if (index == (ScalarIndex) -1)
+                index = vertexCount++;
+            target[3 * i + k] = index;
+        }
+    }
+
+    /* Unreferenced vertices go to the end */
+    for (ScalarIndex i = 0; i < m_vertexCount; ++i)
+        if (remap[i] == (ScalarIndex) -1)
+            remap[i] = vertexCount++;
+    m_F = faces;
+
+    auto permute = [&](auto &buffer, uint32_t dim) {
+        using Buffer = std::decay_t<decltype(buffer)>;
+        using Value = std::conditional_t<std::is_same_v<Buffer, FloatStorage>, InputFloat, uint32_t>;
+        if (slices(buffer) == 0)
+            return;
+        Buffer result = empty<Buffer>((size_t) dim * m_vertexCount);
+        const Value *source = (const Value *) buffer.data();
+        Value *target = (Value *) result.data();
+        tbb::parallel_for(tbb::blocked_range<ScalarIndex>(0, m_vertexCount, 1 << 14),
+            [&](const tbb::blocked_range<ScalarIndex> &range) {
+                for (ScalarIndex i = range.begin(); i != range.end(); ++i)
+                    memcpy(target + (size_t) dim * remap[i], source + (size_t) dim * i, dim * sizeof(Value));
+            }
+        );
+        buffer = result;
+    };
+    permute(m_V, 3);
+    for (FloatStorage &positions : m_motionV)
+        permute(positions, 3);
+    permute(m_N, 3);
+    permute(m_UV, 2);
+    permute(m_packedN, 1);
+    permute(m_packedUV, 1);
+    ++m_revision;
+}
+
+void Mesh::weldVertices(ScalarFloat tolerance) {
+    if (hasCompressedAttributes())
+        throw Exception("Mesh::weldVertices(): the attributes of \"{}\" are compressed, weld the vertices first",
+                        m_name);
+    if (m_vertexCount == 0)
+        return;
+
+    /* Attributes that must match: the positions of all key frames, normals and texture coordinates */
+    std::vector<std::pair<const InputFloat *, uint32_t>> attributes;
+    for (ScalarSize k = 0; k < getTimeStepCount(); ++k)
+        attributes.emplace_back((const InputFloat *) getVertexPositions(k).data(), 3);
+    if (slices(m_N) != 0)
+        attributes.emplace_back((const InputFloat *) m_N.data(), 3);
+    if (slices(m_UV) != 0)
+        attributes.emplace_back((const InputFloat *) m_UV.data(), 2);
+
+    /* Values are compared bitwise (with -0 == +0), or must differ by at most the tolerance */
+    auto bits = [](InputFloat value) -> uint32_t {
+        value += 0.f;
+        uint32_t result;
+        memcpy(&result, &value, sizeof(uint32_t));
+        return result;
+    };
+    auto equal = [&](ScalarIndex a, ScalarIndex b) {
+        for (const auto &[data, dim] : attributes) {
+            for (uint32_t k = 0; k < dim; ++k) {
+                InputFloat u = data[dim * a + k], v = data[dim * b + k];
+                if (tolerance > 0.f ? !(std::abs(u - v) <= tolerance) : bits(u) != bits(v))
+                    return false;
+            }
+        }
+        return true;
+    };
+
+    /* Candidates are found through a hash of the grid cells of the first key frame
+       positions. With a tolerance, the cells are as wide as the tolerance, so that
+       vertices within the tolerance lie in the same or in neighbouring cells. */
+    const InputFloat *V = attributes[0].first;
+    auto cell = [&](ScalarIndex i, uint32_t k) -> int64_t {
+        if (tolerance > 0.f)
+            return (int64_t) std::floor((double) V[3 * i + k] / (double) tolerance);
+        return bits(V[3 * i + k]);
+    };
+    auto hashCell = [](const int64_t *c) {
+        return util::hash(c, 3 * sizeof(int64_t), 0xcbf29ce484222325ull);
+    };
+
+    /* Sorting by (hash, index) groups the vertices of every cell */
+    std::vector<std::pair<uint64_t, ScalarIndex>> order(m_vertexCount);
+    tbb::parallel_for(tbb::blocked_range<ScalarIndex>(0, m_vertexCount, 1 << 14),
+        [&](const tbb::blocked_range<ScalarIndex> &range) {
+            for (ScalarIndex i = range.begin(); i != range.end(); ++i) {
+                int64_t c[3] = { cell(i, 0), cell(i, 1), cell(i, 2) };
+                order[i] = { hashCell(c), i };
+            }
+        }
+    );
+    tbb::parallel_sort(order.begin(), order.end());
+
+    /* Map every vertex to the first vertex that matches it. These only point to
+       smaller indices, so the result does not depend on the number of threads. */
+    std::vector<ScalarIndex> representative(m_vertexCount);
+    int64_t reach = tolerance > 0.f ? 1 : 0;
+    tbb::parallel_for(tbb::blocked_range<ScalarIndex>(0, m_vertexCount, 1 << 12),
+        [&](const tbb::blocked_range<ScalarIndex> &range) {
+            for (ScalarIndex i = range.begin(); i != range.end(); ++i) {
+                ScalarIndex first = i;
+                int64_t c[3] = { cell(i, 0), cell(i, 1), cell(i, 2) };
+                for (int64_t dx = -reach; dx <= reach; ++dx) {
+                    for (int64_t dy = -reach; dy <= reach; ++dy) {
+                        for (int64_t dz = -reach; dz <= reach; ++dz) {
+                            int64_t neighbour[3] = { c[0] + dx, c[1] + dy, c[2] + dz };
+                            uint64_t hash = hashCell(neighbour);
+                            auto it = std::lower_bound(order.begin(), order.end(), std::make_pair(hash, (ScalarIndex) 0));
+                            for (; it != order.end() && it->first == hash && it->second < first; ++it) {
+                                if (equal(it->second, i)) {
+                                    first = it->second;
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                }
+                representative[i] = first;
+            }
+        }
+    );
+
+    /* Number the remaining vertices in their original order */
+    std::vector<ScalarIndex> remap(m_vertexCount);
+    ScalarSize vertexCount = 0;
+    for (ScalarIndex i = 0; i < m_vertexCount; ++i)
+        remap[i] = representative[i] == i ? vertexCount++ : remap[representative[i]];
+    if (vertexCount == m_vertexCount)
+        return;
+
+    auto compact = [&](FloatStorage &buffer, uint32_t dim) {
+        FloatStorage result = empty<FloatStorage>((size_t) dim * vertexCount);
+        const InputFloat *source = (const InputFloat *) buffer.data();
+        InputFloat *target = (InputFloat *) result.data();
+        tbb::parallel_for(tbb::blocked_range<ScalarIndex>(0, m_vertexCount, 1 << 14),
+            [&](const tbb::blocked_range<ScalarIndex> &range) {
+                for (ScalarIndex i = range.begin(); i != range.end(); ++i)
+                    if (representative[i] == i)
+                        memcpy(target + (size_t) dim * remap[i], source + (size_t) dim * i, dim * sizeof(InputFloat));
+            }
+        );
+        buffer = result;
+    };
+    compact(m_V, 3);
+    for (FloatStorage &positions : m_motionV)
+        compact(positions, 3);
+    if (slices(m_N) != 0)
+        compact(m_N, 3);
+    if (slices(m_UV) != 0)
+        compact(m_UV, 2);
+
+    /* Remap the faces and drop those that collapsed into a line or a point */
+    const uint32_t *F = (const uint32_t *) m_F.data();
+    std::vector<uint32_t> faces;
+    faces.reserve(3 * (size_t) m_faceCount);
+    for (ScalarIndex i = 0; i < m_faceCount; ++i) {
+        uint32_t a = remap[F[3 * i]], b = remap[F[3 * i + 1]], c = remap[F[3 * i + 2]];
+        if (a == b || b == c || a == c)
+            continue;
+        faces.push_back(a);
+        faces.push_back(b);
+        faces.push_back(c);
+    }
+    ScalarSize faceCount = (ScalarSize) (faces.size() / 3);
+    m_F = empty<DynamicBuffer<UInt32>>(faces.size());
+    memcpy(m_F.data(), faces.data(), faces.size() * sizeof(uint32_t));
+
+    size_t vertexSize = 0;
+    for (const auto &attribute : attributes)
+        vertexSize += attribute.second * sizeof(InputFloat);
+    size_t saved = (size_t) (m_vertexCount - vertexCount) * vertexSize +
+                   (size_t) (m_faceCount - faceCount) * 3 * sizeof(uint32_t);
+
+    std::cout << "Welded the vertices of \"" << m_name << "\" (" << m_vertexCount << " -> " << vertexCount
+              << " vertices, " << m_faceCount - faceCount << " degenerate triangles removed, saved "
+              << util::memString(saved) << ")." << std::endl;
+
+    m_vertexCount = vertexCount;
+    m_faceCount = faceCount;
+    ++m_revision;
+}
+
+uint32_t Mesh::encodeNormal(const ScalarNormal3f &n) {
+    /* Project onto the octahedron |x| + |y| + |z| = 1 and fold the lower hemisphere over the upper one */
+    ScalarFloat l1 = abs(n.x()) + abs(n.y()) + abs(n.z());
+    if (l1 == 0.f)
+        return encodeNormal(ScalarNormal3f(0.f, 0.f, 1.f));
+    ScalarFloat x = n.x() / l1, y = n.y() / l1;
+    if (n.z() < 0.f) {
+        ScalarFloat ox = x;
+        x = (1.f - abs(y)) * (ox >= 0.f ? 1.f : -1.f);
+        y = (1.f - abs(ox)) * (y >= 0.f ? 1.f : -1.f);
+    }
+
+    auto quantize = [](ScalarFloat value) {
+        return (uint32_t) std::round((std::clamp(value, -1.f, 1.f) * .5f + .5f) * 65535.f);
+    };
+    return quantize(x) | (quantize(y) << 16);
+}
+
+void Mesh::compressAttributes() {
+    if (slices(m_N) != 0) {
+        m_packedN = empty<DynamicBuffer<UInt32>>(m_vertexCount);
+        const InputFloat *N = (const InputFloat *) m_N.data();
+        uint32_t *packed = (uint32_t *) m_packedN.data();
+
+        tbb::parallel_for(tbb::blocked_range<ScalarIndex>(0, m_vertexCount, 1 << 14),
+            [&](const tbb::blocked_range<ScalarIndex> &range) {
+                for (ScalarIndex i = range.begin(); i != range.end(); ++i)
+                    packed[i] = encodeNormal(ScalarNormal3f(N[3 * i], N[3 * i + 1], N[3 * i + 2]));
+            }
+        );
+        m_N = FloatStorage();
+    }
+
+    if (slices(m_UV) != 0) {
+        const InputFloat *UV = (const InputFloat *) m_UV.data();
+
+        /* Quantize relative to the texture coordinate bounds of the mesh */
+        ScalarPoint2f uvMin(std::numeric_limits<ScalarFloat>::infinity()),
+                      uvMax(-std::numeric_limits<ScalarFloat>::infinity());
+        for (ScalarIndex i = 0; i < m_vertexCount; ++i) {
+            ScalarPoint2f uv(UV[2 * i], UV[2 * i + 1]);
+            uvMin = min(uvMin, uv);
+            uvMax = max(uvMax, uv);
+        }
+        m_uvOffset = uvMin;
+        m_uvScale = uvMax - uvMin;
+        ScalarVector2f invScale(m_uvScale.x() > 0.f ? 65535.f / m_uvScale.x() : 0.f,
+                                m_uvScale.y() > 0.f ? 65535.f / m_uvScale.y() : 0.f);
+
+        m_packedUV = empty<DynamicBuffer<UInt32>>(m_vertexCount);
+        uint32_t *packed = (uint32_t *) m_packedUV.data();
+
+        tbb::parallel_for(tbb::blocked_range<ScalarIndex>(0, m_vertexCount, 1 << 14),
+            [&](const tbb::blocked_range<ScalarIndex> &range) {
+                for (ScalarIndex i = range.begin(); i != range.end(); ++i) {
+                    uint32_t u = (uint32_t) std::round(std::clamp((UV[2 * i] - uvMin.x()) * invScale.x(), 0.f, 65535.f)),
+                             v = (uint32_t) std::round(std::clamp((UV[2 * i + 1] - uvMin.y()) * invScale.y(), 0.f, 65535.f));
+                    packed[i] = u | (v << 16);
+                }
+            }
+        );
+        m_UV = FloatStorage();
+    }
+}
+
+void Mesh::setVertexPositions(const FloatStorage &positions) {
+    if (slices(positions) != slices(m_V))
+        throw Exception("Mesh::setVertexPositions(): expected {} values, got {}!",
+                        slices(m_V), slices(positions));
+    m_V = positions;
+    ++m_revision;
+    updateBoundingBox();
+}
+
+void Mesh::addTimeStep(const FloatStorage &positions) {
+    if (slices(positions) != slices(m_V))
+        throw Exception("Mesh::addTimeStep(): expected {} values, got {}!",
+                        slices(m_V), slices(positions));
+    m_motionV.push_back(positions);
+    ++m_revision;
+    updateBoundingBox();
+}
+
+void Mesh::loadKeyFrames(const PropertyList &props, const std::string &pluginName) {
+    std::string list = props.getString("keyFrames", "");
+    for (size_t start = 0; start < list.size(); ) {
+        size_t end = std::min(list.find(',', start), list.size());
+        std::string filename = list.substr(start, end - start);
+        start = end + 1;
+
+        /* Strip surrounding whitespace and skip empty entries */
+        size_t first = filename.find_first_not_of(" \t\r\n");
+        if (first == std::string::npos)
+            continue;
+        filename = filename.substr(first, filename.find_last_not_of(" \t\r\n") - first + 1);
+
+        PropertyList frameProps;
+        frameProps.setString("filename", filename);
+        if (props.hasProperty("toWorld"))
+            frameProps.setTransform("toWorld", props.getTransform("toWorld"));
+        std::unique_ptr<Mesh> frame(static_cast<Mesh *>(ObjectFactory::createInstance(pluginName, frameProps)));
+
+        if (frame->getVertexCount() != m_vertexCount || frame->getFaceCount() != m_faceCount)
+            throw Exception("Mesh \"{}\": key frame \"{}\" has {} vertices and {} triangles, expected {} and {}",
+                            m_name, filename, frame->getVertexCount(), frame->getFaceCount(),
+                            m_vertexCount, m_faceCount);
+        addTimeStep(frame->getVertexPositions());
+    }
+}
+
+void Mesh::updateBoundingBox() {
+    m_bbox.reset();
+    for (ScalarSize k = 0; k < getTimeStepCount(); ++k)
+        for (ScalarIndex i = 0; i < m_vertexCount; ++i)
+            m_bbox.expand(getVertexPosition(i, k));
+}
+
+Mesh::ScalarPoint3f Mesh::getVertexPositionAt(ScalarIndex index, ScalarFloat time) const {
+    if (m_motionV.empty())
+        return getVertexPosition(index);
+
+    /* Locate the key frames enclosing the time (see \ref addTimeStep()) */
+    ScalarFloat t = std::clamp(time, 0.f, 1.f) * (ScalarFloat) m_motionV.size();
+    ScalarSize k = std::min((ScalarSize) t, (ScalarSize) m_motionV.size() - 1);
+    ScalarFloat w = t - (ScalarFloat) k;
+
+    return fmadd(getVertexPosition(index, k + 1), w, getVertexPosition(index, k) * (1.f - w));
+}
+
+Mesh::ScalarBoundingBox3f Mesh::getBoundingBox(ScalarIndex index) const {
+    ScalarBoundingBox3f result = getBoundingBox(index, 0);
+    for (ScalarSize k = 1; k < getTimeStepCount(); ++k)
+        result.expand(getBoundingBox(index, k));
+    return result;
+}
+
+Mesh::ScalarBoundingBox3f Mesh::getBoundingBox(ScalarIndex index, ScalarSize timeStep) const {
+    auto fi = getFaceIndices(index);
+
+    ScalarBoundingBox3f result(getVertexPosition(fi[0], timeStep));
+    result.expand(getVertexPosition(fi[1], timeStep));
+    result.expand(getVertexPosition(fi[2], timeStep));
+    return result;
+}
+
+Mesh::ScalarPoint3f Mesh::getCentroid(ScalarIndex index) const {
+    auto fi = getFaceIndices(index);
+
+    return (getVertexPosition(fi[0]) +
+            getVertexPosition(fi[1]) +
+            getVertexPosition(fi[2])) * (1.f / 3.f);
+}
+
+Mesh::ScalarFloat Mesh::surfaceArea() const {
+    ScalarFloat result = 0.f;
+    for (ScalarIndex i = 0; i < m_faceCount; ++i) {
+        auto fi = getFaceIndices(i);
+        ScalarPoint3f p0 = getVertexPosition(fi[0]),
+                      p1 = getVertexPosition(fi[1]),
+                      p2 = getVertexPosition(fi[2]);
+        result += .5f * norm(cross(p1 - p0, p2 - p0));
+    }
+    return result;
 }
 
+void Mesh::addChild(Object *child) {
+    switch (child->getClassType()) {
+        case EBSDF:
+            if (m_bsdf)
+                throw Exception("Mesh: tried to register multiple BSDF instances!");
+            m_bsdf = static_cast<BSDF *>(child);
+            break;
+
+        case ELight:
+            if (m_light)
+                throw Exception("Mesh: tried to register multiple Light instances!");
+            m_light = static_cast<Light *>(child);
+            break;
+
+        default:
+            throw Exception("Mesh::addChild(<{}>) is not supported!", classTypeName(child->getClassType()));
+    }
+}
+
+std::string Mesh::toString() const {
+    return fmt::format(
+        "Mesh[\n"
+        "  name = \"{}\",\n"
+        "  vertexCount = {},\n"
+        "  triangleCount = {},\n"
+        "  bsdf = {},\n"
+        "  light = {}\n"
+        "]",
+        m_name,
+        m_vertexCount,
+        m_faceCount,
+        m_bsdf ? string::indent(m_bsdf->toString()) : std::string("null"),
+        m_light ? string::indent(m_light->toString()) : std::string("null")
+    );
+}
 
-NAMESPACE_END(kazen)
\ No newline at end of file
+NAMESPACE_END(kazen)
@@ -0,0 +1,90 @@
+#include <kazen/mmap.h>
+
+#if defined(__WINDOWS__)
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <cerrno>
+#  include <cstring>
+#endif
+
+NAMESPACE_BEGIN(kazen)
+
+MemoryMappedFile::MemoryMappedFile(const std::string &filename, bool copyOnWrite)
+    : m_filename(filename) {
+#if defined(__WINDOWS__)
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw Exception("MemoryMappedFile: could not open \"{}\"!", filename);
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        throw Exception("MemoryMappedFile: could not determine the size of \"{}\"!", filename);
+    }
+    m_size = (size_t) size.QuadPart;
+
+    if (m_size > 0) {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY,
+                                            0, 0, nullptr);
+        if (mapping)
+            m_data = MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+        if (mapping)
+            CloseHandle(mapping);
+        if (!m_data) {
+            CloseHandle(file);
+            throw Exception("MemoryMappedFile: could not map \"{}\"!", filename);
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw Exception("MemoryMappedFile: could not open \"{}\": {}", filename, strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        throw Exception("MemoryMappedFile: could not determine the size of \"{}\": {}", filename, strerror(errno));
+    }
+    m_size = (size_t) st.st_size;
+
+    if (m_size > 0) {
+        void *ptr = mmap(nullptr, m_size, copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                         MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            close(fd);
+            throw Exception("MemoryMappedFile: could not map \"{}\": {}", filename, strerror(errno));
+        }
+        m_data = ptr;
+    }
+    close(fd);
+#endif
+}
+
+MemoryMappedFile::~MemoryMappedFile() {
+    if (!m_data)
+        return;
+#if defined(__WINDOWS__)
+    UnmapViewOfFile(m_data);
+#else
+    munmap(m_data, m_size);
+#endif
+}
+
+std::string MemoryMappedFile::toString() const {
+    return fmt::format(
+        "MemoryMappedFile[\n"
+        "  filename = \"{}\",\n"
+        "  size = {}\n"
+        "]",
+        m_filename,
+        util::memString(m_size)
+    );
+}
+
+NAMESPACE_END(kazen)
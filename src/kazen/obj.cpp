@@ -0,0 +1,449 @@
+#include <kazen/mesh.h>
+#include <kazen/mmap.h>
+#include <kazen/timer.h>
+#include <kazen/transform.h>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/parallel_sort.h>
+#include <tbb/blocked_range.h>
+
+/* Size of the file chunks that are parsed in parallel */
+#define KAZEN_OBJ_CHUNK_SIZE (4 * 1024 * 1024)
+
+NAMESPACE_BEGIN(kazen)
+
+NAMESPACE_BEGIN()
+    /// Index of a missing texture coordinate or normal
+    constexpr uint32_t NoIndex = (uint32_t) -1;
+    /// Placeholder of a relative index that is resolved after parsing (see \ref ObjFixup)
+    constexpr uint32_t PendingIndex = (uint32_t) -2;
+
+    /// Position, texture coordinate and normal index of a face corner
+    struct ObjVertex {
+        uint32_t p, uv, n;
+
+        bool operator==(const ObjVertex &v) const { return p == v.p && uv == v.uv && n == v.n; }
+        bool operator!=(const ObjVertex &v) const { return !operator==(v); }
+        bool operator<(const ObjVertex &v) const {
+            if (p != v.p) return p < v.p;
+            if (uv != v.uv) return uv < v.uv;
+            return n < v.n;
+        }
+    };
+
+    /**
+     * \brief Negative (relative) OBJ index that refers to an element of
+     * another chunk, resolved once the element counts of all chunks are known
+     */
+    struct ObjFixup {
+        size_t corner;          ///< Corner within the chunk
+        uint32_t component;     ///< 0: position, 1: texture coordinate, 2: normal
+        int64_t index;          ///< Index relative to the first element of the chunk (may be negative)
+    };
+
+    /// Contents of a part of the file that starts and ends at a line break
+    struct ObjChunk {
+        const char *begin, *end;
+        std::vector<float> positions, texCoords, normals;
+        std::vector<ObjVertex> corners;     ///< Three per triangle
+        std::vector<ObjFixup> fixups;
+        bool allTexCoords = true;           ///< Does every corner reference a texture coordinate?
+        bool allNormals = true;             ///< Does every corner reference a normal?
+    };
+
+    inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+    inline const char *skipSpace(const char *p, const char *end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            ++p;
+        return p;
+    }
+
+    inline const char *skipLine(const char *p, const char *end) {
+        while (p < end && *p != '\n')
+            ++p;
+        return p < end ? p + 1 : end;
+    }
+
+    /**
+     * \brief Parse a decimal floating point number
+     *
+     * Much faster than \c strtof(), which also has to consider the locale.
+     * Up to 19 significant digits are accumulated in an integer, which is
+     * exact for all values that a \c float can represent.
+     *
+     * \return The end of the number, or \c nullptr if there is none
+     */
+    const char *parseFloat(const char *p, const char *end, float &value) {
+        static const double powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+
+        uint64_t mantissa = 0;
+        int exponent = 0, digits = 0;
+        bool valid = false;
+        for (; p < end && isDigit(*p); ++p, valid = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+                digits += mantissa != 0;
+            } else {
+                exponent++;
+            }
+        }
+        if (p < end && *p == '.') {
+            for (++p; p < end && isDigit(*p); ++p, valid = true) {
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+                    digits += mantissa != 0;
+                    exponent--;
+                }
+            }
+        }
+        if (!valid)
+            return nullptr;
+
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            bool negativeExponent = false;
+            if (p < end && (*p == '-' || *p == '+'))
+                negativeExponent = *p++ == '-';
+            if (p == end || !isDigit(*p))
+                return nullptr;
+            int e = 0;
+            for (; p < end && isDigit(*p); ++p)
+                e = std::min(e * 10 + (*p - '0'), 10000);
+            exponent += negativeExponent ? -e : e;
+        }
+
+        double result = (double) mantissa;
+        if (exponent != 0) {
+            int e = std::abs(exponent);
+            double scale = e <= 22 ? powers[e] : std::pow(10.0, (double) e);
+            result = exponent < 0 ? result / scale : result * scale;
+        }
+        value = (float) (negative ? -result : result);
+        return p;
+    }
+
+    /// Parse a (possibly negative) integer, or return \c nullptr if there is none
+    const char *parseInt(const char *p, const char *end, int64_t &value) {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+        if (p == end || !isDigit(*p))
+            return nullptr;
+        int64_t result = 0;
+        for (; p < end && isDigit(*p); ++p)
+            result = result * 10 + (*p - '0');
+        value = negative ? -result : result;
+        return p;
+    }
+
+    /// Parse all lines of a chunk
+    void parseChunk(ObjChunk &chunk, const char *fileBegin, const std::string &filename) {
+        const char *p = chunk.begin, *end = chunk.end;
+        std::vector<ObjVertex> polygon;
+
+        auto error = [&](const char *what) {
+            return Exception("WavefrontOBJ: invalid {} in \"{}\" at byte {}", what, filename, p - fileBegin);
+        };
+
+        auto parseFloats = [&](const char *q, std::vector<float> &out, int count) {
+            for (int i = 0; i < count; ++i) {
+                float value;
+                q = parseFloat(skipSpace(q, end), end, value);
+                if (!q)
+                    throw error("vertex attribute");
+                out.push_back(value);
+            }
+        };
+
+        /* Resolve an index to a zero-based one. Absolute indices are final. A relative
+           index depends on the number of elements in the preceding chunks, which is
+           unknown while the chunks are parsed in parallel, so it is recorded relative
+           to the start of this chunk (negative if it refers to an earlier chunk) and
+           fixed up once the chunk offsets are known. */
+        auto resolve = [&](int64_t index, size_t localCount, uint32_t component) -> uint32_t {
+            if (index > 0)
+                return (uint32_t) (index - 1);
+            if (index == 0)
+                throw error("face index");
+            chunk.fixups.push_back({ polygon.size(), component, (int64_t) localCount + index });
+            return PendingIndex;
+        };
+
+        while (p < end) {
+            const char *line = skipSpace(p, end);
+            const char *next = skipLine(line, end);
+
+            if (line + 1 < end && line[0] == 'v' && (line[1] == ' ' || line[1] == '\t')) {
+                parseFloats(line + 1, chunk.positions, 3);
+            } else if (line + 2 < end && line[0] == 'v' && line[1] == 't' && (line[2] == ' ' || line[2] == '\t')) {
+                parseFloats(line + 2, chunk.texCoords, 2);
+            } else if (line + 2 < end && line[0] == 'v' && line[1] == 'n' && (line[2] == ' ' || line[2] == '\t')) {
+                parseFloats(line + 2, chunk.normals, 3);
+            } else if (line + 1 < end && line[0] == 'f' && (line[1] == ' ' || line[1] == '\t')) {
+                /* Corners are given as v, v/vt, v//vn or v/vt/vn */
+                polygon.clear();
+                size_t fixups = chunk.fixups.size();
+                const char *q = skipSpace(line + 1, end);
+                while (q < end && *q != '\n' && *q != '#') {
+                    ObjVertex v { NoIndex, NoIndex, NoIndex };
+                    int64_t index;
+                    if (!(q = parseInt(q, end, index)))
+                        throw error("face");
+                    v.p = resolve(index, chunk.positions.size() / 3, 0);
+                    if (q < end && *q == '/') {
+                        ++q;
+                        if (q < end && *q != '/') {
+                            if (!(q = parseInt(q, end, index)))
+                                throw error("face");
+                            v.uv = resolve(index, chunk.texCoords.size() / 2, 1);
+                        }
+                        if (q < end && *q == '/') {
+                            if (!(q = parseInt(q + 1, end, index)))
+                                throw error("face");
+                            v.n = resolve(index, chunk.normals.size() / 3, 2);
+                        }
+                    }
+                    polygon.push_back(v);
+                    q = skipSpace(q, end);
+                }
+                if (polygon.size() < 3)
+                    throw error("face");
+
+                /* Triangulate polygons as a fan around the first corner */
+                size_t base = chunk.corners.size();
+                for (size_t i = 2; i < polygon.size(); ++i) {
+                    chunk.corners.push_back(polygon[0]);
+                    chunk.corners.push_back(polygon[i - 1]);
+                    chunk.corners.push_back(polygon[i]);
+                }
+
+                /* Fixups were recorded for the polygon corners, move them to the triangle corners */
+                std::vector<ObjFixup> polygonFixups(chunk.fixups.begin() + fixups, chunk.fixups.end());
+                chunk.fixups.resize(fixups);
+                for (const ObjFixup &fixup : polygonFixups) {
+                    size_t corner = fixup.corner;
+                    for (size_t i = 2; i < polygon.size(); ++i) {
+                        size_t triangle = base + 3 * (i - 2);
+                        if (corner == 0)
+                            chunk.fixups.push_back({ triangle, fixup.component, fixup.index });
+                        if (corner == i - 1)
+                            chunk.fixups.push_back({ triangle + 1, fixup.component, fixup.index });
+                        if (corner == i)
+                            chunk.fixups.push_back({ triangle + 2, fixup.component, fixup.index });
+                    }
+                }
+
+                for (const ObjVertex &v : polygon) {
+                    chunk.allTexCoords &= v.uv != NoIndex;
+                    chunk.allNormals &= v.n != NoIndex;
+                }
+            }
+            /* Everything else (comments, groups, materials, ..) is ignored */
+
+            p = next;
+        }
+    }
+NAMESPACE_END()
+
+/**
+ * \brief Triangle mesh loaded from a Wavefront OBJ file
+ *
+ * The file is memory-mapped and split into chunks at line breaks, which
+ * are parsed in parallel. Vertices are then merged: every distinct
+ * combination of position, texture coordinate and normal indices that is
+ * referenced by a face becomes one mesh vertex. Polygons are triangulated
+ * as fans.
+ *
+ * The string property \c filename names the file, and the optional
+ * transformation \c toWorld is applied to positions and normals. The
+ * boolean property \c compressAttributes selects the compact attribute
+ * encoding (see \ref Mesh::compressAttributes()), and \c weldVertices and
+ * \c weldTolerance merge vertices with equal values that the file stores
+ * under different indices (see \ref Mesh::weldVertices()). The boolean
+ * property \c reorderForLocality sorts the mesh along a space-filling curve
+ * (see \ref Mesh::reorderForLocality()). For motion blur, the string
+ * property \c keyFrames lists further OBJ files with the vertex positions
+ * of the following key frames (see \ref Mesh::loadKeyFrames()).
+ */
+class WavefrontOBJ : public Mesh {
+public:
+    WavefrontOBJ(const PropertyList &props) {
+        std::string filename = props.getString("filename");
+        ScalarTransform4f toWorld = props.getTransform("toWorld", ScalarTransform4f());
+        m_name = filename;
+        m_compressAttributes = props.getBool("compressAttributes", false);
+        m_weldVertices = props.getBool("weldVertices", false);
+        m_weldTolerance = props.getFloat("weldTolerance", 0.f);
+        m_reorderForLocality = props.getBool("reorderForLocality", false);
+
+        Timer timer;
+        MemoryMappedFile file(filename);
+        const char *begin = (const char *) file.data(), *end = begin + file.size();
+
+        /* Split the file into chunks that start after a line break */
+        std::vector<ObjChunk> chunks;
+        for (const char *p = begin; p < end; ) {
+            const char *next = p + std::min((size_t) (end - p), (size_t) KAZEN_OBJ_CHUNK_SIZE);
+            next = next < end ? skipLine(next, end) : end;
+            chunks.emplace_back();
+            chunks.back().begin = p;
+            chunks.back().end = next;
+            p = next;
+        }
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, chunks.size(), 1),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i != range.end(); ++i)
+                    parseChunk(chunks[i], begin, filename);
+            }
+        );
+
+        /* Element offsets of all chunks */
+        size_t chunkCount = chunks.size();
+        std::vector<size_t> positionOffset(chunkCount + 1, 0), texCoordOffset(chunkCount + 1, 0),
+                            normalOffset(chunkCount + 1, 0), cornerOffset(chunkCount + 1, 0);
+        bool hasTexCoords = true, hasNormals = true;
+        for (size_t i = 0; i < chunkCount; ++i) {
+            positionOffset[i + 1] = positionOffset[i] + chunks[i].positions.size() / 3;
+            texCoordOffset[i + 1] = texCoordOffset[i] + chunks[i].texCoords.size() / 2;
+            normalOffset[i + 1] = normalOffset[i] + chunks[i].normals.size() / 3;
+            cornerOffset[i + 1] = cornerOffset[i] + chunks[i].corners.size();
+            if (!chunks[i].corners.empty()) {
+                hasTexCoords &= chunks[i].allTexCoords;
+                hasNormals &= chunks[i].allNormals;
+            }
+        }
+        size_t cornerCount = cornerOffset.back();
+        if (cornerCount == 0)
+            throw Exception("WavefrontOBJ: \"{}\" does not contain any faces", filename);
+        if ((cornerCount / 3) > (size_t) std::numeric_limits<uint32_t>::max() / 3)
+            throw Exception("WavefrontOBJ: \"{}\" has too many faces", filename);
+        hasTexCoords &= texCoordOffset.back() > 0;
+        hasNormals &= normalOffset.back() > 0;
+
+        /* Concatenate the chunks, resolving relative indices and dropping incomplete attributes */
+        std::vector<float> positions(positionOffset.back() * 3), texCoords(texCoordOffset.back() * 2),
+                           normals(normalOffset.back() * 3);
+        std::vector<std::pair<ObjVertex, uint32_t>> corners(cornerCount);
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, chunkCount, 1),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i != range.end(); ++i) {
+                    ObjChunk &chunk = chunks[i];
+                    std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + positionOffset[i] * 3);
+                    std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), texCoords.begin() + texCoordOffset[i] * 2);
+                    std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + normalOffset[i] * 3);
+
+                    for (const ObjFixup &fixup : chunk.fixups) {
+                        const size_t *offsets[] = { positionOffset.data(), texCoordOffset.data(), normalOffset.data() };
+                        int64_t index = (int64_t) offsets[fixup.component][i] + fixup.index;
+                        uint32_t value = index >= 0 ? (uint32_t) index : PendingIndex;
+                        ObjVertex &v = chunk.corners[fixup.corner];
+                        (fixup.component == 0 ? v.p : fixup.component == 1 ? v.uv : v.n) = value;
+                    }
+
+                    for (size_t j = 0; j < chunk.corners.size(); ++j) {
+                        ObjVertex v = chunk.corners[j];
+                        if (!hasTexCoords)
+                            v.uv = NoIndex;
+                        if (!hasNormals)
+                            v.n = NoIndex;
+                        if (v.p >= positionOffset.back() ||
+                            (hasTexCoords && v.uv >= texCoordOffset.back()) ||
+                            (hasNormals && v.n >= normalOffset.back()))
+                            throw Exception("WavefrontOBJ: face index out of range in \"{}\"", filename);
+                        size_t corner = cornerOffset[i] + j;
+                        corners[corner] = { v, (uint32_t) corner };
+                    }
+                    chunk = ObjChunk();
+                }
+            }
+        );
+        std::vector<ObjChunk>().swap(chunks);
+
+        /* Merge corners with the same indices into one vertex. Sorting by the
+           position index first keeps the vertices in the order of the file. */
+        tbb::parallel_sort(corners.begin(), corners.end(),
+            [](const std::pair<ObjVertex, uint32_t> &a, const std::pair<ObjVertex, uint32_t> &b) {
+                return a.first < b.first || (a.first == b.first && a.second < b.second);
+            });
+
+        std::vector<uint32_t> vertexIndex(cornerCount);
+        uint32_t vertexCount = 0;
+        for (size_t i = 0; i < cornerCount; ++i) {
+            if (i > 0 && corners[i].first != corners[i - 1].first)
+                vertexCount++;
+            vertexIndex[i] = vertexCount;
+        }
+        vertexCount++;
+
+        m_vertexCount = vertexCount;
+        m_faceCount = (ScalarSize) (cornerCount / 3);
+        m_F = empty<DynamicBuffer<UInt32>>(cornerCount);
+        m_V = empty<FloatStorage>(3 * (size_t) vertexCount);
+        if (hasNormals)
+            m_N = empty<FloatStorage>(3 * (size_t) vertexCount);
+        if (hasTexCoords)
+            m_UV = empty<FloatStorage>(2 * (size_t) vertexCount);
+
+        uint32_t *F = (uint32_t *) m_F.data();
+        InputFloat *V = (InputFloat *) m_V.data(),
+                   *N = hasNormals ? (InputFloat *) m_N.data() : nullptr,
+                   *UV = hasTexCoords ? (InputFloat *) m_UV.data() : nullptr;
+
+        m_bbox = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, cornerCount, 1 << 14), ScalarBoundingBox3f(),
+            [&](const tbb::blocked_range<size_t> &range, ScalarBoundingBox3f bbox) {
+                for (size_t i = range.begin(); i != range.end(); ++i) {
+                    const ObjVertex &v = corners[i].first;
+                    uint32_t index = vertexIndex[i];
+                    F[corners[i].second] = index;
+
+                    /* Only the first corner of every vertex writes the attributes */
+                    if (i > 0 && vertexIndex[i - 1] == index)
+                        continue;
+
+                    ScalarPoint3f p = toWorld * ScalarPoint3f(positions[3 * v.p], positions[3 * v.p + 1],
+                                                              positions[3 * v.p + 2]);
+                    for (int k = 0; k < 3; ++k)
+                        V[3 * (size_t) index + k] = p[k];
+                    bbox.expand(p);
+
+                    if (N) {
+                        ScalarNormal3f n = normalize(toWorld * ScalarNormal3f(normals[3 * v.n], normals[3 * v.n + 1],
+                                                                              normals[3 * v.n + 2]));
+                        for (int k = 0; k < 3; ++k)
+                            N[3 * (size_t) index + k] = n[k];
+                    }
+                    if (UV) {
+                        UV[2 * (size_t) index] = texCoords[2 * v.uv];
+                        UV[2 * (size_t) index + 1] = texCoords[2 * v.uv + 1];
+                    }
+                }
+                return bbox;
+            },
+            [](ScalarBoundingBox3f a, const ScalarBoundingBox3f &b) {
+                a.expand(b);
+                return a;
+            }
+        );
+
+        double seconds = std::max(timer.elapsed(), (size_t) 1) * 1e-3;
+        std::cout << "Loaded \"" << filename << "\" (" << m_faceCount << " triangles, " << m_vertexCount
+                  << " vertices, " << util::memString(file.size()) << ", took " << timer.elapsedString()
+                  << ", " << fmt::format("{:.2f}", file.size() / seconds * 1e-9) << " GB/s)." << std::endl;
+
+        loadKeyFrames(props, "obj");
+    }
+};
+
+KAZEN_REGISTER_CLASS(WavefrontOBJ, "obj");
+NAMESPACE_END(kazen)
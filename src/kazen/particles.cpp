@@ -0,0 +1,79 @@
+#include <kazen/particles.h>
+#include <kazen/bsdf.h>
+
+NAMESPACE_BEGIN(kazen)
+
+Particles::Particles(const PropertyList &props) {
+    m_name = props.getString("name", "particles");
+    m_radius = props.getFloat("radius", 1.f);
+
+    std::string shape = props.getString("shape", "sphere");
+    if (shape == "sphere")
+        m_shape = ESphere;
+    else if (shape == "disk")
+        m_shape = EDisk;
+    else
+        throw Exception("Particles: unknown shape \"{}\" (expected \"sphere\" or \"disk\")", shape);
+
+    if (m_radius <= 0.f)
+        throw Exception("Particles: the radius must be positive (got {})", m_radius);
+}
+
+Particles::~Particles() {
+    delete m_bsdf;
+}
+
+void Particles::activate() {
+    if (!m_bsdf) {
+        /* If no material was assigned, instantiate a diffuse BRDF */
+        m_bsdf = static_cast<BSDF *>(ObjectFactory::createInstance("diffuse", PropertyList()));
+    }
+}
+
+void Particles::setParticles(const FloatStorage &centers, const FloatStorage &radii) {
+    if (slices(centers) % 3 != 0)
+        throw Exception("Particles::setParticles(): expected three values per center, got {} values!",
+                        slices(centers));
+    ScalarSize count = (ScalarSize) (slices(centers) / 3);
+    if (slices(radii) != 0 && slices(radii) != count)
+        throw Exception("Particles::setParticles(): expected {} radii, got {}!", count, slices(radii));
+
+    m_centers = centers;
+    m_radii = radii;
+    m_particleCount = count;
+
+    m_bbox.reset();
+    for (ScalarIndex i = 0; i < m_particleCount; ++i)
+        m_bbox.expand(getBoundingBox(i));
+}
+
+void Particles::addChild(Object *child) {
+    switch (child->getClassType()) {
+        case EBSDF:
+            if (m_bsdf)
+                throw Exception("Particles: tried to register multiple BSDF instances!");
+            m_bsdf = static_cast<BSDF *>(child);
+            break;
+
+        default:
+            throw Exception("Particles::addChild(<{}>) is not supported!", classTypeName(child->getClassType()));
+    }
+}
+
+std::string Particles::toString() const {
+    return fmt::format(
+        "Particles[\n"
+        "  name = \"{}\",\n"
+        "  shape = {},\n"
+        "  particles = {},\n"
+        "  bsdf = {}\n"
+        "]",
+        m_name,
+        m_shape == EDisk ? "disk" : "sphere",
+        m_particleCount,
+        m_bsdf ? string::indent(m_bsdf->toString()) : std::string("null")
+    );
+}
+
+KAZEN_REGISTER_CLASS(Particles, "particles");
+NAMESPACE_END(kazen)
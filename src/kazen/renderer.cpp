@@ -4,6 +4,8 @@
 #include <kazen/progress.h>
 #include <kazen/block.h>
 #include <kazen/rfilter.h>
+#include <kazen/accel.h>
+#include <kazen/bitmap.h>
 
 #include <tbb/tbb.h>
 #include <tbb/parallel_for.h>
@@ -26,6 +28,60 @@ void Renderer::renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &blo
     /* Clear the block contents */
     block.clear();
 
+    ScalarPoint2i offset = block.getOffset();
+    ScalarVector2i size  = block.getSize();
+
+#if defined(KAZEN_ENABLE_ACCEL_STATS)
+    /* Render the block one pixel at a time so that the traversal work of
+       every pixel can be attributed to it. Only the first lane is active,
+       otherwise the cost would be counted once per packet lane. */
+    Mask firstLane = eq(arange<UInt32>(), 0u);
+    for (int y = 0; y < size.y(); ++y) {
+        for (int x = 0; x < size.x(); ++x) {
+            AccelStatistics before = Accel::getThreadStatistics();
+            renderSample(scene, sampler, block,
+                         Vector2f(ScalarFloat(offset.x() + x) + .5f,
+                                  ScalarFloat(offset.y() + y) + .5f), firstLane);
+            size_t pixel = (offset.y() + y) * (size_t) m_outputSize.x() + offset.x() + x;
+            m_traversalCost[pixel] = (ScalarFloat) (Accel::getThreadStatistics() - before).cost();
+        }
+    }
+#else
+    /* Render one packet of pixels at a time, masking off the lanes past the end of the block */
+    uint32_t pixelCount = (uint32_t) hprod(size);
+    for (uint32_t i = 0; i < pixelCount; i += (uint32_t) Float::Size) {
+        UInt32 index = arange<UInt32>() + i;
+        Mask active = index < pixelCount;
+        UInt32 y = index / (uint32_t) size.x(),
+               x = index - y * (uint32_t) size.x();
+        renderSample(scene, sampler, block,
+                     Vector2f(Float(x + offset.x()) + .5f,
+                              Float(y + offset.y()) + .5f), active);
+    }
+#endif
+}
+
+void Renderer::saveTraversalCost(const std::vector<ScalarFloat> &cost, const ScalarVector2i &size,
+                                 const std::string &filename) {
+    ScalarFloat maxCost = 0.f;
+    for (ScalarFloat c : cost)
+        maxCost = std::max(maxCost, c);
+    if (maxCost == 0.f)
+        return;
+
+    /* Map the normalized cost onto a blue-green-red ramp */
+    Bitmap bitmap(size);
+    for (int y = 0; y < size.y(); ++y) {
+        for (int x = 0; x < size.x(); ++x) {
+            ScalarFloat c = cost[y * (size_t) size.x() + x] / maxCost;
+            ScalarColor3f color(
+                std::clamp(1.5f - std::abs(4.f * c - 3.f), 0.f, 1.f),
+                std::clamp(1.5f - std::abs(4.f * c - 2.f), 0.f, 1.f),
+                std::clamp(1.5f - std::abs(4.f * c - 1.f), 0.f, 1.f));
+            bitmap.setPixel(ScalarPoint2i(x, y), toLinearRGB(color));
+        }
+    }
+    bitmap.savePNG(filename + "_traversal");
 }
 
 
@@ -33,6 +89,11 @@ void Renderer::render(Scene *scene, const std::string &filename) {
 
     // FIXME
     ScalarVector2i outputSize(1000, 1000);
+    m_outputSize = outputSize;
+#if defined(KAZEN_ENABLE_ACCEL_STATS)
+    m_traversalCost.assign(outputSize.x() * (size_t) outputSize.y(), 0.f);
+    Accel::resetStatistics();
+#endif
     
     /* Create a block generator (i.e. a work scheduler) */
     BlockGenerator blockGenerator(outputSize, KAZEN_BLOCK_SIZE);
@@ -92,6 +153,10 @@ void Renderer::render(Scene *scene, const std::string &filename) {
     /* Shut down the user interface */
     render_thread.join();
 
+#if defined(KAZEN_ENABLE_ACCEL_STATS)
+    std::cout << Accel::getStatistics().toString() << std::endl;
+    saveTraversalCost(m_traversalCost, m_outputSize, filename);
+#endif
 
 }
 
@@ -7,8 +7,8 @@
 
 NAMESPACE_BEGIN(kazen)
 
-Scene::Scene(const PropertyList &) {
-    m_accel = new Accel();
+Scene::Scene(const PropertyList &props) {
+    m_accel = new Accel(props);
 }
 
 Scene::~Scene() {
@@ -44,6 +44,12 @@ void Scene::addChild(Object *obj) {
                 m_meshes.push_back(mesh);
             }
             break;
+        case EInstance:
+            m_accel->addInstance(static_cast<Instance *>(obj));
+            break;
+        case EParticles:
+            m_accel->addParticles(static_cast<Particles *>(obj));
+            break;
         case ELight: {
                 // Light *light = static_cast<Light *>(obj);
                 /* TBD */